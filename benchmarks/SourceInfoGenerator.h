@@ -0,0 +1,215 @@
+#ifndef SOURCE_INFO_GENERATOR_H
+#define SOURCE_INFO_GENERATOR_H
+
+// Writes synthetic but valid .swiftsourceinfo files, laid out like the ones the Swift compiler
+// writes, for the benchmarks.
+
+#include "../srcs/SwiftInternals.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Bitstream/BitstreamWriter.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct SourceInfoShape {
+  unsigned NumFiles = 100;
+  unsigned NumUSRs = 10000;
+  // Every USR gets this many doc ranges. Zero leaves DocRanges empty.
+  unsigned DocRangesPerUSR = 1;
+  // The length of the source paths, padded with directories
+  unsigned PathLength = 96;
+  // The version of the format, which gives the layout of the records
+  swift::serialization::SourceInfoLayoutID Layout =
+      swift::serialization::SourceInfoLayoutCurrent::ID;
+};
+
+namespace source_info_generator {
+
+using namespace llvm;
+using namespace swift::serialization;
+
+// The DeclUSRs table, as Swift writes it
+class DeclUSRTableWriterInfo {
+public:
+  using key_type = StringRef;
+  using key_type_ref = StringRef;
+  using data_type = uint32_t;
+  using data_type_ref = uint32_t;
+  using hash_value_type = uint32_t;
+  using offset_type = unsigned;
+
+  hash_value_type ComputeHash(key_type_ref Key) {
+    return llvm::djbHash(Key, SWIFTSOURCEINFO_HASH_SEED);
+  }
+
+  std::pair<unsigned, unsigned> EmitKeyDataLength(raw_ostream &Out, key_type_ref Key,
+                                                  data_type_ref) {
+    support::endian::write<uint32_t>(Out, Key.size(), llvm::endianness::little);
+    return {Key.size(), sizeof(uint32_t)};
+  }
+
+  void EmitKey(raw_ostream &Out, key_type_ref Key, unsigned) { Out << Key; }
+
+  void EmitData(raw_ostream &Out, key_type_ref, data_type_ref Data, unsigned) {
+    support::endian::write<uint32_t>(Out, Data, llvm::endianness::little);
+  }
+};
+
+// The record codes of DECL_LOCS_BLOCK
+enum : unsigned {
+  BASIC_DECL_LOCS = 1,
+  DECL_USRS,
+  TEXT_DATA,
+  DOC_RANGES,
+  SOURCE_FILE_LIST,
+};
+
+inline unsigned emitBlobAbbrev(BitstreamWriter &Writer, unsigned Code, bool WithOffset) {
+  auto Abbrev = std::make_shared<BitCodeAbbrev>();
+  Abbrev->Add(BitCodeAbbrevOp(Code));
+  if (WithOffset)
+    Abbrev->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::VBR, 16));
+  Abbrev->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Blob));
+  return Writer.EmitAbbrev(std::move(Abbrev));
+}
+
+template <typename Layout>
+void generateSourceInfo(const SourceInfoShape &Shape, SmallVectorImpl<char> &Out) {
+  using SourceFileRecord = typename Layout::SourceFileRecord;
+  using DeclLocRecord = typename Layout::DeclLocRecord;
+  using DocRangeRecord = typename Layout::DocRangeRecord;
+
+  // TextData starts with the empty path, which FileID 0 refers to
+  std::string TextData(1, '\0');
+  std::vector<uint32_t> FileIDs;
+  for (unsigned I = 0; I < Shape.NumFiles; I++) {
+    std::string Path = formatv("/Users/builder/Project/Module{0}", I % 32);
+    std::string FileName = formatv("/File{0}.swift", I);
+    while (Path.size() + FileName.size() + 4 <= Shape.PathLength)
+      Path += "/Dir";
+    FileIDs.push_back(TextData.size());
+    TextData += Path + FileName;
+    TextData.push_back('\0');
+  }
+
+  std::string SourceFileList;
+  for (unsigned I = 0; I < Shape.NumFiles; I++) {
+    SourceFileRecord Record{};
+    Record.FileID = FileIDs[I];
+    std::memset(Record.Fingerprint1, 'a' + I % 26, sizeof(Record.Fingerprint1));
+    if constexpr (Layout::HasFingerprint2)
+      std::memset(Record.Fingerprint2, 'A' + I % 26, sizeof(Record.Fingerprint2));
+    Record.Timestamp = 1700000000000000000ull + I;
+    Record.FileSize = 1000 + I;
+    SourceFileList.append(reinterpret_cast<const char *>(&Record), sizeof(Record));
+  }
+
+  // DocRanges starts with a reserved byte, so offset 0 means no doc ranges
+  std::string DocRanges(1, '\0');
+  std::string BasicDeclLocs;
+  std::vector<std::string> USRs;
+  for (unsigned I = 0; I < Shape.NumUSRs; I++) {
+    uint32_t FileID = Shape.NumFiles ? FileIDs[I % Shape.NumFiles] : 0;
+    DeclLocRecord Record{};
+    Record.FileID = FileID;
+    if (Shape.DocRangesPerUSR > 0) {
+      Record.DocRanges = DocRanges.size();
+      uint32_t Count = Shape.DocRangesPerUSR;
+      DocRanges.append(reinterpret_cast<const char *>(&Count), sizeof(Count));
+      for (unsigned K = 0; K < Count; K++) {
+        DocRangeRecord Range{};
+        Range.Loc.Line = I + 1;
+        Range.Loc.Column = K + 1;
+        Range.Length = 16;
+        if constexpr (Layout::HasRawLocs) {
+          Range.Loc.Offset = I * 64;
+          Range.Loc.FileID = FileID;
+        }
+        DocRanges.append(reinterpret_cast<const char *>(&Range), sizeof(Range));
+      }
+    }
+    for (unsigned K = 0; K < 3; K++) {
+      Record.Locs[K].Line = I + 1;
+      Record.Locs[K].Column = K * 4 + 1;
+      if constexpr (Layout::HasRawLocs) {
+        Record.Locs[K].Offset = I * 64 + K;
+        Record.Locs[K].FileID = FileID;
+      }
+    }
+    BasicDeclLocs.append(reinterpret_cast<const char *>(&Record), sizeof(Record));
+    USRs.push_back(formatv("s:9BenchCore4Decl{0}V", I));
+  }
+
+  // The USR table comes after a leading zero word, like in DeclUSRs
+  SmallString<0> DeclUSRs;
+  uint32_t TableOffset;
+  {
+    OnDiskChainedHashTableGenerator<DeclUSRTableWriterInfo> Generator;
+    for (unsigned I = 0; I < Shape.NumUSRs; I++)
+      Generator.insert(USRs[I], I);
+    raw_svector_ostream Stream(DeclUSRs);
+    support::endian::write<uint32_t>(Stream, 0, llvm::endianness::little);
+    TableOffset = Generator.Emit(Stream);
+  }
+
+  Out.clear();
+  BitstreamWriter Writer(Out);
+  for (unsigned char Byte : SWIFTSOURCEINFO_SIGNATURE)
+    Writer.Emit(Byte, 8);
+
+  Writer.EnterSubblock(CONTROL_BLOCK_ID, 3);
+  {
+    // METADATA: major and minor version, then the compiler version
+    auto Abbrev = std::make_shared<BitCodeAbbrev>();
+    Abbrev->Add(BitCodeAbbrevOp(1));
+    Abbrev->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::VBR, 16));
+    Abbrev->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::VBR, 16));
+    Abbrev->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Blob));
+    unsigned AbbrevID = Writer.EmitAbbrev(std::move(Abbrev));
+    uint64_t Fields[] = {CONTROL_METADATA, Layout::MajorVersion, 0};
+    Writer.EmitRecordWithBlob(AbbrevID, Fields, StringRef("Swift version 5.10"));
+  }
+  Writer.ExitBlock();
+
+  Writer.EnterSubblock(MODULE_SOURCEINFO_BLOCK_ID, 3);
+  Writer.EnterSubblock(DECL_LOCS_BLOCK_ID, 4);
+  // Defined in the order that gives them the abbrev IDs of the layout
+  unsigned SourceFileListAbbrev = Layout::SourceFileListAbbrevID
+                                      ? emitBlobAbbrev(Writer, SOURCE_FILE_LIST, false)
+                                      : 0;
+  unsigned BasicDeclLocsAbbrev = emitBlobAbbrev(Writer, BASIC_DECL_LOCS, false);
+  unsigned DeclUSRsAbbrev = emitBlobAbbrev(Writer, DECL_USRS, true);
+  unsigned TextDataAbbrev = emitBlobAbbrev(Writer, TEXT_DATA, false);
+  unsigned DocRangesAbbrev = emitBlobAbbrev(Writer, DOC_RANGES, false);
+  assert(SourceFileListAbbrev == Layout::SourceFileListAbbrevID &&
+         DocRangesAbbrev == Layout::DocRangesAbbrevID && "abbrev IDs out of sync");
+
+  uint64_t BasicDeclLocsFields[] = {BASIC_DECL_LOCS};
+  Writer.EmitRecordWithBlob(BasicDeclLocsAbbrev, BasicDeclLocsFields, BasicDeclLocs);
+  uint64_t DeclUSRsFields[] = {DECL_USRS, TableOffset};
+  Writer.EmitRecordWithBlob(DeclUSRsAbbrev, DeclUSRsFields, DeclUSRs.str());
+  uint64_t TextDataFields[] = {TEXT_DATA};
+  Writer.EmitRecordWithBlob(TextDataAbbrev, TextDataFields, TextData);
+  uint64_t DocRangesFields[] = {DOC_RANGES};
+  Writer.EmitRecordWithBlob(DocRangesAbbrev, DocRangesFields, DocRanges);
+  if (SourceFileListAbbrev) {
+    uint64_t SourceFileListFields[] = {SOURCE_FILE_LIST};
+    Writer.EmitRecordWithBlob(SourceFileListAbbrev, SourceFileListFields, SourceFileList);
+  }
+  Writer.ExitBlock();
+  Writer.ExitBlock();
+}
+
+} // namespace source_info_generator
+
+inline void generateSourceInfo(const SourceInfoShape &Shape, llvm::SmallVectorImpl<char> &Out) {
+  swift::serialization::withSourceInfoLayout(Shape.Layout, [&](auto L) {
+    source_info_generator::generateSourceInfo<decltype(L)>(Shape, Out);
+  });
+}
+
+#endif // SOURCE_INFO_GENERATOR_H
@@ -0,0 +1,97 @@
+// Compares the compiled remap rules with applying the same rules through `std::regex_replace`,
+// which is what the tool used to do.
+//
+//   $ ./remap-benchmark [<number of paths>]
+
+#include "../srcs/RemapRules.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <regex>
+
+using namespace llvm;
+
+namespace {
+
+struct Scenario {
+  const char *Name;
+  std::vector<std::pair<std::string, std::string>> Rules;
+};
+
+std::vector<std::string> makePaths(unsigned Count) {
+  std::vector<std::string> Paths;
+  for (unsigned I = 0; I < Count; I++)
+    Paths.push_back(formatv("/Users/builder{0}/MyProject/Module{1}/Sources/Feature{2}/File{3}.swift",
+                            I % 16, I % 64, I % 7, I));
+  return Paths;
+}
+
+template <typename Fn> double measureNanosPerPath(const std::vector<std::string> &Paths, Fn &&F) {
+  size_t Checksum = 0;
+  auto Start = std::chrono::steady_clock::now();
+  for (const auto &Path : Paths)
+    Checksum += F(Path).size();
+  auto End = std::chrono::steady_clock::now();
+  if (Checksum == 0)
+    errs() << "unexpected empty output\n";
+  return std::chrono::duration<double, std::nano>(End - Start).count() / Paths.size();
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  unsigned Count = argc > 1 ? std::stoul(argv[1]) : 20000;
+  std::vector<std::string> Paths = makePaths(Count);
+
+  std::vector<Scenario> Scenarios = {
+      {"anchored literal", {{"^/Users/builder3/MyProject", "/src/MyProject"}}},
+      {"prefix regex", {{"/Users/.*/MyProject", "/src/MyProject"}}},
+      {"capture groups", {{"^/Users/([^/]+)/(\\w+)", "/home/$1/$2"}}},
+      {"10 literal rules",
+       {{"^/Users/builder0/MyProject", "/a"},
+        {"^/Users/builder1/MyProject", "/b"},
+        {"^/Users/builder2/MyProject", "/c"},
+        {"^/Users/builder3/MyProject", "/d"},
+        {"^/Users/builder4/MyProject", "/e"},
+        {"^/Users/builder5/MyProject", "/f"},
+        {"^/Users/builder6/MyProject", "/g"},
+        {"^/Users/builder7/MyProject", "/h"},
+        {"^/Users/builder8/MyProject", "/i"},
+        {"^/Users/builder9/MyProject", "/j"}}},
+      {"chained rules",
+       {{"/Users/[^/]+/", "/src/"}, {"\\.swift$", ".swift"}, {"Module(\\d+)", "M$1"}}},
+  };
+
+  outs() << formatv("{0,-18} {1,14} {2,14} {3,8}\n", "scenario", "std::regex", "compiled",
+                    "speedup");
+  for (const auto &S : Scenarios) {
+    RemapRuleSet Compiled;
+    std::vector<std::pair<std::regex, std::string>> Regexes;
+    for (const auto &Rule : S.Rules) {
+      Compiled.addRule(Rule.first, Rule.second);
+      Regexes.emplace_back(std::regex(Rule.first), Rule.second);
+    }
+
+    auto ApplyRegexes = [&](const std::string &Path) {
+      std::string Result = Path;
+      for (const auto &Rule : Regexes)
+        Result = std::regex_replace(Result, Rule.first, Rule.second);
+      return Result;
+    };
+    auto ApplyCompiled = [&](const std::string &Path) { return Compiled.apply(Path); };
+
+    for (const auto &Path : Paths) {
+      if (ApplyRegexes(Path) != ApplyCompiled(Path)) {
+        errs() << formatv("{0}: results differ for {1}\n", S.Name, Path);
+        return 1;
+      }
+    }
+
+    double RegexNanos = measureNanosPerPath(Paths, ApplyRegexes);
+    double CompiledNanos = measureNanosPerPath(Paths, ApplyCompiled);
+    outs() << formatv("{0,-18} {1,11:f1} ns {2,11:f1} ns {3,7:f1}x\n", S.Name, RegexNanos,
+                      CompiledNanos, RegexNanos / CompiledNanos);
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+// Measures the end-to-end latency of remapping a file through a `--serve` server, against spawning
+// the tool for every file. It starts the server from the given binary, checks that both ways write
+// the same output, and stops the server.
+//
+//   $ ./serve-latency ./source-info-import <file.swiftsourceinfo> [<number of requests>]
+
+#include "../srcs/Server.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+using namespace llvm;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double microsSince(Clock::time_point Start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - Start).count();
+}
+
+void printLatencies(StringRef Name, std::vector<double> &Micros) {
+  std::sort(Micros.begin(), Micros.end());
+  outs() << formatv("{0,-8} {1,10:f1} us {2,10:f1} us {3,10:f1} us\n", Name,
+                    Micros[Micros.size() / 2], Micros[Micros.size() * 9 / 10], Micros.back());
+}
+
+bool sameContent(StringRef A, StringRef B) {
+  auto BufferA = MemoryBuffer::getFile(A);
+  auto BufferB = MemoryBuffer::getFile(B);
+  return BufferA && BufferB && (*BufferA)->getBuffer() == (*BufferB)->getBuffer();
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    errs() << "usage: serve-latency <source-info-import> <file.swiftsourceinfo> [<requests>]\n";
+    return 1;
+  }
+  std::string Binary = argv[1];
+  SmallString<256> Input(argv[2]);
+  unsigned Count = argc > 3 ? std::stoul(argv[3]) : 200;
+  sys::fs::make_absolute(Input);
+
+  std::string Socket = formatv("/tmp/serve-latency-{0}.sock", sys::Process::getProcessId());
+  SmallString<256> ServedOutput, SpawnedOutput;
+  if (sys::fs::createTemporaryFile("served", "swiftsourceinfo", ServedOutput) ||
+      sys::fs::createTemporaryFile("spawned", "swiftsourceinfo", SpawnedOutput)) {
+    errs() << "cannot create the output files\n";
+    return 1;
+  }
+
+  // An anchored literal rule, so the remapping itself is cheap and the overhead stands out
+  std::string Remap = "--remap=^/=/";
+  std::string ServeArg = "--serve=" + Socket;
+  sys::ProcessInfo Server =
+      sys::ExecuteNoWait(Binary, {Binary, ServeArg, Remap, "-quiet"}, std::nullopt);
+
+  int FD = -1;
+  for (int Attempt = 0; Attempt < 500 && FD < 0; Attempt++) {
+    Expected<int> Connected = connectToServer(Socket);
+    if (Connected) {
+      FD = *Connected;
+    } else {
+      consumeError(Connected.takeError());
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  if (FD < 0) {
+    errs() << "the server didn't start\n";
+    return 1;
+  }
+
+  std::vector<double> Served;
+  for (unsigned I = 0; I < Count; I++) {
+    auto Start = Clock::now();
+    Expected<ServeResponse> Response = sendServeRequest(FD, {"remap", Input, ServedOutput});
+    Served.push_back(microsSince(Start));
+    if (!Response || Response->ExitCode != 0) {
+      errs() << "remap request failed: "
+             << (Response ? Response->Errors : toString(Response.takeError())) << "\n";
+      return 1;
+    }
+  }
+
+  std::vector<double> Spawned;
+  for (unsigned I = 0; I < Count; I++) {
+    auto Start = Clock::now();
+    int ExitCode =
+        sys::ExecuteAndWait(Binary, {Binary, "-quiet", Remap, Input, SpawnedOutput}, std::nullopt);
+    Spawned.push_back(microsSince(Start));
+    if (ExitCode != 0) {
+      errs() << "spawned remap failed\n";
+      return 1;
+    }
+  }
+
+  if (Expected<ServeResponse> Response = sendServeRequest(FD, {"shutdown"}))
+    sys::Wait(Server, std::nullopt);
+  else
+    consumeError(Response.takeError());
+  ::close(FD);
+
+  if (!sameContent(ServedOutput, SpawnedOutput)) {
+    errs() << "the served and the spawned outputs differ\n";
+    return 1;
+  }
+  sys::fs::remove(ServedOutput);
+  sys::fs::remove(SpawnedOutput);
+
+  outs() << formatv("{0,-8} {1,13} {2,13} {3,13}\n", "", "p50", "p90", "max");
+  printLatencies("served", Served);
+  printLatencies("spawned", Spawned);
+  return 0;
+}
@@ -0,0 +1,295 @@
+// Measures the phases of the tool on synthetic .swiftsourceinfo files of a few sizes and versions:
+// parsing, remapping, rewriting and printing, in MB/s of input and records/s, then the latency of
+// remapping a whole file from disk to disk. Each file is first checked to remap correctly, and to
+// diff against a changed copy of itself. With --write, it only writes a synthetic file.
+//
+//   $ ./sourceinfo-benchmark
+//   $ ./sourceinfo-benchmark --write <output> <files> <USRs> <doc ranges per USR> <path length>
+//         [<major version>]
+
+#include "../srcs/Remapper.h"
+#include "../srcs/SourceInfo.h"
+#include "../srcs/SourceInfoDiff.h"
+#include "../srcs/SourceInfoFile.h"
+#include "SourceInfoGenerator.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+
+using namespace llvm;
+using namespace swift::serialization;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Size {
+  const char *Name;
+  SourceInfoShape Shape;
+};
+
+ExitOnError ExitOnErr("sourceinfo-benchmark: ");
+
+// Runs `Setup` untimed and then `Run` timed, until the timed runs add up to `MinSeconds`, and at
+// least three times. Returns the seconds per run.
+template <typename SetupFn, typename RunFn>
+double secondsPerRun(SetupFn &&Setup, RunFn &&Run, double MinSeconds = 0.3) {
+  double Total = 0;
+  unsigned Runs = 0;
+  while (Runs < 3 || Total < MinSeconds) {
+    Setup();
+    auto Start = Clock::now();
+    Run();
+    Total += std::chrono::duration<double>(Clock::now() - Start).count();
+    Runs++;
+  }
+  return Total / Runs;
+}
+
+std::unique_ptr<SwiftSourceInfo> parse(MemoryBufferRef Input) {
+  BitstreamCursor Cursor{Input};
+  if (!checkMagicNumber(Cursor))
+    ExitOnErr(createStringError(std::errc::invalid_argument, "bad signature"));
+  return ExitOnErr(parseSwiftSourceInfo(Cursor));
+}
+
+std::unique_ptr<FilePathRemapper> makeRemapper() {
+  auto Remapper = std::make_unique<FilePathRemapper>();
+  Remapper->addRemap("^/Users/builder", "/src");
+  return Remapper;
+}
+
+void writeFile(StringRef Path, StringRef Data) {
+  std::error_code EC;
+  raw_fd_ostream Out(Path, EC);
+  if (EC)
+    ExitOnErr(createStringError(EC, "%s: %s", Path.str().c_str(), EC.message().c_str()));
+  Out << Data;
+}
+
+// Remaps the file, parses the output again, and checks that every declaration is where it was,
+// in the remapped file, and that the layout is kept
+void checkRoundTrip(const Size &S, MemoryBufferRef Input) {
+  std::unique_ptr<SwiftSourceInfo> SSI = parse(Input);
+  std::unique_ptr<FilePathRemapper> Remapper = makeRemapper();
+  std::vector<std::pair<std::string, SwiftSourceInfo::DeclLocation>> Before;
+  SSI->forEachUSR([&](StringRef USR, const SwiftSourceInfo::DeclLocation &Loc) {
+    Before.emplace_back(USR.str(), Loc);
+  });
+
+  SourceInfoArena Arena;
+  SmallVector<char, 0> Output, Block;
+  FileIDRemapper FIDRemapper(*Remapper, Arena, nulls());
+  SSI->remapFilePath(FIDRemapper, /*Quiet=*/true);
+  ExitOnErr(rewriteSwiftSourceInfo(*SSI, Input, Output, Block));
+  std::unique_ptr<SwiftSourceInfo> Remapped =
+      parse(MemoryBufferRef(StringRef(Output.data(), Output.size()), S.Name));
+
+  auto Fail = [&](const Twine &Message) {
+    ExitOnErr(createStringError(std::errc::invalid_argument, "%s: %s", S.Name,
+                                Message.str().c_str()));
+  };
+  if (Remapped->getLayout() != S.Shape.Layout)
+    Fail("the layout changed");
+  size_t I = 0;
+  Remapped->forEachUSR([&](StringRef USR, const SwiftSourceInfo::DeclLocation &Loc) {
+    if (I >= Before.size())
+      return Fail("too many USRs");
+    const auto &[ExpectedUSR, ExpectedLoc] = Before[I++];
+    if (USR != ExpectedUSR || Loc.FilePath != Remapper->remap(ExpectedLoc.FilePath) ||
+        Loc.Line != ExpectedLoc.Line || Loc.Column != ExpectedLoc.Column)
+      Fail("'" + USR + "' moved to " + Loc.FilePath);
+  });
+  if (I != Before.size())
+    Fail("USRs are missing");
+}
+
+// Moves one declaration, changes only the end of another and the length of a documentation range
+// of a third and, on the layouts that have it, the second fingerprint of a source file in a copy
+// of the file, and checks that the diff finds exactly those. A copy with only the documentation
+// range changed has every other section the same.
+void checkDiff(const Size &S, MemoryBufferRef Input) {
+  std::unique_ptr<SourceInfo> Old = ExitOnErr(SourceInfo::parse(Input));
+  auto OffsetOf = [&](const void *P) {
+    return static_cast<const char *>(P) - Input.getBufferStart();
+  };
+  auto Increment = [](std::string &Data, size_t Offset) {
+    uint32_t Value;
+    std::memcpy(&Value, &Data[Offset], sizeof(Value));
+    Value++;
+    std::memcpy(&Data[Offset], &Value, sizeof(Value));
+  };
+  auto Check = [&](StringRef Data, long Moved, long Changed, long ChangedFiles) {
+    std::unique_ptr<SourceInfo> New =
+        ExitOnErr(SourceInfo::parse(MemoryBufferRef(Data, S.Name)));
+    std::vector<SourceInfoChange> Changes = diffSourceInfo(*Old, *New);
+    auto Count = [&](SourceInfoChange::KindType Kind, SourceInfoChange::ActionType Action) {
+      return llvm::count_if(Changes, [&](const SourceInfoChange &Change) {
+        return Change.Kind == Kind && Change.Action == Action;
+      });
+    };
+    long Expected = Moved + Changed + ChangedFiles;
+    if (Count(SourceInfoChange::Decl, SourceInfoChange::Moved) != Moved ||
+        Count(SourceInfoChange::Decl, SourceInfoChange::Changed) != Changed ||
+        Count(SourceInfoChange::SourceFile, SourceInfoChange::Changed) != ChangedFiles ||
+        Changes.size() != size_t(Expected))
+      ExitOnErr(createStringError(std::errc::invalid_argument,
+                                  "%s: the diff found %zu changes instead of %ld", S.Name,
+                                  Changes.size(), Expected));
+  };
+
+  std::string Data = Input.getBuffer().str();
+  std::string DocRangesOnly = Data;
+  long ChangedFiles = 0;
+  Old->withLayout([&](auto L) {
+    using Layout = decltype(L);
+    auto Decls = Old->getDeclLocs<Layout>();
+    Increment(Data, OffsetOf(&Decls[0].Locs[0].Column));
+    Increment(Data, OffsetOf(&Decls[1].Locs[2].Column));
+    size_t DocRange = OffsetOf(&Old->getDocRanges<Layout>(Decls[2]).front().Length);
+    Increment(Data, DocRange);
+    Increment(DocRangesOnly, DocRange);
+    if constexpr (Layout::HasFingerprint2) {
+      Data[OffsetOf(Old->getSourceFiles<Layout>().front().Fingerprint2)]++;
+      ChangedFiles++;
+    }
+  });
+  Check(Data, /*Moved=*/1, /*Changed=*/2, ChangedFiles);
+  Check(DocRangesOnly, /*Moved=*/0, /*Changed=*/1, /*ChangedFiles=*/0);
+}
+
+void benchmarkSize(const Size &S) {
+  SmallVector<char, 0> Data;
+  generateSourceInfo(S.Shape, Data);
+  MemoryBufferRef Input(StringRef(Data.data(), Data.size()), S.Name);
+  checkRoundTrip(S, Input);
+  checkDiff(S, Input);
+  double Megabytes = Data.size() / 1e6;
+  double Records = S.Shape.NumFiles + S.Shape.NumUSRs * (1 + S.Shape.DocRangesPerUSR);
+
+  auto Report = [&](StringRef Phase, double Seconds) {
+    outs() << formatv("{0,-10} {1,-8} {2,12:f1} {3,14:f2}\n", S.Name, Phase, Megabytes / Seconds,
+                      Records / Seconds / 1e6);
+  };
+
+  std::unique_ptr<SwiftSourceInfo> SSI;
+  std::unique_ptr<FilePathRemapper> Remapper;
+  SourceInfoArena Arena;
+  SmallVector<char, 0> Output, Block;
+
+  // The sections are read on first use, so the parse reads them all to time what it used to
+  Report("parse", secondsPerRun([] {}, [&] {
+           SSI = parse(Input);
+           SSI->getSourceFileList();
+           SSI->getBasicDeclLocs();
+           SSI->getDocRanges();
+           SSI->getTextData();
+           SSI->getDeclUSRs();
+         }));
+
+  Report("remap", secondsPerRun(
+                      [&] {
+                        SSI = parse(Input);
+                        Remapper = makeRemapper();
+                      },
+                      [&] {
+                        FileIDRemapper FIDRemapper(*Remapper, Arena, nulls());
+                        SSI->remapFilePath(FIDRemapper, /*Quiet=*/true);
+                      }));
+
+  Report("rewrite", secondsPerRun(
+                        [&] {
+                          SSI = parse(Input);
+                          FileIDRemapper FIDRemapper(*Remapper, Arena, nulls());
+                          SSI->remapFilePath(FIDRemapper, /*Quiet=*/true);
+                        },
+                        [&] { ExitOnErr(rewriteSwiftSourceInfo(*SSI, Input, Output, Block)); }));
+
+  Report("print", secondsPerRun([&] { SSI = parse(Input); }, [&] { SSI->printContent(nulls()); }));
+}
+
+// Reads, remaps and writes a whole file, like the remap mode does, and returns the milliseconds
+// it takes
+double wholeFileMillis(const Size &S) {
+  SmallVector<char, 0> Data;
+  generateSourceInfo(S.Shape, Data);
+
+  SmallString<256> InputPath, OutputPath;
+  ExitOnErr(errorCodeToError(
+      sys::fs::createTemporaryFile("benchmark-input", "swiftsourceinfo", InputPath)));
+  ExitOnErr(errorCodeToError(
+      sys::fs::createTemporaryFile("benchmark-output", "swiftsourceinfo", OutputPath)));
+  writeFile(InputPath, StringRef(Data.data(), Data.size()));
+
+  SourceInfoArena Arena;
+  SmallVector<char, 0> Block;
+  std::unique_ptr<FilePathRemapper> Remapper;
+  // The output is removed before every run, so that the write isn't skipped as unchanged
+  double Seconds = secondsPerRun(
+      [&] {
+        Remapper = makeRemapper();
+        sys::fs::remove(OutputPath);
+      },
+      [&] {
+        std::unique_ptr<MemoryBuffer> MB;
+        auto SSI = ExitOnErr(loadSourceInfo(InputPath, MB));
+        FileIDRemapper FIDRemapper(*Remapper, Arena, nulls());
+        SSI->remapFilePath(FIDRemapper, /*Quiet=*/true);
+        SourceInfoRewrite Rewrite = ExitOnErr(prepareRewrite(*SSI, MB->getMemBufferRef(), Block));
+        ExitOnErr(writeSourceInfoFile(OutputPath, Rewrite));
+      });
+
+  sys::fs::remove(InputPath);
+  sys::fs::remove(OutputPath);
+  return Seconds * 1e3;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  if (argc > 1 && StringRef(argv[1]) == "--write") {
+    if (argc != 7 && argc != 8) {
+      errs() << "usage: sourceinfo-benchmark --write <output> <files> <USRs> "
+                "<doc ranges per USR> <path length> [<major version>]\n";
+      return 1;
+    }
+    SourceInfoShape Shape;
+    Shape.NumFiles = std::stoul(argv[3]);
+    Shape.NumUSRs = std::stoul(argv[4]);
+    Shape.DocRangesPerUSR = std::stoul(argv[5]);
+    Shape.PathLength = std::stoul(argv[6]);
+    if (argc == 8) {
+      std::optional<SourceInfoLayoutID> Layout = getSourceInfoLayout(std::stoul(argv[7]));
+      if (!Layout) {
+        errs() << "sourceinfo-benchmark: unsupported version " << argv[7] << "\n";
+        return 1;
+      }
+      Shape.Layout = *Layout;
+    }
+
+    SmallVector<char, 0> Data;
+    generateSourceInfo(Shape, Data);
+    writeFile(argv[2], StringRef(Data.data(), Data.size()));
+    return 0;
+  }
+
+  std::vector<Size> Sizes = {
+      {"small", {/*NumFiles=*/10, /*NumUSRs=*/500, /*DocRangesPerUSR=*/1, /*PathLength=*/80}},
+      {"medium", {200, 20000, 1, 96}},
+      {"huge", {2000, 500000, 2, 128}},
+      // The older layouts, at the medium size
+      {"medium-v1", {200, 20000, 1, 96, SourceInfoLayoutID::V1}},
+      {"medium-v2", {200, 20000, 1, 96, SourceInfoLayoutID::V2}},
+  };
+
+  outs() << formatv("{0,-10} {1,-8} {2,12} {3,14}\n", "size", "phase", "MB/s", "Mrecords/s");
+  for (const Size &S : Sizes)
+    benchmarkSize(S);
+
+  outs() << formatv("\n{0,-10} {1,12}\n", "size", "whole file");
+  for (const Size &S : Sizes)
+    outs() << formatv("{0,-10} {1,9:f2} ms\n", S.Name, wholeFileMillis(S));
+  return 0;
+}
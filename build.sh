@@ -7,12 +7,62 @@ LLVM_BUILD_DIR="$HOME/OpenSource/SwiftProject/build/Ninja-ReleaseAssert/llvm-mac
 DEBUG_FLAGS=(-g -O0)
 RELEASE_FLAGS=(-O3 -DNDEBUG)
 
+# The library, for tools that link it instead of spawning the binary. The public header is
+# srcs/SourceInfo.h.
+LIB_SRCS=(
+    srcs/FilePipeline.cpp
+    srcs/RemapRules.cpp
+    srcs/ResultCache.cpp
+    srcs/Server.cpp
+    srcs/SourceInfo.cpp
+    srcs/SourceInfoDiff.cpp
+    srcs/SourceInfoDump.cpp
+    srcs/SourceInfoFile.cpp
+    srcs/SwiftSourceInfo.cpp
+    srcs/TarStream.cpp
+    srcs/USRIndex.cpp
+)
+rm -rf build/lib && mkdir -p build/lib
+for SRC in ${LIB_SRCS[@]}; do
+    xcrun clang++ ${RELEASE_FLAGS[@]} \
+        $($LLVM_BUILD_DIR/bin/llvm-config --cxxflags) \
+        -c $SRC -o build/lib/${${SRC:t}:r}.o
+done
+rm -f libsourceinfoimport.a
+ar rcs libsourceinfoimport.a build/lib/*.o
+
 xcrun clang++ ${RELEASE_FLAGS[@]} \
     $($LLVM_BUILD_DIR/bin/llvm-config --cxxflags --ldflags --libs) \
     -o source-info-import \
     -lcurses \
     srcs/source-info-import.cpp \
-    srcs/SwiftSourceInfo.cpp
+    libsourceinfoimport.a
+
+if [[ "$1" == "--benchmarks" ]]; then
+    xcrun clang++ ${RELEASE_FLAGS[@]} \
+        $($LLVM_BUILD_DIR/bin/llvm-config --cxxflags --ldflags --libs) \
+        -o remap-benchmark \
+        -lcurses \
+        benchmarks/remap-benchmark.cpp \
+        srcs/RemapRules.cpp
+    xcrun clang++ ${RELEASE_FLAGS[@]} \
+        $($LLVM_BUILD_DIR/bin/llvm-config --cxxflags --ldflags --libs) \
+        -o serve-latency \
+        -lcurses \
+        benchmarks/serve-latency.cpp \
+        srcs/Server.cpp
+    xcrun clang++ ${RELEASE_FLAGS[@]} \
+        $($LLVM_BUILD_DIR/bin/llvm-config --cxxflags --ldflags --libs) \
+        -o sourceinfo-benchmark \
+        -lcurses \
+        benchmarks/sourceinfo-benchmark.cpp \
+        srcs/RemapRules.cpp \
+        srcs/SourceInfo.cpp \
+        srcs/SourceInfoDiff.cpp \
+        srcs/SourceInfoFile.cpp \
+        srcs/SwiftSourceInfo.cpp
+    exit 0
+fi
 
 ZIP_FILE=source-info-import_macos-$(arch).zip
 zip $ZIP_FILE source-info-import
@@ -0,0 +1,111 @@
+#ifndef DUMP_WRITER_H
+#define DUMP_WRITER_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+
+using namespace llvm;
+
+// A buffered writer that formats numbers and escapes strings itself, so writing a record doesn't
+// allocate or go through the virtual calls of raw_ostream for every field
+class DumpWriter {
+  raw_ostream &OS;
+  char Buffer[64 * 1024];
+  size_t Size = 0;
+
+  void reserve(size_t N) {
+    if (Size + N > sizeof(Buffer))
+      flush();
+  }
+
+public:
+  explicit DumpWriter(raw_ostream &OS) : OS(OS) {}
+  ~DumpWriter() { flush(); }
+
+  void flush() {
+    OS.write(Buffer, Size);
+    Size = 0;
+  }
+
+  void write(char C) {
+    reserve(1);
+    Buffer[Size++] = C;
+  }
+
+  void write(StringRef S) {
+    // An empty StringRef may have no data at all
+    if (S.empty())
+      return;
+    if (S.size() > sizeof(Buffer)) {
+      flush();
+      OS << S;
+      return;
+    }
+    reserve(S.size());
+    std::memcpy(Buffer + Size, S.data(), S.size());
+    Size += S.size();
+  }
+
+  void writeNumber(uint64_t N) {
+    char Digits[20];
+    char *End = Digits + sizeof(Digits);
+    char *Begin = End;
+    do {
+      *--Begin = '0' + N % 10;
+      N /= 10;
+    } while (N);
+    write(StringRef(Begin, End - Begin));
+  }
+
+  // Writes `S` quoted. Bytes above 0x7f are copied, since the paths are UTF-8.
+  void writeJSONString(StringRef S) {
+    static const char Hex[] = "0123456789abcdef";
+    write('"');
+    size_t Start = 0;
+    for (size_t I = 0; I < S.size(); I++) {
+      unsigned char C = S[I];
+      if (C >= 0x20 && C != '"' && C != '\\')
+        continue;
+      write(S.slice(Start, I));
+      Start = I + 1;
+      switch (C) {
+      case '"':
+        write("\\\"");
+        break;
+      case '\\':
+        write("\\\\");
+        break;
+      case '\n':
+        write("\\n");
+        break;
+      case '\t':
+        write("\\t");
+        break;
+      default:
+        write("\\u00");
+        write(Hex[C >> 4]);
+        write(Hex[C & 0xf]);
+      }
+    }
+    write(S.drop_front(Start));
+    write('"');
+  }
+
+  // Writes `S` as one field, with the characters that would split it escaped
+  void writeTSVField(StringRef S) {
+    size_t Start = 0;
+    for (size_t I = 0; I < S.size(); I++) {
+      char C = S[I];
+      if (C != '\t' && C != '\n' && C != '\r' && C != '\\')
+        continue;
+      write(S.slice(Start, I));
+      Start = I + 1;
+      write('\\');
+      write(C == '\t' ? 't' : C == '\n' ? 'n' : C == '\r' ? 'r' : '\\');
+    }
+    write(S.drop_front(Start));
+  }
+};
+
+#endif // DUMP_WRITER_H
@@ -0,0 +1,42 @@
+#include "FilePipeline.h"
+#include "SourceInfoFile.h"
+#include "ThreadPool.h"
+#include "llvm/Support/FileSystem.h"
+#include <vector>
+
+void FilePipeline::run(ArrayRef<std::string> Inputs, ProcessFn Process, DoneFn Done) {
+  unsigned NumCPUThreads =
+      CPUThreads ? CPUThreads : std::max(1u, std::thread::hardware_concurrency());
+  // Enough files to keep every thread of both pools busy, with one more read ready per CPU thread
+  InFlightBudget Budget(MemoryLimit, IOThreads + 2 * size_t(NumCPUThreads));
+  // Handed from the read of an input to its processing
+  std::vector<std::unique_ptr<MemoryBuffer>> Buffers(Inputs.size());
+  // Declared after what the tasks use, so the pools are joined first
+  WorkStealingThreadPool CPUPool(NumCPUThreads);
+  WorkStealingThreadPool IOPool(IOThreads);
+
+  for (size_t I = 0; I < Inputs.size(); I++) {
+    uint64_t Size = 0;
+    if (sys::fs::file_size(Inputs[I], Size))
+      Size = 0; // The read reports the error
+    size_t Cost = Size * 2;
+    Budget.acquire(Cost);
+
+    auto Finish = [&, I, Cost](Error Err) {
+      Done(I, std::move(Err));
+      Budget.release(Cost);
+    };
+    IOPool.async([&, I, Finish] {
+      if (Error Err = readSourceInfo(Inputs[I]).moveInto(Buffers[I]))
+        return Finish(std::move(Err));
+
+      CPUPool.async([&, I, Finish] {
+        Expected<WriteFn> Write = Process(I, std::move(Buffers[I]));
+        if (!Write)
+          return Finish(Write.takeError());
+        IOPool.async([Write = std::move(*Write), Finish] { Finish(Write()); });
+      });
+    });
+  }
+  Budget.waitIdle();
+}
@@ -0,0 +1,80 @@
+#ifndef FILE_PIPELINE_H
+#define FILE_PIPELINE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace llvm;
+
+// The files in flight and the bytes they hold. A file waits until both fit, except that a file
+// larger than the whole budget still goes through on its own.
+class InFlightBudget {
+  std::mutex Lock;
+  std::condition_variable Released;
+  size_t MaxBytes;
+  size_t MaxFiles;
+  size_t Bytes = 0;
+  size_t Files = 0;
+
+public:
+  InFlightBudget(size_t MaxBytes, size_t MaxFiles) : MaxBytes(MaxBytes), MaxFiles(MaxFiles) {}
+
+  void acquire(size_t Size) {
+    std::unique_lock<std::mutex> Guard(Lock);
+    Released.wait(Guard,
+                  [&] { return Files == 0 || (Files < MaxFiles && Bytes + Size <= MaxBytes); });
+    Bytes += Size;
+    Files++;
+  }
+
+  void release(size_t Size) {
+    // Notified under the lock, since `waitIdle` returning may end the budget's lifetime
+    std::lock_guard<std::mutex> Guard(Lock);
+    Bytes -= Size;
+    Files--;
+    Released.notify_all();
+  }
+
+  // Blocks until every file has been released
+  void waitIdle() {
+    std::unique_lock<std::mutex> Guard(Lock);
+    Released.wait(Guard, [&] { return Files == 0; });
+  }
+};
+
+// Moves the files of a batch through three stages: reading them into memory on I/O threads,
+// processing them on CPU threads, and writing the results on the I/O threads again. The inputs are
+// read ahead and the outputs written behind, so on a slow or cold disk the reads of the next
+// files and the writes of the previous ones overlap the CPU work, instead of each file waiting on
+// its own I/O. The files in flight are bounded by count and by memory.
+class FilePipeline {
+public:
+  // Writes a processed file. It runs on an I/O thread, and owns everything it writes.
+  using WriteFn = std::function<Error()>;
+  // Processes the content of the `Index`th input on a CPU thread
+  using ProcessFn =
+      std::function<Expected<WriteFn>(size_t Index, std::unique_ptr<MemoryBuffer> Input)>;
+  // Called once for every input when it's done, or has failed, on any thread
+  using DoneFn = std::function<void(size_t Index, Error Err)>;
+
+  // Zero CPU threads means one per hardware thread. `MemoryLimit` bounds the bytes held by the
+  // files in flight, counting each input twice for its output.
+  FilePipeline(unsigned CPUThreads, unsigned IOThreads, size_t MemoryLimit)
+      : CPUThreads(CPUThreads), IOThreads(IOThreads), MemoryLimit(MemoryLimit) {}
+
+  // Runs every input through the stages, starting them in order, and returns when all are done
+  void run(ArrayRef<std::string> Inputs, ProcessFn Process, DoneFn Done);
+
+private:
+  unsigned CPUThreads;
+  unsigned IOThreads;
+  size_t MemoryLimit;
+};
+
+#endif // FILE_PIPELINE_H
@@ -0,0 +1,1105 @@
+#include "RemapRules.h"
+#include "llvm/ADT/StringExtras.h"
+
+#include <bitset>
+#include <map>
+#include <regex>
+
+namespace {
+
+const size_t NoPos = StringRef::npos;
+
+// The replacement format of `std::regex_replace`: `$&`, `$n`, `$nn`, `` $` ``, `$'` and `$$`.
+// Anything else is copied as is.
+class ReplacementTemplate {
+  struct Piece {
+    enum Kind { Text, Group, Prefix, Suffix } K;
+    std::string Str;
+    unsigned Index = 0;
+  };
+  std::vector<Piece> Pieces;
+
+  void appendText(StringRef Str) {
+    if (Pieces.empty() || Pieces.back().K != Piece::Text)
+      Pieces.push_back({Piece::Text, "", 0});
+    Pieces.back().Str += Str;
+  }
+
+public:
+  explicit ReplacementTemplate(StringRef Format) {
+    for (size_t I = 0; I < Format.size(); I++) {
+      if (Format[I] != '$' || I + 1 == Format.size()) {
+        appendText(Format.substr(I, 1));
+        continue;
+      }
+
+      char Next = Format[I + 1];
+      if (Next == '$') {
+        appendText("$");
+        I++;
+      } else if (Next == '&') {
+        Pieces.push_back({Piece::Group, "", 0});
+        I++;
+      } else if (Next == '`') {
+        Pieces.push_back({Piece::Prefix, "", 0});
+        I++;
+      } else if (Next == '\'') {
+        Pieces.push_back({Piece::Suffix, "", 0});
+        I++;
+      } else if (isDigit(Next)) {
+        unsigned Index = Next - '0';
+        I++;
+        if (I + 1 < Format.size() && isDigit(Format[I + 1])) {
+          Index = Index * 10 + (Format[I + 1] - '0');
+          I++;
+        }
+        Pieces.push_back({Piece::Group, "", Index});
+      } else {
+        appendText("$");
+      }
+    }
+  }
+
+  // Returns true if the replacement doesn't refer to the match.
+  bool isLiteral() const {
+    return Pieces.size() <= 1 && (Pieces.empty() || Pieces[0].K == Piece::Text);
+  }
+
+  // Returns true if the replacement refers to a group other than the whole match.
+  bool needsGroups() const {
+    for (const Piece &P : Pieces)
+      if (P.K == Piece::Group && P.Index != 0)
+        return true;
+    return false;
+  }
+
+  StringRef getLiteral() const { return Pieces.empty() ? StringRef() : StringRef(Pieces[0].Str); }
+
+  // Appends the replacement of a match. `Caps` holds the begin and end offsets of every group,
+  // NoPos if the group didn't participate. `PrevEnd` is where the previous match ended.
+  void expand(std::string &Out, StringRef Input, ArrayRef<size_t> Caps, size_t PrevEnd) const {
+    for (const Piece &P : Pieces) {
+      switch (P.K) {
+      case Piece::Text:
+        Out += P.Str;
+        break;
+      case Piece::Group:
+        if (P.Index * 2 < Caps.size() && Caps[P.Index * 2] != NoPos)
+          Out += Input.slice(Caps[P.Index * 2], Caps[P.Index * 2 + 1]);
+        break;
+      case Piece::Prefix:
+        Out += Input.slice(PrevEnd, Caps[0]);
+        break;
+      case Piece::Suffix:
+        Out += Input.substr(Caps[1]);
+        break;
+      }
+    }
+  }
+};
+
+// The syntax tree of the ECMAScript subset the automaton supports
+struct RegexNode {
+  enum Kind { Char, Class, Bol, Eol, Concat, Alternate, Repeat, Group } K;
+  unsigned char C = 0;
+  unsigned ClassIndex = 0;
+  unsigned Min = 0, Max = 0; // Repeat only, Max is Unbounded for `*` and `+`
+  bool Greedy = true;
+  unsigned CaptureIndex = 0; // Group only, 0 for non-capturing groups
+  std::vector<std::unique_ptr<RegexNode>> Children;
+
+  static const unsigned Unbounded = ~0u;
+
+  explicit RegexNode(Kind K) : K(K) {}
+
+  // Whether the node can match without consuming any character
+  bool isNullable() const {
+    switch (K) {
+    case Char:
+    case Class:
+      return false;
+    case Bol:
+    case Eol:
+      return true;
+    case Concat:
+      for (const auto &Child : Children)
+        if (!Child->isNullable())
+          return false;
+      return true;
+    case Alternate:
+      for (const auto &Child : Children)
+        if (Child->isNullable())
+          return true;
+      return false;
+    case Repeat:
+      return Min == 0 || Children[0]->isNullable();
+    case Group:
+      return Children[0]->isNullable();
+    }
+    return true;
+  }
+};
+
+using NodePtr = std::unique_ptr<RegexNode>;
+using CharSet = std::bitset<256>;
+
+// A recursive descent parser. It fails, and the rule falls back to `std::regex`, on anything it
+// doesn't understand.
+class RegexParser {
+  StringRef Pattern;
+  size_t Pos = 0;
+  bool Failed = false;
+
+public:
+  std::vector<CharSet> Classes;
+  unsigned NumGroups = 0;
+
+  explicit RegexParser(StringRef Pattern) : Pattern(Pattern) {}
+
+  NodePtr parse() {
+    NodePtr Root = parseAlternation();
+    if (Failed || Pos != Pattern.size())
+      return nullptr;
+    return Root;
+  }
+
+private:
+  bool atEnd() const { return Pos >= Pattern.size(); }
+  char peek() const { return Pattern[Pos]; }
+
+  NodePtr fail() {
+    Failed = true;
+    return nullptr;
+  }
+
+  NodePtr makeClass(const CharSet &Set) {
+    auto Node = std::make_unique<RegexNode>(RegexNode::Class);
+    Node->ClassIndex = Classes.size();
+    Classes.push_back(Set);
+    return Node;
+  }
+
+  NodePtr parseAlternation() {
+    auto Node = std::make_unique<RegexNode>(RegexNode::Alternate);
+    Node->Children.push_back(parseConcat());
+    while (!Failed && !atEnd() && peek() == '|') {
+      Pos++;
+      Node->Children.push_back(parseConcat());
+    }
+    if (Failed)
+      return nullptr;
+    if (Node->Children.size() == 1)
+      return std::move(Node->Children[0]);
+    return Node;
+  }
+
+  NodePtr parseConcat() {
+    auto Node = std::make_unique<RegexNode>(RegexNode::Concat);
+    while (!Failed && !atEnd() && peek() != '|' && peek() != ')') {
+      NodePtr Child = parseRepeat();
+      if (!Child)
+        return fail();
+      Node->Children.push_back(std::move(Child));
+    }
+    return Node;
+  }
+
+  bool parseNumber(unsigned &Value) {
+    size_t Start = Pos;
+    Value = 0;
+    while (!atEnd() && isDigit(peek()) && Value < 1000)
+      Value = Value * 10 + (Pattern[Pos++] - '0');
+    return Pos != Start;
+  }
+
+  NodePtr parseRepeat() {
+    NodePtr Atom = parseAtom();
+    if (!Atom || atEnd())
+      return Atom;
+
+    unsigned Min, Max;
+    switch (peek()) {
+    case '*':
+      Min = 0, Max = RegexNode::Unbounded;
+      Pos++;
+      break;
+    case '+':
+      Min = 1, Max = RegexNode::Unbounded;
+      Pos++;
+      break;
+    case '?':
+      Min = 0, Max = 1;
+      Pos++;
+      break;
+    case '{':
+      Pos++;
+      if (!parseNumber(Min))
+        return fail();
+      Max = Min;
+      if (!atEnd() && peek() == ',') {
+        Pos++;
+        if (!parseNumber(Max))
+          Max = RegexNode::Unbounded;
+      }
+      if (atEnd() || peek() != '}' || Max < Min)
+        return fail();
+      Pos++;
+      // Counted repetitions are unrolled, so keep them small.
+      if (Min > 32 || (Max != RegexNode::Unbounded && Max > 32))
+        return fail();
+      break;
+    default:
+      return Atom;
+    }
+
+    if (Atom->K == RegexNode::Bol || Atom->K == RegexNode::Eol)
+      return fail();
+
+    auto Node = std::make_unique<RegexNode>(RegexNode::Repeat);
+    Node->Min = Min;
+    Node->Max = Max;
+    if (!atEnd() && peek() == '?') {
+      Node->Greedy = false;
+      Pos++;
+    }
+    Node->Children.push_back(std::move(Atom));
+
+    // Stacked quantifiers like `a**` are errors in ECMAScript
+    if (!atEnd() && (peek() == '*' || peek() == '+' || peek() == '?' || peek() == '{'))
+      return fail();
+    return Node;
+  }
+
+  // Parses the escape after a backslash into a set. Returns false if it isn't supported.
+  bool parseEscape(CharSet &Set, bool InClass) {
+    if (atEnd())
+      return false;
+    char C = Pattern[Pos++];
+    CharSet Digits, Words, Spaces;
+    for (char D = '0'; D <= '9'; D++)
+      Digits.set((unsigned char)D);
+    Words = Digits;
+    for (char L = 'a'; L <= 'z'; L++)
+      Words.set((unsigned char)L).set((unsigned char)toUpper(L));
+    Words.set('_');
+    for (char S : StringRef(" \t\n\v\f\r"))
+      Spaces.set((unsigned char)S);
+
+    switch (C) {
+    case 'd':
+      Set |= Digits;
+      return true;
+    case 'D':
+      Set |= ~Digits;
+      return true;
+    case 'w':
+      Set |= Words;
+      return true;
+    case 'W':
+      Set |= ~Words;
+      return true;
+    case 's':
+      Set |= Spaces;
+      return true;
+    case 'S':
+      Set |= ~Spaces;
+      return true;
+    case 'n':
+      Set.set('\n');
+      return true;
+    case 't':
+      Set.set('\t');
+      return true;
+    case 'r':
+      Set.set('\r');
+      return true;
+    case 'f':
+      Set.set('\f');
+      return true;
+    case 'v':
+      Set.set('\v');
+      return true;
+    case '0':
+      Set.set(0);
+      return true;
+    case 'b':
+      // A backspace in a class, a word boundary outside
+      if (!InClass)
+        return false;
+      Set.set('\b');
+      return true;
+    default:
+      // Backreferences, `\xHH`, `\uHHHH`, `\cX`, `\B` and the like aren't supported.
+      if (isAlnum(C))
+        return false;
+      Set.set((unsigned char)C);
+      return true;
+    }
+  }
+
+  NodePtr parseClass() {
+    CharSet Set;
+    bool Negated = false;
+    if (!atEnd() && peek() == '^') {
+      Negated = true;
+      Pos++;
+    }
+
+    while (true) {
+      if (atEnd())
+        return fail();
+      if (peek() == ']') {
+        Pos++;
+        break;
+      }
+
+      // Reads one class atom, which is a single character unless it's a class escape like `\d`
+      auto readAtom = [&](CharSet &AtomSet) -> bool {
+        char C = Pattern[Pos++];
+        if (C == '\\')
+          return parseEscape(AtomSet, /*InClass=*/true);
+        if (C == '[' && !atEnd() && (peek() == ':' || peek() == '=' || peek() == '.'))
+          return false;
+        AtomSet.set((unsigned char)C);
+        return true;
+      };
+
+      CharSet Low;
+      if (!readAtom(Low))
+        return fail();
+
+      if (Pos + 1 < Pattern.size() && peek() == '-' && Pattern[Pos + 1] != ']') {
+        Pos++;
+        CharSet High;
+        if (!readAtom(High) || Low.count() != 1 || High.count() != 1)
+          return fail();
+        unsigned First = 0, Last = 0;
+        while (!Low.test(First))
+          First++;
+        while (!High.test(Last))
+          Last++;
+        if (First > Last)
+          return fail();
+        for (unsigned C = First; C <= Last; C++)
+          Set.set(C);
+      } else {
+        Set |= Low;
+      }
+    }
+
+    return makeClass(Negated ? ~Set : Set);
+  }
+
+  NodePtr parseAtom() {
+    char C = Pattern[Pos++];
+    switch (C) {
+    case '(': {
+      auto Node = std::make_unique<RegexNode>(RegexNode::Group);
+      if (!atEnd() && peek() == '?') {
+        // Only non-capturing groups; no lookaheads
+        if (Pos + 1 >= Pattern.size() || Pattern[Pos + 1] != ':')
+          return fail();
+        Pos += 2;
+      } else {
+        Node->CaptureIndex = ++NumGroups;
+      }
+      NodePtr Child = parseAlternation();
+      if (!Child || atEnd() || peek() != ')')
+        return fail();
+      Pos++;
+      Node->Children.push_back(std::move(Child));
+      return Node;
+    }
+    case '[':
+      return parseClass();
+    case '.': {
+      CharSet Set;
+      Set.set();
+      Set.reset('\n');
+      Set.reset('\r');
+      return makeClass(Set);
+    }
+    case '^':
+      return std::make_unique<RegexNode>(RegexNode::Bol);
+    case '$':
+      return std::make_unique<RegexNode>(RegexNode::Eol);
+    case '\\': {
+      CharSet Set;
+      if (!parseEscape(Set, /*InClass=*/false))
+        return fail();
+      if (Set.count() != 1)
+        return makeClass(Set);
+      unsigned Index = 0;
+      while (!Set.test(Index))
+        Index++;
+      auto Node = std::make_unique<RegexNode>(RegexNode::Char);
+      Node->C = Index;
+      return Node;
+    }
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+    case '}':
+    case ']':
+    case ')':
+    case '|':
+      return fail();
+    default: {
+      auto Node = std::make_unique<RegexNode>(RegexNode::Char);
+      Node->C = C;
+      return Node;
+    }
+    }
+  }
+};
+
+// Collects the literal characters every match must start with. Returns true if the whole node is
+// literal, so the caller can keep collecting from its next sibling.
+static bool collectLiteralPrefix(const RegexNode &Node, std::string &Prefix) {
+  switch (Node.K) {
+  case RegexNode::Char:
+    Prefix.push_back(Node.C);
+    return true;
+  case RegexNode::Group:
+    return collectLiteralPrefix(*Node.Children[0], Prefix);
+  case RegexNode::Concat:
+    for (const auto &Child : Node.Children)
+      if (!collectLiteralPrefix(*Child, Prefix))
+        return false;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Returns true if the pattern is `^`, optionally, followed by plain characters.
+static bool isLiteralPattern(const RegexNode &Root, bool &Anchored, std::string &Literal) {
+  Anchored = false;
+  if (Root.K == RegexNode::Char) {
+    Literal.push_back(Root.C);
+    return true;
+  }
+  if (Root.K != RegexNode::Concat)
+    return false;
+
+  for (size_t I = 0; I < Root.Children.size(); I++) {
+    const RegexNode &Child = *Root.Children[I];
+    if (I == 0 && Child.K == RegexNode::Bol)
+      Anchored = true;
+    else if (Child.K == RegexNode::Char)
+      Literal.push_back(Child.C);
+    else
+      return false;
+  }
+  return true;
+}
+
+// A compiled regex. Matches are found with a DFA that is built up front, when the pattern is small
+// enough, and the submatches with a Pike VM: a Thompson NFA simulation that tracks them. Both run
+// in linear time and find the same leftmost match as the backtracking `std::regex`.
+class RegexProgram {
+  struct Inst {
+    enum Opcode : uint8_t { Char, Class, Split, Jmp, Save, Bol, Eol, Match } Op;
+    unsigned char C = 0;
+    unsigned X = 0, Y = 0;
+  };
+
+  std::vector<Inst> Insts;
+  std::vector<CharSet> Classes;
+  unsigned NumCaps;
+  // A literal every match starts with, used to skip to the candidate positions
+  std::string Prefix;
+  // Matches can only start at offset 0
+  bool Anchored;
+
+  // The DFA simulates the NFA from one start position. A state is the ordered list of the live
+  // threads, with the threads that have a lower priority than a match already cut off, so the
+  // last match seen is the leftmost-first one. State 0 is the dead state.
+  static const unsigned MaxDFAStates = 256;
+  bool HasDFA = false;
+  uint8_t ByteClasses[256];
+  unsigned NumByteClasses = 0;
+  std::vector<uint32_t> Transitions; // [State * NumByteClasses + ByteClass]
+  std::vector<uint8_t> Matching;     // A match ends right after entering the state
+  std::vector<uint8_t> MatchingAtEnd; // A match ends if the input ends in the state
+  uint32_t StartState = 0, StartStateAtBol = 0;
+
+  struct ThreadList {
+    std::vector<unsigned> PCs;
+    std::vector<unsigned> Sparse;
+    std::vector<size_t> Caps;
+
+    void reset(size_t NumInsts, unsigned NumCaps) {
+      PCs.clear();
+      if (Sparse.size() < NumInsts)
+        Sparse.resize(NumInsts);
+      if (Caps.size() < NumInsts * NumCaps)
+        Caps.resize(NumInsts * NumCaps);
+    }
+
+    bool contains(unsigned PC) const {
+      unsigned Index = Sparse[PC];
+      return Index < PCs.size() && PCs[Index] == PC;
+    }
+
+    void insert(unsigned PC) {
+      Sparse[PC] = PCs.size();
+      PCs.push_back(PC);
+    }
+  };
+
+  unsigned emit(Inst::Opcode Op, unsigned X = 0, unsigned Y = 0) {
+    Inst I;
+    I.Op = Op;
+    I.X = X;
+    I.Y = Y;
+    Insts.push_back(I);
+    return Insts.size() - 1;
+  }
+
+  void compile(const RegexNode &Node) {
+    switch (Node.K) {
+    case RegexNode::Char:
+      Insts[emit(Inst::Char)].C = Node.C;
+      break;
+    case RegexNode::Class:
+      emit(Inst::Class, Node.ClassIndex);
+      break;
+    case RegexNode::Bol:
+      emit(Inst::Bol);
+      break;
+    case RegexNode::Eol:
+      emit(Inst::Eol);
+      break;
+    case RegexNode::Concat:
+      for (const auto &Child : Node.Children)
+        compile(*Child);
+      break;
+    case RegexNode::Alternate: {
+      std::vector<unsigned> Jumps;
+      for (size_t I = 0; I < Node.Children.size(); I++) {
+        if (I + 1 == Node.Children.size()) {
+          compile(*Node.Children[I]);
+          break;
+        }
+        unsigned Split = emit(Inst::Split);
+        Insts[Split].X = Insts.size();
+        compile(*Node.Children[I]);
+        Jumps.push_back(emit(Inst::Jmp));
+        Insts[Split].Y = Insts.size();
+      }
+      for (unsigned Jump : Jumps)
+        Insts[Jump].X = Insts.size();
+      break;
+    }
+    case RegexNode::Group:
+      if (Node.CaptureIndex)
+        emit(Inst::Save, Node.CaptureIndex * 2);
+      compile(*Node.Children[0]);
+      if (Node.CaptureIndex)
+        emit(Inst::Save, Node.CaptureIndex * 2 + 1);
+      break;
+    case RegexNode::Repeat: {
+      const RegexNode &Child = *Node.Children[0];
+      for (unsigned I = 0; I < Node.Min; I++)
+        compile(Child);
+
+      // The preferred branch of a split goes to X
+      auto setBranches = [&](unsigned Split, unsigned Body, unsigned Out) {
+        Insts[Split].X = Node.Greedy ? Body : Out;
+        Insts[Split].Y = Node.Greedy ? Out : Body;
+      };
+
+      if (Node.Max == RegexNode::Unbounded) {
+        unsigned Split = emit(Inst::Split);
+        compile(Child);
+        emit(Inst::Jmp, Split);
+        setBranches(Split, Split + 1, Insts.size());
+      } else {
+        // `x{0,2}` becomes `(x(x)?)?`
+        std::vector<unsigned> Splits;
+        for (unsigned I = Node.Min; I < Node.Max; I++) {
+          Splits.push_back(emit(Inst::Split));
+          compile(Child);
+        }
+        for (unsigned Split : Splits)
+          setBranches(Split, Split + 1, Insts.size());
+      }
+      break;
+    }
+    }
+  }
+
+  bool consumes(const Inst &I, unsigned char C) const {
+    return I.Op == Inst::Char ? I.C == C : I.Op == Inst::Class && Classes[I.X].test(C);
+  }
+
+  // Follows the empty transitions from `PC` and appends the threads it reaches, in priority
+  // order. Returns true when it reaches the match, and then the threads with a lower priority are
+  // cut off.
+  bool follow(unsigned PC, bool AtBol, bool AtEol, std::vector<unsigned> &Threads,
+              std::vector<bool> &Seen) const {
+    if (Seen[PC])
+      return false;
+    Seen[PC] = true;
+
+    const Inst &I = Insts[PC];
+    switch (I.Op) {
+    case Inst::Jmp:
+      return follow(I.X, AtBol, AtEol, Threads, Seen);
+    case Inst::Split:
+      return follow(I.X, AtBol, AtEol, Threads, Seen) || follow(I.Y, AtBol, AtEol, Threads, Seen);
+    case Inst::Save:
+      return follow(PC + 1, AtBol, AtEol, Threads, Seen);
+    case Inst::Bol:
+      return AtBol && follow(PC + 1, AtBol, AtEol, Threads, Seen);
+    case Inst::Eol:
+      if (AtEol)
+        return follow(PC + 1, AtBol, AtEol, Threads, Seen);
+      // Kept so that the state knows whether it matches at the end of the input
+      Threads.push_back(PC);
+      return false;
+    case Inst::Match:
+      return true;
+    default:
+      Threads.push_back(PC);
+      return false;
+    }
+  }
+
+  void buildDFA() {
+    // Bytes that no instruction tells apart share a column in the transition table.
+    std::map<std::vector<bool>, unsigned> Signatures;
+    unsigned char Representatives[256];
+    for (unsigned B = 0; B < 256; B++) {
+      std::vector<bool> Signature;
+      for (const Inst &I : Insts)
+        if (I.Op == Inst::Char || I.Op == Inst::Class)
+          Signature.push_back(consumes(I, B));
+      auto Inserted = Signatures.emplace(Signature, Signatures.size());
+      if (Inserted.second)
+        Representatives[Inserted.first->second] = B;
+      ByteClasses[B] = Inserted.first->second;
+    }
+    NumByteClasses = Signatures.size();
+
+    std::map<std::pair<std::vector<unsigned>, bool>, uint32_t> StateIDs;
+    std::vector<std::vector<unsigned>> StateThreads;
+    auto intern = [&](std::vector<unsigned> Threads, bool Match) -> uint32_t {
+      if (Threads.empty() && !Match)
+        return 0;
+      auto Inserted = StateIDs.emplace(std::make_pair(Threads, Match), StateThreads.size());
+      if (Inserted.second) {
+        StateThreads.push_back(std::move(Threads));
+        Matching.push_back(Match);
+      }
+      return Inserted.first->second;
+    };
+
+    StateThreads.emplace_back();
+    Matching.push_back(false);
+    for (bool AtBol : {false, true}) {
+      std::vector<unsigned> Threads;
+      std::vector<bool> Seen(Insts.size());
+      bool Match = follow(0, AtBol, false, Threads, Seen);
+      (AtBol ? StartStateAtBol : StartState) = intern(Threads, Match);
+    }
+
+    for (size_t State = 0; State < StateThreads.size(); State++) {
+      if (StateThreads.size() > MaxDFAStates)
+        return;
+
+      for (unsigned Class = 0; Class < NumByteClasses; Class++) {
+        std::vector<unsigned> Threads;
+        std::vector<bool> Seen(Insts.size());
+        bool Match = false;
+        for (unsigned PC : StateThreads[State]) {
+          if (consumes(Insts[PC], Representatives[Class]) &&
+              follow(PC + 1, false, false, Threads, Seen)) {
+            Match = true;
+            break;
+          }
+        }
+        // `StateThreads` may grow, so don't keep a reference into it.
+        uint32_t Next = intern(std::move(Threads), Match);
+        Transitions.resize(StateThreads.size() * NumByteClasses);
+        Transitions[State * NumByteClasses + Class] = Next;
+      }
+
+      bool MatchAtEnd = false;
+      for (unsigned PC : StateThreads[State]) {
+        std::vector<unsigned> Threads;
+        std::vector<bool> Seen(Insts.size());
+        if (Insts[PC].Op == Inst::Eol && follow(PC + 1, false, true, Threads, Seen)) {
+          MatchAtEnd = true;
+          break;
+        }
+      }
+      MatchingAtEnd.push_back(MatchAtEnd);
+    }
+    HasDFA = true;
+  }
+
+  // Returns the end of the leftmost-first match that starts at `Start`, or NoPos. Gives up and
+  // returns false if it takes more than `Budget` steps.
+  bool matchDFA(StringRef Input, size_t Start, size_t &Budget, size_t &End) const {
+    uint32_t State = Start == 0 ? StartStateAtBol : StartState;
+    End = Matching[State] ? Start : NoPos;
+    size_t Pos = Start;
+    for (; Pos < Input.size() && State != 0; Pos++) {
+      if (Budget-- == 0)
+        return false;
+      State = Transitions[State * NumByteClasses + ByteClasses[(unsigned char)Input[Pos]]];
+      if (Matching[State])
+        End = Pos + 1;
+    }
+    if (Pos == Input.size() && MatchingAtEnd[State])
+      End = Pos;
+    return true;
+  }
+
+  void addThread(ThreadList &List, unsigned PC, size_t Pos, StringRef Input, size_t *Caps) const {
+    if (List.contains(PC))
+      return;
+    List.insert(PC);
+
+    const Inst &I = Insts[PC];
+    switch (I.Op) {
+    case Inst::Jmp:
+      addThread(List, I.X, Pos, Input, Caps);
+      break;
+    case Inst::Split:
+      addThread(List, I.X, Pos, Input, Caps);
+      addThread(List, I.Y, Pos, Input, Caps);
+      break;
+    case Inst::Save: {
+      size_t Old = Caps[I.X];
+      Caps[I.X] = Pos;
+      addThread(List, PC + 1, Pos, Input, Caps);
+      Caps[I.X] = Old;
+      break;
+    }
+    case Inst::Bol:
+      if (Pos == 0)
+        addThread(List, PC + 1, Pos, Input, Caps);
+      break;
+    case Inst::Eol:
+      if (Pos == Input.size())
+        addThread(List, PC + 1, Pos, Input, Caps);
+      break;
+    default:
+      std::copy(Caps, Caps + NumCaps, &List.Caps[PC * NumCaps]);
+      break;
+    }
+  }
+
+  // Runs the Pike VM. With `OnlyAtStart`, the match has to start at `Start`.
+  bool searchPike(StringRef Input, size_t Start, bool OnlyAtStart,
+                  std::vector<size_t> &Caps) const {
+    // The thread lists are reused across searches to keep allocations off the per-path path.
+    static thread_local ThreadList Lists[2];
+    static thread_local std::vector<size_t> Work;
+    ThreadList *Current = &Lists[0], *Next = &Lists[1];
+    Current->reset(Insts.size(), NumCaps);
+    Next->reset(Insts.size(), NumCaps);
+    Work.resize(NumCaps);
+    bool Matched = false;
+
+    for (size_t Pos = Start; Pos <= Input.size(); Pos++) {
+      if (!Matched && Current->PCs.empty()) {
+        if ((Anchored && Pos != 0) || (OnlyAtStart && Pos != Start))
+          break;
+        if (!Prefix.empty()) {
+          Pos = Input.find(Prefix, Pos);
+          if (Pos == NoPos)
+            break;
+        }
+      }
+      if (!Matched && (!OnlyAtStart || Pos == Start)) {
+        std::fill(Work.begin(), Work.end(), NoPos);
+        addThread(*Current, 0, Pos, Input, Work.data());
+      }
+      if (Current->PCs.empty())
+        break;
+
+      Next->PCs.clear();
+      for (unsigned PC : Current->PCs) {
+        const Inst &I = Insts[PC];
+        size_t *ThreadCaps = &Current->Caps[PC * NumCaps];
+        if (I.Op == Inst::Match) {
+          Caps.assign(ThreadCaps, ThreadCaps + NumCaps);
+          Matched = true;
+          // Threads after this one have a lower priority
+          break;
+        }
+        if (Pos < Input.size() && consumes(I, Input[Pos]))
+          addThread(*Next, PC + 1, Pos + 1, Input, ThreadCaps);
+      }
+      std::swap(Current, Next);
+    }
+    return Matched;
+  }
+
+public:
+  RegexProgram(const RegexNode &Root, std::vector<CharSet> Classes, unsigned NumGroups,
+               StringRef Prefix, bool Anchored)
+      : Classes(std::move(Classes)), NumCaps((NumGroups + 1) * 2), Prefix(Prefix.str()),
+        Anchored(Anchored) {
+    emit(Inst::Save, 0);
+    compile(Root);
+    emit(Inst::Save, 1);
+    emit(Inst::Match);
+    buildDFA();
+  }
+
+  bool isAnchored() const { return Anchored; }
+
+  // Finds the leftmost match that starts at or after `Start`. `Caps` receives the begin and end
+  // offsets of the match and, if `NeedGroups` is set, of every group.
+  bool search(StringRef Input, size_t Start, bool NeedGroups, std::vector<size_t> &Caps) const {
+    if (!HasDFA)
+      return searchPike(Input, Start, false, Caps);
+
+    // The DFA is restarted at every candidate position. The budget bounds the restarts to a
+    // constant factor of the input; past it, the Pike VM takes over.
+    size_t Budget = (Input.size() - Start) * 4 + 64;
+    for (size_t Pos = Start; Pos <= Input.size(); Pos++) {
+      if (Anchored && Pos != 0)
+        return false;
+      if (!Prefix.empty()) {
+        Pos = Input.find(Prefix, Pos);
+        if (Pos == NoPos)
+          return false;
+      }
+
+      size_t End;
+      if (!matchDFA(Input, Pos, Budget, End))
+        return searchPike(Input, Pos, false, Caps);
+      if (End == NoPos)
+        continue;
+
+      if (NeedGroups)
+        return searchPike(Input, Pos, true, Caps);
+      Caps.assign(2, NoPos);
+      Caps[0] = Pos;
+      Caps[1] = End;
+      return true;
+    }
+    return false;
+  }
+};
+
+} // end anonymous namespace
+
+class RemapRuleSet::Stage {
+public:
+  virtual ~Stage() = default;
+
+  // Writes the result to `Out` and returns true, or returns false if nothing matched.
+  virtual bool apply(StringRef Input, std::string &Out) const = 0;
+};
+
+namespace {
+
+// A run of `^literal=replacement` rules whose replacements are literal too. They are matched with
+// one walk down a prefix trie. Only rules that can't match the output of an earlier rule in the
+// same trie are added, so applying the first matching rule is the same as applying all of them in
+// order.
+class PrefixTrieStage : public RemapRuleSet::Stage {
+  struct Node {
+    std::vector<std::pair<unsigned char, unsigned>> Children;
+    int Rule = -1; // The first rule whose prefix ends here
+  };
+
+  std::vector<Node> Nodes{1};
+  std::vector<std::pair<std::string, std::string>> Rules;
+
+public:
+  bool canAdd(StringRef Prefix) const {
+    for (const auto &Rule : Rules) {
+      StringRef Replacement = Rule.second;
+      if (Replacement.startswith(Prefix) || Prefix.startswith(Replacement))
+        return false;
+    }
+    return true;
+  }
+
+  void add(StringRef Prefix, StringRef Replacement) {
+    unsigned Current = 0;
+    for (unsigned char C : Prefix) {
+      auto &Children = Nodes[Current].Children;
+      auto It = std::find_if(Children.begin(), Children.end(),
+                             [&](const std::pair<unsigned char, unsigned> &Child) {
+                               return Child.first == C;
+                             });
+      if (It != Children.end()) {
+        Current = It->second;
+      } else {
+        Nodes[Current].Children.emplace_back(C, Nodes.size());
+        Current = Nodes.size();
+        Nodes.emplace_back();
+      }
+    }
+    if (Nodes[Current].Rule < 0)
+      Nodes[Current].Rule = Rules.size();
+    Rules.emplace_back(Prefix.str(), Replacement.str());
+  }
+
+  bool apply(StringRef Input, std::string &Out) const override {
+    int Best = -1;
+    unsigned Current = 0;
+    for (unsigned char C : Input) {
+      const auto &Children = Nodes[Current].Children;
+      auto It = std::find_if(Children.begin(), Children.end(),
+                             [&](const std::pair<unsigned char, unsigned> &Child) {
+                               return Child.first == C;
+                             });
+      if (It == Children.end())
+        break;
+      Current = It->second;
+      int Rule = Nodes[Current].Rule;
+      if (Rule >= 0 && (Best < 0 || Rule < Best))
+        Best = Rule;
+    }
+    if (Best < 0)
+      return false;
+
+    Out = Rules[Best].second;
+    Out += Input.substr(Rules[Best].first.size());
+    return true;
+  }
+};
+
+// A literal pattern, replaced everywhere, or only at the start if it's anchored
+class LiteralStage : public RemapRuleSet::Stage {
+  std::string Literal;
+  bool Anchored;
+  ReplacementTemplate Replacement;
+
+public:
+  LiteralStage(StringRef Literal, bool Anchored, StringRef Replacement)
+      : Literal(Literal.str()), Anchored(Anchored), Replacement(Replacement) {}
+
+  bool apply(StringRef Input, std::string &Out) const override {
+    size_t Pos = Anchored ? (Input.startswith(Literal) ? 0 : NoPos) : Input.find(Literal);
+    if (Pos == NoPos)
+      return false;
+
+    Out.clear();
+    size_t PrevEnd = 0;
+    while (Pos != NoPos) {
+      Out += Input.slice(PrevEnd, Pos);
+      size_t Caps[] = {Pos, Pos + Literal.size()};
+      Replacement.expand(Out, Input, Caps, PrevEnd);
+      PrevEnd = Pos + Literal.size();
+      Pos = Anchored ? NoPos : Input.find(Literal, PrevEnd);
+    }
+    Out += Input.substr(PrevEnd);
+    return true;
+  }
+};
+
+class AutomatonStage : public RemapRuleSet::Stage {
+  RegexProgram Program;
+  ReplacementTemplate Replacement;
+  bool NeedGroups;
+
+public:
+  AutomatonStage(RegexProgram Program, StringRef Replacement)
+      : Program(std::move(Program)), Replacement(Replacement),
+        NeedGroups(this->Replacement.needsGroups()) {}
+
+  bool apply(StringRef Input, std::string &Out) const override {
+    static thread_local std::vector<size_t> Caps;
+    if (!Program.search(Input, 0, NeedGroups, Caps))
+      return false;
+
+    Out.clear();
+    size_t PrevEnd = 0;
+    do {
+      Out += Input.slice(PrevEnd, Caps[0]);
+      Replacement.expand(Out, Input, Caps, PrevEnd);
+      // Nullable patterns never get here, so every match consumes at least one character.
+      PrevEnd = Caps[1];
+    } while (!Program.isAnchored() && Program.search(Input, PrevEnd, NeedGroups, Caps));
+    Out += Input.substr(PrevEnd);
+    return true;
+  }
+};
+
+class StdRegexStage : public RemapRuleSet::Stage {
+  std::regex Pattern;
+  std::string Replacement;
+
+public:
+  StdRegexStage(StringRef Pattern, StringRef Replacement)
+      : Pattern(Pattern.str()), Replacement(Replacement.str()) {}
+
+  bool apply(StringRef Input, std::string &Out) const override {
+    Out.clear();
+    std::regex_replace(std::back_inserter(Out), Input.begin(), Input.end(), Pattern, Replacement);
+    return true;
+  }
+};
+
+} // end anonymous namespace
+
+RemapRuleSet::RemapRuleSet() = default;
+RemapRuleSet::RemapRuleSet(RemapRuleSet &&) = default;
+RemapRuleSet &RemapRuleSet::operator=(RemapRuleSet &&) = default;
+RemapRuleSet::~RemapRuleSet() = default;
+
+void RemapRuleSet::addRule(StringRef Pattern, StringRef Replacement) {
+  RegexParser Parser(Pattern);
+  NodePtr Root = Parser.parse();
+  if (!Root || Root->isNullable()) {
+    LastTrie = nullptr;
+    Stages.push_back(std::make_unique<StdRegexStage>(Pattern, Replacement));
+    RuleKinds.push_back(RuleKind::StdRegex);
+    return;
+  }
+
+  bool Anchored;
+  std::string Literal;
+  if (isLiteralPattern(*Root, Anchored, Literal)) {
+    ReplacementTemplate Template(Replacement);
+    if (Anchored && Template.isLiteral()) {
+      auto *Trie = static_cast<PrefixTrieStage *>(LastTrie);
+      if (!Trie || !Trie->canAdd(Literal)) {
+        Stages.push_back(std::make_unique<PrefixTrieStage>());
+        Trie = static_cast<PrefixTrieStage *>(Stages.back().get());
+        LastTrie = Trie;
+      }
+      Trie->add(Literal, Template.getLiteral());
+    } else {
+      LastTrie = nullptr;
+      Stages.push_back(std::make_unique<LiteralStage>(Literal, Anchored, Replacement));
+    }
+    RuleKinds.push_back(Anchored ? RuleKind::AnchoredLiteral : RuleKind::Literal);
+    return;
+  }
+
+  Anchored = Root->K == RegexNode::Concat && !Root->Children.empty() &&
+             Root->Children[0]->K == RegexNode::Bol;
+  std::string Prefix;
+  collectLiteralPrefix(*Root, Prefix);
+  RegexProgram Program(*Root, std::move(Parser.Classes), Parser.NumGroups, Prefix, Anchored);
+  LastTrie = nullptr;
+  Stages.push_back(std::make_unique<AutomatonStage>(std::move(Program), Replacement));
+  RuleKinds.push_back(RuleKind::Automaton);
+}
+
+std::string RemapRuleSet::apply(StringRef Path) const {
+  // Ping-pong between two buffers, so that no stage copies its input.
+  std::string Buffers[2];
+  unsigned Next = 0;
+  StringRef Current = Path;
+  for (const auto &S : Stages) {
+    if (S->apply(Current, Buffers[Next])) {
+      Current = Buffers[Next];
+      Next ^= 1;
+    }
+  }
+  return Current.str();
+}
@@ -0,0 +1,55 @@
+#ifndef REMAP_RULES_H
+#define REMAP_RULES_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+// A compiled list of `regex=replacement` rules. The rules keep the ECMAScript semantics of
+// `std::regex_replace` and are applied in order, so the output of one rule is the input of the
+// next. Each rule is compiled to the cheapest matcher that can handle it:
+//
+//   - `^literal` rules are grouped into a prefix trie, so a run of them is matched in one pass.
+//   - Literal rules are a plain substring search.
+//   - Other rules run on a linear-time automaton, skipping to the occurrences of the pattern's
+//     literal prefix, e.g. `/Users/` in `/Users/.*/MyProject`. Matches are found with a DFA built
+//     up front, which most patterns fit in. A Pike VM (an NFA simulation) finds them instead when
+//     the DFA would need more than 256 states, or when restarting the DFA at candidate positions
+//     goes past a budget linear in the path. The Pike VM also finds the groups, when the
+//     replacement uses them, from the start of the match the DFA found.
+//   - Only the rules that use features the automaton doesn't support (backreferences, lookaheads,
+//     word boundaries, ...) or that can match an empty string fall back to `std::regex`.
+class RemapRuleSet {
+public:
+  enum class RuleKind { AnchoredLiteral, Literal, Automaton, StdRegex };
+
+  class Stage;
+
+  RemapRuleSet();
+  RemapRuleSet(RemapRuleSet &&);
+  RemapRuleSet &operator=(RemapRuleSet &&);
+  ~RemapRuleSet();
+
+  // Compiles a rule and appends it after the existing ones.
+  void addRule(StringRef Pattern, StringRef Replacement);
+
+  // Applies all the rules to the path.
+  std::string apply(StringRef Path) const;
+
+  // How each rule was compiled, in the order they were added.
+  ArrayRef<RuleKind> getRuleKinds() const { return RuleKinds; }
+
+  bool empty() const { return RuleKinds.empty(); }
+
+private:
+  std::vector<std::unique_ptr<Stage>> Stages;
+  std::vector<RuleKind> RuleKinds;
+  // The trailing prefix trie stage, which the next `^literal` rule may join
+  Stage *LastTrie = nullptr;
+};
+
+#endif // REMAP_RULES_H
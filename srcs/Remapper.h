@@ -1,67 +1,205 @@
 #ifndef REMAPPER_H
 #define REMAPPER_H
 
+#include "RemapRules.h"
+#include "SourceInfoArena.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/FormatVariadic.h"
 #include "llvm/Support/raw_ostream.h"
-#include <regex>
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
 
 using namespace llvm;
 
-// Remaps file paths with provided regexes and replacements
-class FilePathRemapper {
-  std::vector<std::pair<std::regex, std::string>> Remaps;
+// A thread-safe memo of the remapped paths, shared by all the files processed in the process. The
+// table is split into shards, each with its own reader-writer lock, so concurrent lookups of
+// different paths rarely touch the same lock and lookups of the same path only share it.
+class RemappedPathCache {
+  static const unsigned NumShards = 64;
+
+  struct alignas(64) Shard {
+    std::shared_mutex Lock;
+    // The keys are interned by the map. The entries never move, so the values can be handed out.
+    StringMap<std::string> Paths;
+    std::atomic<uint64_t> Hits{0};
+    std::atomic<uint64_t> Misses{0};
+  };
+
+  std::unique_ptr<Shard[]> Shards{new Shard[NumShards]};
 
 public:
-  std::string remap(StringRef input) const {
-    std::string result = input.str();
-    for (const auto &remap : Remaps) {
-      const auto &pattern = remap.first;
-      const auto &replacement = remap.second;
-      result = std::regex_replace(input.str(), pattern, replacement);
+  // Returns the cached result for `Path`, or computes it with `Remap` and caches it. The returned
+  // reference lives as long as the cache.
+  template <typename RemapFn> StringRef lookup(StringRef Path, RemapFn &&Remap) {
+    Shard &S = Shards[xxHash64(Path) % NumShards];
+    {
+      std::shared_lock<std::shared_mutex> Guard(S.Lock);
+      auto It = S.Paths.find(Path);
+      if (It != S.Paths.end()) {
+        S.Hits.fetch_add(1, std::memory_order_relaxed);
+        return It->second;
+      }
     }
 
-    return result;
+    // Remap outside of the lock. If another thread wins the race, its result is kept.
+    std::string NewPath = Remap(Path);
+    S.Misses.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock<std::shared_mutex> Guard(S.Lock);
+    return S.Paths.try_emplace(Path, std::move(NewPath)).first->second;
+  }
+
+  uint64_t getHits() const {
+    uint64_t Hits = 0;
+    for (unsigned I = 0; I < NumShards; I++)
+      Hits += Shards[I].Hits.load(std::memory_order_relaxed);
+    return Hits;
+  }
+
+  uint64_t getMisses() const {
+    uint64_t Misses = 0;
+    for (unsigned I = 0; I < NumShards; I++)
+      Misses += Shards[I].Misses.load(std::memory_order_relaxed);
+    return Misses;
   }
+};
+
+// Remaps file paths with provided regexes and replacements. The remaps are applied in order, each
+// one to the result of the previous one. The results are cached for the lifetime of the remapper,
+// which is usually the whole process.
+class FilePathRemapper {
+  RemapRuleSet Rules;
+  std::unique_ptr<RemappedPathCache> Cache = std::make_unique<RemappedPathCache>();
 
-  void addRemap(std::regex &pattern, const std::string &replacement) {
-    Remaps.emplace_back(pattern, replacement);
+public:
+  StringRef remap(StringRef input) const {
+    return Cache->lookup(input, [&](StringRef Path) { return Rules.apply(Path); });
   }
+
+  void addRemap(StringRef pattern, StringRef replacement) { Rules.addRule(pattern, replacement); }
+
+  const RemappedPathCache &getCache() const { return *Cache; }
 };
 
 // Remaps the FileID, which is the offset into the TextData blob.
-// This class also provides the remapped TextData blob.
+// This class also provides the remapped TextData blob, which is built in the tail of the arena.
 class FileIDRemapper {
-  FilePathRemapper &PathRemapper;
+  const FilePathRemapper &PathRemapper;
   DenseMap<uint32_t, uint32_t> IndexMap;
-  SmallString<1024> Buffer;
+  // The offset of each path in the new TextData, so that old paths remapped to the same path share
+  // one string. The keys point into the path cache, which outlives the remapper.
+  DenseMap<StringRef, uint32_t> PathOffsets;
+  // The new FileID for each old one, indexed by the old offset. Offsets that don't start a string
+  // map to InvalidFileID, and so does the extra last slot, which stands for all the offsets past
+  // the end of TextData.
+  std::vector<uint32_t> TranslationTable;
+  SourceInfoArena &Arena;
+  // Where the "old -> new" lines go. Batch mode gives every file its own stream so the lines of
+  // concurrently remapped files don't interleave.
+  raw_ostream &Log;
 
 public:
-  FileIDRemapper(FilePathRemapper &PathRemapper) : PathRemapper(PathRemapper) {}
+  static constexpr uint32_t InvalidFileID = ~0u;
+
+  FileIDRemapper(const FilePathRemapper &PathRemapper, SourceInfoArena &Arena,
+                 raw_ostream &Log = llvm::outs())
+      : PathRemapper(PathRemapper), Arena(Arena), Log(Log) {}
 
   uint32_t mapFileID(uint32_t FileID, StringRef TextDataData, bool Quiet) {
     if (IndexMap.count(FileID) == 0) {
-      IndexMap[FileID] = Buffer.size();
-
       auto OldPath = TextDataData.substr(FileID);
       size_t terminatorOffset = OldPath.find('\0');
       OldPath = OldPath.slice(0, terminatorOffset);
 
-      auto NewPath = PathRemapper.remap(OldPath.str());
-      Buffer.append(NewPath);
-      Buffer.push_back('\0');
+      auto NewPath = PathRemapper.remap(OldPath);
+      auto [It, Inserted] = PathOffsets.try_emplace(NewPath, Arena.getTail().size());
+      if (Inserted) {
+        Arena.appendToTail(NewPath);
+        Arena.appendToTail(StringRef("\0", 1));
+      }
+      IndexMap[FileID] = It->second;
 
       if (!Quiet)
-        llvm::outs() << llvm::formatv("{0} -> {1}\n", OldPath.size() > 0 ? OldPath : "(Empty)",
-                                      NewPath.size() > 0 ? NewPath : "(Empty)");
+        Log << llvm::formatv("{0} -> {1}\n", OldPath.size() > 0 ? OldPath : "(Empty)",
+                             NewPath.size() > 0 ? NewPath : "(Empty)");
     }
 
     return IndexMap[FileID];
   }
 
-  StringRef getNewTextDataData() { return StringRef(Buffer); }
+  // Remaps every path in TextData once, in order, and fills the translation table. After this,
+  // translating a FileID is a single load from the table. With `Referenced`, the paths whose
+  // offsets aren't set in it are left out of the new TextData.
+  void buildTranslationTable(StringRef TextDataData, bool Quiet,
+                             const BitVector *Referenced = nullptr) {
+    TranslationTable.assign(TextDataData.size() + 1, InvalidFileID);
+    size_t Offset = 0;
+    while (Offset < TextDataData.size()) {
+      if (!Referenced || Referenced->test(Offset))
+        TranslationTable[Offset] = mapFileID(Offset, TextDataData, Quiet);
+      size_t Terminator = TextDataData.find('\0', Offset);
+      if (Terminator == StringRef::npos)
+        break;
+      Offset = Terminator + 1;
+    }
+  }
+
+  ArrayRef<uint32_t> getTranslationTable() const { return TranslationTable; }
+
+  // The number of distinct FileIDs mapped so far
+  size_t getNumFileIDs() const { return IndexMap.size(); }
+
+  // The number of distinct paths in the new TextData
+  size_t getNumPaths() const { return PathOffsets.size(); }
+
+  // Rewrites the new TextData with its paths sorted, and points the translation table to the new
+  // offsets, so that the same paths always give the same TextData, whatever order they were
+  // written in. FileIDs remapped after this are appended unsorted.
+  void sortTextData() {
+    std::string OldText = Arena.getTail().str();
+    auto PathAt = [&](uint32_t Offset) {
+      return StringRef(OldText).substr(Offset).take_until([](char C) { return C == '\0'; });
+    };
+
+    std::vector<StringRef> Paths;
+    for (StringRef Rest = OldText; !Rest.empty();) {
+      auto [Path, Next] = Rest.split('\0');
+      Paths.push_back(Path);
+      Rest = Next;
+    }
+    llvm::sort(Paths);
+
+    Arena.truncateTail();
+    DenseMap<StringRef, uint32_t> NewOffsets;
+    for (StringRef Path : Paths) {
+      NewOffsets[Path] = Arena.getTail().size();
+      Arena.appendToTail(Path);
+      Arena.appendToTail(StringRef("\0", 1));
+    }
+
+    for (auto &[OldFileID, NewFileID] : IndexMap) {
+      NewFileID = NewOffsets.lookup(PathAt(NewFileID));
+      if (OldFileID < TranslationTable.size() - 1)
+        TranslationTable[OldFileID] = NewFileID;
+    }
+    for (auto &[Path, Offset] : PathOffsets)
+      Offset = NewOffsets.lookup(Path);
+  }
+
+  SourceInfoArena &getArena() { return Arena; }
+
+  StringRef getNewTextDataData() { return Arena.getTail(); }
 };
 
 #endif // REMAPPER_H
@@ -0,0 +1,122 @@
+#include "ResultCache.h"
+#include "SourceInfoFile.h"
+#include "Stats.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+Expected<std::unique_ptr<ResultCache>> ResultCache::open(StringRef Dir, uint64_t MaxBytes,
+                                                         uint64_t ConfigDigest) {
+  if (std::error_code EC = sys::fs::create_directories(Dir))
+    return createStringError(EC, "%s: %s", Dir.str().c_str(), EC.message().c_str());
+  return std::unique_ptr<ResultCache>(new ResultCache(Dir, MaxBytes, ConfigDigest));
+}
+
+uint64_t ResultCache::digest(StringRef Data) { return xxHash64(Data); }
+
+std::string ResultCache::getEntryPath(StringRef InputData) const {
+  std::string Name;
+  raw_string_ostream OS(Name);
+  OS << format_hex_no_prefix(digest(InputData), 16) << format_hex_no_prefix(ConfigDigest, 16)
+     << '-' << InputData.size();
+  OS.flush();
+
+  SmallString<256> Path(Dir);
+  sys::path::append(Path, StringRef(Name).take_front(2), Name);
+  return std::string(Path);
+}
+
+// Records a use of the entry in its access time, and keeps its modification time
+static void touchEntry(StringRef EntryPath) {
+  int FD;
+  if (sys::fs::openFileForRead(EntryPath, FD))
+    return;
+  sys::fs::file_status Status;
+  if (!sys::fs::status(FD, Status))
+    sys::fs::setLastAccessAndModificationTime(FD, std::chrono::system_clock::now(),
+                                              Status.getLastModificationTime());
+  sys::fs::closeFile(FD);
+}
+
+Expected<bool> ResultCache::materialize(StringRef EntryPath, StringRef OutputPath) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Entry =
+      MemoryBuffer::getFile(EntryPath, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+  if (!Entry) {
+    Misses++;
+    ImportStats::get().add(ImportStats::ResultCacheMisses, 1);
+    return false;
+  }
+
+  touchEntry(EntryPath);
+  RETURN_IF_ERROR(copyFileContent(EntryPath, OutputPath, (*Entry)->getBuffer()));
+  Hits++;
+  ImportStats::get().add(ImportStats::ResultCacheHits, 1);
+  return true;
+}
+
+void ResultCache::insert(StringRef EntryPath, StringRef OutputPath) {
+  uint64_t Size;
+  if (OutputPath == "-" || sys::fs::file_size(OutputPath, Size) ||
+      sys::fs::create_directories(sys::path::parent_path(EntryPath)))
+    return;
+
+  if (!linkFile(OutputPath, EntryPath, /*AllowHardLink=*/false)) {
+    SmallString<256> TempPath;
+    sys::fs::createUniquePath(EntryPath + ".tmp%%%%%%%", TempPath, /*MakeAbsolute=*/false);
+    if (sys::fs::copy_file(OutputPath, TempPath) || sys::fs::rename(TempPath, EntryPath)) {
+      sys::fs::remove(TempPath);
+      return;
+    }
+  }
+
+  bool NeedsTrim;
+  {
+    std::lock_guard<std::mutex> Guard(TrimLock);
+    AddedSinceTrim += Size;
+    NeedsTrim = AddedSinceTrim > MaxBytes / 8;
+  }
+  if (NeedsTrim)
+    trim();
+}
+
+void ResultCache::trim() {
+  std::lock_guard<std::mutex> Guard(TrimLock);
+  AddedSinceTrim = 0;
+
+  struct Entry {
+    sys::TimePoint<> LastUsed;
+    uint64_t Size;
+    std::string Path;
+  };
+  std::vector<Entry> Entries;
+  uint64_t Total = 0;
+
+  std::error_code EC;
+  for (sys::fs::recursive_directory_iterator It(Dir, EC), End; It != End && !EC;
+       It.increment(EC)) {
+    sys::fs::file_status Status;
+    if (sys::fs::status(It->path(), Status) || !sys::fs::is_regular_file(Status))
+      continue;
+    Entries.push_back({Status.getLastAccessedTime(), Status.getSize(), It->path()});
+    Total += Status.getSize();
+  }
+  if (Total <= MaxBytes)
+    return;
+
+  // Go down to 90% of the bound, so the next few entries don't scan the directory again
+  uint64_t Target = MaxBytes / 10 * 9;
+  std::sort(Entries.begin(), Entries.end(),
+            [](const Entry &A, const Entry &B) { return A.LastUsed < B.LastUsed; });
+  for (const Entry &E : Entries) {
+    if (Total <= Target)
+      break;
+    if (!sys::fs::remove(E.Path))
+      Total -= E.Size;
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace llvm;
+
+// An on-disk cache of remapped files, shared by all the processes using the same directory. An
+// entry is the output for one input and one configuration, keyed on the xxHash64 of the input
+// bytes, the input size and the digest of the configuration (the remap rules, and anything else
+// that changes the output):
+//
+//   <dir>/<first two hex digits>/<input digest><configuration digest>-<input size>
+//
+// Entries are written through a temporary file and a rename, so a reader never sees a partial
+// entry. The cache is bounded by size: the least recently used entries are removed first. Use is
+// recorded in the access time, which is set explicitly, so `noatime` mounts don't matter and the
+// modification time of the entry, which hard-linked outputs share, is never touched.
+class ResultCache {
+public:
+  // Creates the directory if needed
+  static Expected<std::unique_ptr<ResultCache>> open(StringRef Dir, uint64_t MaxBytes,
+                                                     uint64_t ConfigDigest);
+
+  static uint64_t digest(StringRef Data);
+
+  // The path of the entry for an input
+  std::string getEntryPath(StringRef InputData) const;
+
+  // Makes `OutputPath` the cached output at `EntryPath`, by cloning or hard-linking it where the
+  // file system allows it. Returns false on a miss.
+  Expected<bool> materialize(StringRef EntryPath, StringRef OutputPath);
+
+  // Adds the output just written to `OutputPath`. The entry is a clone or a copy, never a hard
+  // link, so the cache doesn't change when the output is written over in place. Failing to add an
+  // entry isn't an error; the cache only misses next time.
+  void insert(StringRef EntryPath, StringRef OutputPath);
+
+  // Removes the least recently used entries until the cache is below its size bound
+  void trim();
+
+  uint64_t getHits() const { return Hits.load(std::memory_order_relaxed); }
+  uint64_t getMisses() const { return Misses.load(std::memory_order_relaxed); }
+
+private:
+  ResultCache(StringRef Dir, uint64_t MaxBytes, uint64_t ConfigDigest)
+      : Dir(Dir.str()), MaxBytes(MaxBytes), ConfigDigest(ConfigDigest) {}
+
+  std::string Dir;
+  uint64_t MaxBytes;
+  uint64_t ConfigDigest;
+  std::atomic<uint64_t> Hits{0};
+  std::atomic<uint64_t> Misses{0};
+
+  // The bytes added since the last trim. A long batch or a server trims whenever it has added an
+  // eighth of the bound, instead of scanning the directory for every file.
+  std::mutex TrimLock;
+  uint64_t AddedSinceTrim = 0;
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,259 @@
+#include "Server.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Endian.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+// Requests larger than this are treated as a broken connection. Responses can be as large as the
+// output, up to the 4 GB the frame header can tell.
+static const uint32_t MaxRequestSize = 64 << 20;
+
+static Error errnoError(const Twine &Message) {
+  std::error_code EC(errno, std::generic_category());
+  return createStringError(EC, "%s: %s", Message.str().c_str(), EC.message().c_str());
+}
+
+static bool readAll(int FD, char *Data, size_t Size) {
+  while (Size > 0) {
+    ssize_t N = ::read(FD, Data, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Data += N;
+    Size -= N;
+  }
+  return true;
+}
+
+static bool writeAll(int FD, const char *Data, size_t Size) {
+  while (Size > 0) {
+    ssize_t N = ::write(FD, Data, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Data += N;
+    Size -= N;
+  }
+  return true;
+}
+
+static bool readFrame(int FD, std::string &Payload, uint32_t MaxSize) {
+  char Header[sizeof(uint32_t)];
+  if (!readAll(FD, Header, sizeof(Header)))
+    return false;
+  uint32_t Size = support::endian::read32le(Header);
+  if (Size > MaxSize)
+    return false;
+  Payload.resize(Size);
+  return readAll(FD, Payload.data(), Size);
+}
+
+// `Parts` are concatenated into one frame, written with a single call
+static bool writeFrame(int FD, ArrayRef<StringRef> Parts) {
+  std::string Frame(sizeof(uint32_t), '\0');
+  for (StringRef Part : Parts)
+    Frame.append(Part.data(), Part.size());
+  support::endian::write32le(Frame.data(), Frame.size() - sizeof(uint32_t));
+  return writeAll(FD, Frame.data(), Frame.size());
+}
+
+static bool makeSocketAddress(StringRef SocketPath, sockaddr_un &Addr) {
+  std::memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (SocketPath.size() >= sizeof(Addr.sun_path))
+    return false;
+  std::memcpy(Addr.sun_path, SocketPath.data(), SocketPath.size());
+  return true;
+}
+
+// Removes the socket file of a server that is gone, which refuses connections. Nothing else at
+// the path is removed.
+static Error removeStaleSocket(const std::string &SocketPath, const sockaddr_un &Addr) {
+  struct stat Status;
+  if (::lstat(SocketPath.c_str(), &Status) < 0)
+    return errno == ENOENT ? Error::success() : errnoError(SocketPath);
+  if (!S_ISSOCK(Status.st_mode))
+    return createStringError(std::errc::file_exists, "%s: the path exists and is not a socket.",
+                             SocketPath.c_str());
+
+  int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (FD < 0)
+    return errnoError(SocketPath);
+  int Result = ::connect(FD, reinterpret_cast<const sockaddr *>(&Addr), sizeof(Addr));
+  int ConnectErrno = errno;
+  ::close(FD);
+  if (Result == 0)
+    return createStringError(std::errc::address_in_use, "%s: a server is already serving.",
+                             SocketPath.c_str());
+  if (ConnectErrno != ECONNREFUSED) {
+    errno = ConnectErrno;
+    return errnoError(SocketPath);
+  }
+  if (::unlink(SocketPath.c_str()) < 0 && errno != ENOENT)
+    return errnoError(SocketPath);
+  return Error::success();
+}
+
+SourceInfoServer::SourceInfoServer(StringRef SocketPath, ServeHandler Handler, unsigned NumThreads)
+    : SocketPath(SocketPath.str()), Handler(std::move(Handler)),
+      Pool(std::make_unique<WorkStealingThreadPool>(NumThreads)) {}
+
+Error SourceInfoServer::run() {
+  // A client that goes away mid-response must not kill the server
+  ::signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un Addr;
+  if (!makeSocketAddress(SocketPath, Addr))
+    return createStringError(std::errc::filename_too_long, "%s: the socket path is too long.",
+                             SocketPath.c_str());
+
+  if (Error Err = removeStaleSocket(SocketPath, Addr))
+    return Err;
+  int ListenFD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (ListenFD < 0)
+    return errnoError(SocketPath);
+  // The socket file is identified by its inode, so that the one of a later server isn't removed
+  struct stat Bound;
+  if (::bind(ListenFD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0 ||
+      ::lstat(SocketPath.c_str(), &Bound) < 0 || ::listen(ListenFD, SOMAXCONN) < 0) {
+    Error Err = errnoError(SocketPath);
+    ::close(ListenFD);
+    return Err;
+  }
+
+  while (!ShuttingDown) {
+    int FD = ::accept(ListenFD, nullptr, nullptr);
+    if (FD < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      Error Err = errnoError(SocketPath);
+      ::close(ListenFD);
+      return Err;
+    }
+    if (ShuttingDown) {
+      ::close(FD);
+      break;
+    }
+
+    std::lock_guard<std::mutex> Guard(ConnectionsLock);
+    OpenConnections.insert(FD);
+    NumConnections++;
+    std::thread(&SourceInfoServer::serveConnection, this, FD).detach();
+  }
+  ::close(ListenFD);
+  struct stat Current;
+  if (::lstat(SocketPath.c_str(), &Current) == 0 && Current.st_dev == Bound.st_dev &&
+      Current.st_ino == Bound.st_ino)
+    ::unlink(SocketPath.c_str());
+
+  // Wake the idle connections, and wait for the ones answering a request
+  std::unique_lock<std::mutex> Guard(ConnectionsLock);
+  for (int FD : OpenConnections)
+    ::shutdown(FD, SHUT_RD);
+  ConnectionsDone.wait(Guard, [&] { return NumConnections == 0; });
+  return Error::success();
+}
+
+void SourceInfoServer::requestShutdown() {
+  ShuttingDown = true;
+
+  // Wake `accept` with a connection of our own
+  sockaddr_un Addr;
+  int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (FD < 0)
+    return;
+  if (makeSocketAddress(SocketPath, Addr))
+    ::connect(FD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr));
+  ::close(FD);
+}
+
+void SourceInfoServer::serveConnection(int FD) {
+  std::string Request;
+  while (!ShuttingDown && readFrame(FD, Request, MaxRequestSize)) {
+    SmallVector<StringRef, 8> Args;
+    StringRef(Request).split(Args, '\0');
+
+    ServeResponse Response;
+    if (Args.front() == "shutdown") {
+      requestShutdown();
+    } else {
+      // The connection thread only does the I/O. The request itself runs on the pool, where the
+      // per-thread state is warm.
+      std::promise<void> Done;
+      Pool->async([&] {
+        raw_string_ostream Out(Response.Output);
+        raw_string_ostream Err(Response.Errors);
+        Response.ExitCode = Handler(Args, Out, Err);
+        Out.flush();
+        Err.flush();
+        Done.set_value();
+      });
+      Done.get_future().wait();
+    }
+
+    char Header[2 * sizeof(uint32_t)];
+    if (Response.Output.size() + Response.Errors.size() > UINT32_MAX - sizeof(Header)) {
+      Response.ExitCode = 1;
+      Response.Output.clear();
+      Response.Errors = "source-info-import: The response is too large to send.\n";
+    }
+    support::endian::write32le(Header, Response.ExitCode);
+    support::endian::write32le(Header + sizeof(uint32_t), Response.Output.size());
+    if (!writeFrame(FD, {StringRef(Header, sizeof(Header)), Response.Output, Response.Errors}))
+      break;
+  }
+
+  std::lock_guard<std::mutex> Guard(ConnectionsLock);
+  OpenConnections.erase(FD);
+  ::close(FD);
+  if (--NumConnections == 0)
+    ConnectionsDone.notify_all();
+}
+
+Expected<int> connectToServer(StringRef SocketPath) {
+  sockaddr_un Addr;
+  if (!makeSocketAddress(SocketPath, Addr))
+    return createStringError(std::errc::filename_too_long, "%s: the socket path is too long.",
+                             SocketPath.str().c_str());
+
+  int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (FD < 0)
+    return errnoError(SocketPath);
+  if (::connect(FD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0) {
+    Error Err = errnoError(SocketPath);
+    ::close(FD);
+    return std::move(Err);
+  }
+  return FD;
+}
+
+Expected<ServeResponse> sendServeRequest(int FD, ArrayRef<StringRef> Args) {
+  std::string Request = join(Args.begin(), Args.end(), StringRef("\0", 1));
+  if (!writeFrame(FD, {Request}))
+    return errnoError("sending the request");
+
+  std::string Payload;
+  if (!readFrame(FD, Payload, UINT32_MAX) || Payload.size() < 2 * sizeof(uint32_t))
+    return createStringError(std::errc::connection_aborted, "The server closed the connection.");
+
+  ServeResponse Response;
+  Response.ExitCode = static_cast<int32_t>(support::endian::read32le(Payload.data()));
+  uint32_t OutputSize = support::endian::read32le(Payload.data() + sizeof(uint32_t));
+  StringRef Rest = StringRef(Payload).drop_front(2 * sizeof(uint32_t));
+  if (OutputSize > Rest.size())
+    return createStringError(std::errc::illegal_byte_sequence, "Malformed response.");
+  Response.Output = Rest.take_front(OutputSize).str();
+  Response.Errors = Rest.drop_front(OutputSize).str();
+  return std::move(Response);
+}
@@ -0,0 +1,72 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "ThreadPool.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+using namespace llvm;
+
+// A long-running server for tools that call the importer continuously. Requests run on a pool
+// whose threads live as long as the server, so the compiled rules, the remapped-path cache and the
+// per-thread arenas stay warm between them.
+//
+// Clients talk to it over a Unix domain socket. Every message is a frame: the payload size as a
+// 32-bit little-endian integer, then the payload.
+//
+//   Request   the command and its arguments, separated by '\0'
+//   Response  the exit code and the size of the output, both 32-bit little-endian, the output,
+//             then the error text
+//
+// A connection can send any number of requests, one at a time. The `shutdown` command stops the
+// server after the requests in flight have been answered. Requests are limited to 64 MB, and a
+// response too large for a frame is replaced with an error.
+
+struct ServeResponse {
+  int ExitCode = 0;
+  std::string Output;
+  std::string Errors;
+};
+
+// Runs a request. `Args` starts with the command. Returns the exit code.
+using ServeHandler =
+    std::function<int(ArrayRef<StringRef> Args, raw_ostream &Out, raw_ostream &Err)>;
+
+class SourceInfoServer {
+public:
+  SourceInfoServer(StringRef SocketPath, ServeHandler Handler, unsigned NumThreads = 0);
+
+  // Listens on the socket and serves until a client sends `shutdown`. A stale socket file at the
+  // path is replaced, but anything else there, or a socket another server is listening on, is an
+  // error. Only the socket this server bound is removed when it stops.
+  Error run();
+
+private:
+  void serveConnection(int FD);
+  void requestShutdown();
+
+  std::string SocketPath;
+  ServeHandler Handler;
+  std::unique_ptr<WorkStealingThreadPool> Pool;
+
+  std::atomic<bool> ShuttingDown{false};
+  std::mutex ConnectionsLock;
+  std::condition_variable ConnectionsDone;
+  std::set<int> OpenConnections;
+  size_t NumConnections = 0;
+};
+
+// The client side of the protocol
+Expected<int> connectToServer(StringRef SocketPath);
+Expected<ServeResponse> sendServeRequest(int FD, ArrayRef<StringRef> Args);
+
+#endif // SERVER_H
@@ -0,0 +1,89 @@
+#include "SourceInfo.h"
+#include "Stats.h"
+#include <cstring>
+
+Expected<std::unique_ptr<SourceInfo>> SourceInfo::open(StringRef Path) {
+  std::unique_ptr<MemoryBuffer> MB;
+  RETURN_IF_ERROR(openSourceInfo(Path).moveInto(MB));
+  return parse(std::move(MB), Path);
+}
+
+Expected<std::unique_ptr<SourceInfo>> SourceInfo::parse(std::unique_ptr<MemoryBuffer> Buffer,
+                                                        StringRef Path) {
+  std::unique_ptr<SwiftSourceInfo> Sections;
+  RETURN_IF_ERROR(parseSourceInfoBuffer(Buffer->getMemBufferRef()).moveInto(Sections));
+  MemoryBufferRef Ref = Buffer->getMemBufferRef();
+  return std::unique_ptr<SourceInfo>(
+      new SourceInfo(std::move(Buffer), Ref, Path, std::move(Sections)));
+}
+
+Expected<std::unique_ptr<SourceInfo>> SourceInfo::parse(MemoryBufferRef Buffer) {
+  std::unique_ptr<SwiftSourceInfo> Sections;
+  RETURN_IF_ERROR(parseSourceInfoBuffer(Buffer).moveInto(Sections));
+  return std::unique_ptr<SourceInfo>(new SourceInfo(nullptr, Buffer, "-", std::move(Sections)));
+}
+
+Expected<StringRef> SourceInfo::getFilePath(uint32_t FileID) const {
+  StringRef TextData = Sections->getTextData();
+  if (FileID >= TextData.size() || (FileID > 0 && TextData[FileID - 1] != '\0'))
+    return createStringError(std::errc::invalid_argument, "Invalid FileID %u.", FileID);
+  return TextData.substr(FileID).take_until([](char C) { return C == '\0'; });
+}
+
+namespace {
+
+// The memory reused by the files remapped on one thread: the arena for the remapped sections and
+// the buffer the new DECL_LOCS_BLOCK is encoded into.
+struct RemapSession {
+  SourceInfoArena Arena;
+  SmallVector<char, 0> BlockScratch;
+
+  static RemapSession &forCurrentThread() {
+    static thread_local RemapSession Session;
+    return Session;
+  }
+};
+
+} // end anonymous namespace
+
+Expected<std::optional<SourceInfoRewrite>>
+SourceInfo::prepareRemap(const FilePathRemapper &PathRemapper,
+                         const RemapOptions &Options) const {
+  RemapSession &Session = RemapSession::forCurrentThread();
+  // The sections are remapped in a copy, so this object keeps pointing into the file
+  SwiftSourceInfo Remapped = *Sections;
+  FileIDRemapper FIDRemapper(PathRemapper, Session.Arena, Options.Log ? *Options.Log : nulls());
+  if (!Remapped.remapFilePath(FIDRemapper, !Options.Log, Options.PatchThreads, Options.Normalize))
+    return std::nullopt;
+
+  PhaseScope Scope(ImportStats::Rewrite);
+  SourceInfoRewrite Rewrite;
+  RETURN_IF_ERROR(prepareRewrite(Remapped, Buffer, Session.BlockScratch).moveInto(Rewrite));
+  return std::move(Rewrite);
+}
+
+Expected<bool> SourceInfo::remapToBuffer(const FilePathRemapper &PathRemapper,
+                                         std::string &Output, const RemapOptions &Options) const {
+  std::optional<SourceInfoRewrite> Rewrite;
+  RETURN_IF_ERROR(prepareRemap(PathRemapper, Options).moveInto(Rewrite));
+  if (!Rewrite) {
+    Output.assign(Buffer.getBufferStart(), Buffer.getBufferSize());
+    return false;
+  }
+  Output.resize(Rewrite->size());
+  Rewrite->writeTo(Output.data());
+  return true;
+}
+
+Expected<bool> SourceInfo::remapToFile(const FilePathRemapper &PathRemapper,
+                                       StringRef OutputPath, const RemapOptions &Options) const {
+  std::optional<SourceInfoRewrite> Rewrite;
+  RETURN_IF_ERROR(prepareRemap(PathRemapper, Options).moveInto(Rewrite));
+  if (!Rewrite) {
+    ImportStats::get().add(ImportStats::UnchangedFiles, 1);
+    RETURN_IF_ERROR(copyFileContent(Path, OutputPath, Buffer.getBuffer()));
+    return false;
+  }
+  RETURN_IF_ERROR(writeSourceInfoFile(OutputPath, *Rewrite));
+  return true;
+}
@@ -0,0 +1,236 @@
+#ifndef SOURCE_INFO_H
+#define SOURCE_INFO_H
+
+// The library interface: a parsed .swiftsourceinfo file, with views of its records that read them
+// in place, path and USR lookups, and remapping to a buffer or a file. Everything reports errors
+// through `Expected`, so build tools can link the library and process files on their own threads
+// instead of spawning the command line tool.
+//
+//   auto SI = SourceInfo::open("Foo.swiftmodule/Project/arm64.swiftsourceinfo");
+//   if (!SI)
+//     return SI.takeError();
+//   for (const SourceFileRecord &File : (*SI)->getSourceFiles())
+//     ...
+//   FilePathRemapper Remapper;
+//   Remapper.addRemap("^/SOURCE_ROOT", "/work");
+//   Expected<bool> Changed = (*SI)->remapToFile(Remapper, "out.swiftsourceinfo");
+//
+// The record views are for the layout of the current compilers unless one is given; `withLayout`
+// reads the records of any version.
+
+#include "Remapper.h"
+#include "SourceInfoFile.h"
+#include "SwiftInternals.h"
+#include "SwiftSourceInfo.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/iterator.h"
+#include "llvm/ADT/iterator_range.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+
+using namespace llvm;
+using swift::serialization::DeclLocRecord;
+using swift::serialization::DocRangeRecord;
+using swift::serialization::RawLocRecord;
+using swift::serialization::SourceFileRecord;
+using swift::serialization::SourceInfoLayoutCurrent;
+
+// Walks every record of DocRanges, across the groups of the declarations
+template <typename RecordT = DocRangeRecord>
+class DocRangeIterator
+    : public iterator_facade_base<DocRangeIterator<RecordT>, std::forward_iterator_tag,
+                                  const RecordT> {
+  const char *Cursor = nullptr;
+  const char *End = nullptr;
+  // The records left in the current group
+  uint32_t Left = 0;
+
+  // Skips the counts of empty groups, and stops at the end of the data
+  void settle() {
+    while (Left == 0) {
+      if (Cursor + sizeof(uint32_t) > End) {
+        *this = DocRangeIterator();
+        return;
+      }
+      uint32_t Count;
+      std::memcpy(&Count, Cursor, sizeof(Count));
+      Cursor += sizeof(Count);
+      // A group cut short by the end of the data ends the walk after its last whole record
+      Left = std::min<size_t>(Count, (End - Cursor) / sizeof(RecordT));
+      if (Left < Count)
+        End = Cursor + Left * sizeof(RecordT);
+    }
+  }
+
+public:
+  DocRangeIterator() = default;
+  // `Data` is all of DocRanges, including its reserved first byte
+  explicit DocRangeIterator(StringRef Data) {
+    if (Data.empty())
+      return;
+    Cursor = Data.data() + 1; // Skip the reserved number
+    End = Data.data() + Data.size();
+    settle();
+  }
+
+  const RecordT &operator*() const { return *reinterpret_cast<const RecordT *>(Cursor); }
+
+  DocRangeIterator &operator++() {
+    Cursor += sizeof(RecordT);
+    Left--;
+    settle();
+    return *this;
+  }
+
+  bool operator==(const DocRangeIterator &Other) const { return Cursor == Other.Cursor; }
+};
+
+// What `SourceInfo::remapToBuffer` and `SourceInfo::remapToFile` do besides applying the rules
+struct RemapOptions {
+  NormalizeOptions Normalize;
+  // A large BasicDeclLocs is patched on up to this many threads
+  unsigned PatchThreads = 1;
+  // Receives the "old -> new" lines, if not null
+  raw_ostream *Log = nullptr;
+};
+
+// A parsed .swiftsourceinfo file. The views and the strings it returns point into the file, which
+// is memory-mapped when possible, and live as long as the object. Nothing is copied until a
+// remapped file is written.
+//
+// A `SourceInfo` can be read from several threads. Remapping uses memory that is reused by the
+// next remap on the same thread, and doesn't change the object.
+class SourceInfo {
+public:
+  // Memory-maps and parses the file at `Path`, or reads stdin for `-`
+  static Expected<std::unique_ptr<SourceInfo>> open(StringRef Path);
+
+  // Parses a file already in memory. `Path` is where it was read from, if anywhere, so that an
+  // unchanged file can be cloned instead of written.
+  static Expected<std::unique_ptr<SourceInfo>> parse(std::unique_ptr<MemoryBuffer> Buffer,
+                                                     StringRef Path = "-");
+
+  // Parses a buffer owned by the caller, which must outlive the object
+  static Expected<std::unique_ptr<SourceInfo>> parse(MemoryBufferRef Buffer);
+
+  MemoryBufferRef getBuffer() const { return Buffer; }
+  const SwiftSourceInfo &getSections() const { return *Sections; }
+
+  // The layout of the records, given by the version of the file
+  SourceInfoLayoutID getLayout() const { return Sections->getLayout(); }
+
+  // Calls `F` with the layout type of the file, so that the views below are compiled for it:
+  //
+  //   SI->withLayout([&](auto L) {
+  //     for (const auto &Decl : SI->getDeclLocs<decltype(L)>())
+  //       ...
+  //   });
+  template <typename Fn> decltype(auto) withLayout(Fn &&F) const {
+    return withSourceInfoLayout(getLayout(), std::forward<Fn>(F));
+  }
+
+  // The records, read in place. They are empty unless `Layout` is the layout of the file, which is
+  // the current one by default.
+  template <typename Layout = SourceInfoLayoutCurrent>
+  ArrayRef<typename Layout::SourceFileRecord> getSourceFiles() const {
+    return recordsOf<Layout, typename Layout::SourceFileRecord>(Sections->getSourceFileList());
+  }
+  template <typename Layout = SourceInfoLayoutCurrent>
+  ArrayRef<typename Layout::DeclLocRecord> getDeclLocs() const {
+    return recordsOf<Layout, typename Layout::DeclLocRecord>(Sections->getBasicDeclLocs());
+  }
+  template <typename Layout = SourceInfoLayoutCurrent>
+  iterator_range<DocRangeIterator<typename Layout::DocRangeRecord>> getDocRanges() const {
+    using Iterator = DocRangeIterator<typename Layout::DocRangeRecord>;
+    if (Layout::ID != getLayout())
+      return make_range(Iterator(), Iterator());
+    return make_range(Iterator(Sections->getDocRanges()), Iterator());
+  }
+
+  // The documentation ranges of one declaration
+  template <typename Layout = SourceInfoLayoutCurrent>
+  ArrayRef<typename Layout::DocRangeRecord>
+  getDocRanges(const typename Layout::DeclLocRecord &Decl) const {
+    using RecordT = typename Layout::DocRangeRecord;
+    StringRef Data = Sections->getDocRanges();
+    // Zero is the reserved number, for the declarations without documentation
+    if (Layout::ID != getLayout() || Decl.DocRanges == 0 ||
+        uint64_t(Decl.DocRanges) + sizeof(uint32_t) > Data.size())
+      return {};
+    uint32_t Count;
+    std::memcpy(&Count, Data.data() + Decl.DocRanges, sizeof(Count));
+    StringRef Records = Data.drop_front(Decl.DocRanges + sizeof(Count));
+    return recordsOf<Layout, RecordT>(Records).take_front(
+        std::min<size_t>(Count, Records.size() / sizeof(RecordT)));
+  }
+
+  // The path of a FileID, which is the offset of the path in TextData
+  Expected<StringRef> getFilePath(uint32_t FileID) const;
+
+  // Finds the declaration of `USR`, decoding only its record
+  std::optional<SwiftSourceInfo::DeclLocation> lookupUSR(StringRef USR) const {
+    return Sections->lookupUSR(USR);
+  }
+
+  // Calls `Callback` for every USR, in the order of the table
+  void forEachUSR(
+      function_ref<void(StringRef USR, const SwiftSourceInfo::DeclLocation &Loc)> Callback) const {
+    Sections->forEachUSR(Callback);
+  }
+
+  // Prints the human readable content, like the command line tool without options
+  void print(raw_ostream &OS) const { Sections->printContent(OS); }
+
+  // Remaps the paths and re-encodes the file. Returns std::nullopt when no byte would change. The
+  // rewrite points into memory of the current thread, and stays valid until its next remap.
+  Expected<std::optional<SourceInfoRewrite>> prepareRemap(const FilePathRemapper &PathRemapper,
+                                                          const RemapOptions &Options = {}) const;
+
+  // Writes the remapped file to `Output`, which is the input as it is if nothing changes. Returns
+  // whether anything changed.
+  Expected<bool> remapToBuffer(const FilePathRemapper &PathRemapper, std::string &Output,
+                               const RemapOptions &Options = {}) const;
+
+  // Writes the remapped file to `OutputPath`, or stdout for `-`. An unchanged file is cloned or
+  // hard-linked from the input where possible, and an output that already has the right bytes
+  // isn't touched. Returns whether anything changed.
+  Expected<bool> remapToFile(const FilePathRemapper &PathRemapper, StringRef OutputPath,
+                             const RemapOptions &Options = {}) const;
+
+  // Checks that the file is already normalized for the rules and options. Returns the first
+  // difference found.
+  Error checkNormalized(const FilePathRemapper &PathRemapper, NormalizeOptions Normalize) const {
+    return Sections->checkNormalized(PathRemapper, Normalize);
+  }
+
+  // Checks the structure of every section, so that a downloaded file can be rejected before it is
+  // read or remapped. The parser only checks the bitstream, and the USR lookups trust the hash
+  // table of DeclUSRs. Returns the first problem found.
+  Error verify() const { return Sections->verify(); }
+
+private:
+  SourceInfo(std::unique_ptr<MemoryBuffer> OwnedBuffer, MemoryBufferRef Buffer, StringRef Path,
+             std::unique_ptr<SwiftSourceInfo> Sections)
+      : OwnedBuffer(std::move(OwnedBuffer)), Buffer(Buffer), Path(Path.str()),
+        Sections(std::move(Sections)) {}
+
+  template <typename Layout, typename RecordT> ArrayRef<RecordT> recordsOf(StringRef Data) const {
+    static_assert(alignof(RecordT) == 1, "The records are packed, so they can be read in place.");
+    if (Layout::ID != getLayout())
+      return {};
+    return ArrayRef<RecordT>(reinterpret_cast<const RecordT *>(Data.data()),
+                             Data.size() / sizeof(RecordT));
+  }
+
+  std::unique_ptr<MemoryBuffer> OwnedBuffer;
+  MemoryBufferRef Buffer;
+  std::string Path;
+  std::unique_ptr<SwiftSourceInfo> Sections;
+};
+
+#endif // SOURCE_INFO_H
@@ -0,0 +1,84 @@
+#ifndef SOURCE_INFO_ARENA_H
+#define SOURCE_INFO_ARENA_H
+
+#include "llvm/ADT/StringRef.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+
+// A bump allocator for the rewritten sections of a file. It's sized from the sections of the input
+// before remapping, so a file normally takes one slab, and it's reset and reused for the next file.
+//
+// Besides plain copies, the arena has a growable tail: the bytes appended since the last copy. The
+// remapped TextData is built there, so it doesn't need a buffer of its own.
+class SourceInfoArena {
+  std::unique_ptr<char[]> Slab;
+  size_t Capacity = 0;
+  size_t Used = 0;
+  size_t TailStart = 0;
+  // The slabs outgrown since the last reset. Earlier allocations still point into them.
+  std::vector<std::unique_ptr<char[]>> RetiredSlabs;
+
+  // Moves the tail to a new slab with at least `MinFree` bytes free after it.
+  void grow(size_t MinFree) {
+    size_t TailSize = Used - TailStart;
+    size_t NewCapacity = std::max(Capacity * 2, TailSize + MinFree);
+    std::unique_ptr<char[]> NewSlab(new char[NewCapacity]);
+    if (TailSize > 0)
+      std::memcpy(NewSlab.get(), Slab.get() + TailStart, TailSize);
+
+    if (Slab)
+      RetiredSlabs.push_back(std::move(Slab));
+    Slab = std::move(NewSlab);
+    Capacity = NewCapacity;
+    TailStart = 0;
+    Used = TailSize;
+  }
+
+public:
+  // Releases all the allocations and makes sure `SizeHint` bytes fit in one slab. The slab itself
+  // is kept, so a long-running process stops allocating once it has seen its largest file.
+  void reset(size_t SizeHint) {
+    RetiredSlabs.clear();
+    Used = TailStart = 0;
+    if (Capacity < SizeHint) {
+      Slab.reset(new char[SizeHint]);
+      Capacity = SizeHint;
+    }
+  }
+
+  // Returns a mutable copy of `Data`, aligned to 16 bytes so that the records in it are aligned
+  // too. This closes the current tail.
+  MutableArrayRef<char> copy(StringRef Data) {
+    Used = (Used + 15) & ~size_t(15);
+    TailStart = Used;
+    if (Used > Capacity || Capacity - Used < Data.size())
+      grow(Data.size());
+
+    char *Copy = Slab.get() + Used;
+    if (!Data.empty())
+      std::memcpy(Copy, Data.data(), Data.size());
+    Used += Data.size();
+    TailStart = Used;
+    return MutableArrayRef<char>(Copy, Data.size());
+  }
+
+  void appendToTail(StringRef Data) {
+    if (Capacity - Used < Data.size())
+      grow(Data.size());
+    if (!Data.empty())
+      std::memcpy(Slab.get() + Used, Data.data(), Data.size());
+    Used += Data.size();
+  }
+
+  // Drops the bytes appended since the last copy
+  void truncateTail() { Used = TailStart; }
+
+  // The bytes appended since the last copy. Appending may move them.
+  StringRef getTail() const { return StringRef(Slab.get() + TailStart, Used - TailStart); }
+};
+
+#endif // SOURCE_INFO_ARENA_H
@@ -0,0 +1,581 @@
+#include "SourceInfoDiff.h"
+#include "DumpWriter.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include <cstring>
+
+// Whether the sections the comparison reads have the same bytes, which makes the files the same
+// whatever the rest of the bitstream has
+static bool haveSameSections(const SourceInfo &Old, const SourceInfo &New) {
+  const SwiftSourceInfo &A = Old.getSections();
+  const SwiftSourceInfo &B = New.getSections();
+  return Old.getLayout() == New.getLayout() && A.getTextData() == B.getTextData() &&
+         A.getSourceFileList() == B.getSourceFileList() &&
+         A.getBasicDeclLocs() == B.getBasicDeclLocs() && A.getDocRanges() == B.getDocRanges() &&
+         A.getDeclUSRs().Fields == B.getDeclUSRs().Fields &&
+         A.getDeclUSRs().Blob == B.getDeclUSRs().Blob;
+}
+
+// The non-empty paths of TextData, sorted and without duplicates
+static std::vector<StringRef> sortedPaths(const SourceInfo &SI) {
+  std::vector<StringRef> Paths;
+  for (StringRef Rest = SI.getSections().getTextData(); !Rest.empty();) {
+    auto [Path, Next] = Rest.split('\0');
+    if (!Path.empty())
+      Paths.push_back(Path);
+    Rest = Next;
+  }
+  llvm::sort(Paths);
+  Paths.erase(std::unique(Paths.begin(), Paths.end()), Paths.end());
+  return Paths;
+}
+
+// The source file records, sorted by path
+static std::vector<SourceFileSummary> sortedSourceFiles(const SourceInfo &SI) {
+  std::vector<SourceFileSummary> Files;
+  SI.withLayout([&](auto L) {
+    using Layout = decltype(L);
+    auto IsPadding = [](char C) { return C == '\0'; };
+    for (const auto &File : SI.getSourceFiles<Layout>()) {
+      SourceFileSummary Summary;
+      Expected<StringRef> Path = SI.getFilePath(File.FileID);
+      if (Path)
+        Summary.Path = *Path;
+      else
+        consumeError(Path.takeError());
+      Summary.Fingerprint = StringRef(reinterpret_cast<const char *>(File.Fingerprint1),
+                                      sizeof(File.Fingerprint1))
+                                .take_until(IsPadding);
+      if constexpr (Layout::HasFingerprint2) {
+        Summary.Fingerprint2 = StringRef(reinterpret_cast<const char *>(File.Fingerprint2),
+                                         sizeof(File.Fingerprint2))
+                                   .take_until(IsPadding);
+        Summary.HasFingerprint2 = true;
+      }
+      Summary.Timestamp = File.Timestamp;
+      Summary.Size = File.FileSize;
+      Files.push_back(Summary);
+    }
+  });
+  llvm::stable_sort(Files, [](const SourceFileSummary &A, const SourceFileSummary &B) {
+    return A.Path < B.Path;
+  });
+  return Files;
+}
+
+// Walks two sorted lists together, calling `Visit` with the elements only in `Old`, only in `New`
+// (the other one is null), or in both. Stops when `Visit` returns false.
+template <typename T, typename KeyFn, typename VisitFn>
+static void mergeSorted(ArrayRef<T> Old, ArrayRef<T> New, KeyFn Key, VisitFn &&Visit) {
+  size_t I = 0, J = 0;
+  while (I < Old.size() || J < New.size()) {
+    bool Continue;
+    if (J == New.size() || (I < Old.size() && Key(Old[I]) < Key(New[J])))
+      Continue = Visit(&Old[I++], nullptr);
+    else if (I == Old.size() || Key(New[J]) < Key(Old[I]))
+      Continue = Visit(nullptr, &New[J++]);
+    else
+      Continue = Visit(&Old[I++], &New[J++]);
+    if (!Continue)
+      return;
+  }
+}
+
+namespace {
+
+// The paths of FileIDs, each found once
+class PathCache {
+  const SourceInfo &SI;
+  DenseMap<uint32_t, StringRef> Paths;
+
+public:
+  explicit PathCache(const SourceInfo &SI) : SI(SI) {}
+
+  StringRef get(uint32_t FileID) {
+    auto [It, Inserted] = Paths.try_emplace(FileID);
+    if (Inserted) {
+      Expected<StringRef> Path = SI.getFilePath(FileID);
+      if (Path)
+        It->second = *Path;
+      else
+        consumeError(Path.takeError());
+    }
+    return It->second;
+  }
+};
+
+} // namespace
+
+template <typename Layout, typename LocT>
+static LocSummary summarizeLoc(const LocT &Loc, PathCache &Paths) {
+  LocSummary Summary;
+  if constexpr (Layout::HasRawLocs) {
+    Summary.Offset = Loc.Offset;
+    Summary.DirectivePath = Paths.get(Loc.FileID);
+  }
+  Summary.Line = Loc.Line;
+  Summary.Column = Loc.Column;
+  return Summary;
+}
+
+// The record at `Index` in BasicDeclLocs, if there is one
+static std::optional<DeclSummary> summarizeDecl(const SourceInfo &SI, uint32_t Index,
+                                                PathCache &Paths) {
+  return SI.withLayout([&](auto L) -> std::optional<DeclSummary> {
+    using Layout = decltype(L);
+    auto Decls = SI.getDeclLocs<Layout>();
+    if (Index >= Decls.size())
+      return std::nullopt;
+    const auto &Decl = Decls[Index];
+    DeclSummary Summary;
+    Summary.Path = Paths.get(Decl.FileID);
+    for (unsigned I = 0; I < 3; I++)
+      Summary.Locs[I] = summarizeLoc<Layout>(Decl.Locs[I], Paths);
+    for (const auto &Range : SI.getDocRanges<Layout>(Decl))
+      Summary.DocRanges.push_back({summarizeLoc<Layout>(Range.Loc, Paths), Range.Length});
+    Summary.HasRawLocs = Layout::HasRawLocs;
+    return Summary;
+  });
+}
+
+// Whether two locations are the same, including the offsets and the directive paths when `Raw`
+static bool isSameLoc(const LocSummary &A, const LocSummary &B, bool Raw) {
+  return A.Line == B.Line && A.Column == B.Column &&
+         (!Raw || (A.Offset == B.Offset && A.DirectivePath == B.DirectivePath));
+}
+
+static bool isSameDocRanges(ArrayRef<DocRangeSummary> A, ArrayRef<DocRangeSummary> B, bool Raw) {
+  return A.size() == B.size() &&
+         std::equal(A.begin(), A.end(), B.begin(),
+                    [&](const DocRangeSummary &X, const DocRangeSummary &Y) {
+                      return isSameLoc(X.Loc, Y.Loc, Raw) && X.Length == Y.Length;
+                    });
+}
+
+// Whether the declaration is somewhere else: another file, line or column
+static bool hasMoved(const DeclSummary &Old, const DeclSummary &New) {
+  return Old.Path != New.Path || !isSameLoc(Old.Locs[0], New.Locs[0], /*Raw=*/false);
+}
+
+static bool isSameDecl(const DeclSummary &Old, const DeclSummary &New) {
+  bool Raw = Old.HasRawLocs && New.HasRawLocs;
+  return Old.Path == New.Path && isSameLoc(Old.Locs[0], New.Locs[0], Raw) &&
+         isSameLoc(Old.Locs[1], New.Locs[1], Raw) && isSameLoc(Old.Locs[2], New.Locs[2], Raw) &&
+         isSameDocRanges(Old.DocRanges, New.DocRanges, Raw);
+}
+
+std::vector<SourceInfoChange> diffSourceInfo(const SourceInfo &Old, const SourceInfo &New,
+                                             bool StopAtFirst) {
+  std::vector<SourceInfoChange> Changes;
+  if (Old.getBuffer().getBuffer() == New.getBuffer().getBuffer() || haveSameSections(Old, New))
+    return Changes;
+
+  auto Add = [&](SourceInfoChange Change) {
+    Changes.push_back(std::move(Change));
+    return !StopAtFirst;
+  };
+
+  std::vector<StringRef> OldPaths = sortedPaths(Old);
+  std::vector<StringRef> NewPaths = sortedPaths(New);
+  mergeSorted<StringRef>(
+      OldPaths, NewPaths, [](StringRef Path) { return Path; },
+      [&](const StringRef *OldPath, const StringRef *NewPath) {
+        if (OldPath && NewPath)
+          return true;
+        SourceInfoChange Change{};
+        Change.Kind = SourceInfoChange::Path;
+        Change.Action = NewPath ? SourceInfoChange::Added : SourceInfoChange::Removed;
+        Change.Name = NewPath ? *NewPath : *OldPath;
+        return Add(Change);
+      });
+  if (StopAtFirst && !Changes.empty())
+    return Changes;
+
+  std::vector<SourceFileSummary> OldFiles = sortedSourceFiles(Old);
+  std::vector<SourceFileSummary> NewFiles = sortedSourceFiles(New);
+  mergeSorted<SourceFileSummary>(
+      OldFiles, NewFiles, [](const SourceFileSummary &File) { return File.Path; },
+      [&](const SourceFileSummary *OldFile, const SourceFileSummary *NewFile) {
+        if (OldFile && NewFile && *OldFile == *NewFile)
+          return true;
+        SourceInfoChange Change{};
+        Change.Kind = SourceInfoChange::SourceFile;
+        Change.Action = !OldFile   ? SourceInfoChange::Added
+                        : !NewFile ? SourceInfoChange::Removed
+                                   : SourceInfoChange::Changed;
+        Change.Name = OldFile ? OldFile->Path : NewFile->Path;
+        if (OldFile)
+          Change.OldFile = *OldFile;
+        if (NewFile)
+          Change.NewFile = *NewFile;
+        return Add(Change);
+      });
+  if (StopAtFirst && !Changes.empty())
+    return Changes;
+
+  // The tables are in hash order, so the declarations are sorted once they are all found
+  size_t FirstDecl = Changes.size();
+  PathCache OldFilePaths(Old), NewFilePaths(New);
+  Old.getSections().joinUSRs(
+      New.getSections(),
+      [&](StringRef USR, std::optional<uint32_t> OldIndex, std::optional<uint32_t> NewIndex) {
+        std::optional<DeclSummary> OldDecl, NewDecl;
+        if (OldIndex)
+          OldDecl = summarizeDecl(Old, *OldIndex, OldFilePaths);
+        if (NewIndex)
+          NewDecl = summarizeDecl(New, *NewIndex, NewFilePaths);
+        if (!OldDecl && !NewDecl)
+          return true;
+        if (OldDecl && NewDecl && isSameDecl(*OldDecl, *NewDecl))
+          return true;
+        SourceInfoChange Change{};
+        Change.Kind = SourceInfoChange::Decl;
+        Change.Action = !OldDecl                       ? SourceInfoChange::Added
+                        : !NewDecl                     ? SourceInfoChange::Removed
+                        : hasMoved(*OldDecl, *NewDecl) ? SourceInfoChange::Moved
+                                                       : SourceInfoChange::Changed;
+        Change.Name = USR;
+        if (OldDecl)
+          Change.OldDecl = std::move(*OldDecl);
+        if (NewDecl)
+          Change.NewDecl = std::move(*NewDecl);
+        return Add(std::move(Change));
+      });
+  std::sort(Changes.begin() + FirstDecl, Changes.end(),
+            [](const SourceInfoChange &A, const SourceInfoChange &B) { return A.Name < B.Name; });
+  return Changes;
+}
+
+namespace {
+
+// Writes the changes in one of the formats
+class ChangeFormatter {
+  DumpFormat Format;
+  DumpWriter Writer;
+
+  static StringRef getKindName(SourceInfoChange::KindType Kind, bool TSV) {
+    switch (Kind) {
+    case SourceInfoChange::Path:
+      return "path";
+    case SourceInfoChange::SourceFile:
+      return TSV ? "file" : "source_file";
+    case SourceInfoChange::Decl:
+      return "decl";
+    }
+    llvm_unreachable("Unknown change kind");
+  }
+
+  static StringRef getActionName(SourceInfoChange::ActionType Action) {
+    switch (Action) {
+    case SourceInfoChange::Added:
+      return "added";
+    case SourceInfoChange::Removed:
+      return "removed";
+    case SourceInfoChange::Changed:
+      return "changed";
+    case SourceInfoChange::Moved:
+      return "moved";
+    }
+    llvm_unreachable("Unknown change action");
+  }
+
+  void writeDeclLoc(const DeclSummary &Decl) {
+    Writer.write(Decl.Path);
+    Writer.write(':');
+    Writer.writeNumber(Decl.Locs[0].Line);
+    Writer.write(':');
+    Writer.writeNumber(Decl.Locs[0].Column);
+  }
+
+  // A location as `line:column`, with the offset after it when `Raw`, and the directive path
+  // before it when `Directive`
+  void writeLoc(const LocSummary &Loc, bool Raw, bool Directive) {
+    if (Raw && Directive) {
+      Writer.write(Loc.DirectivePath);
+      Writer.write(':');
+    }
+    Writer.writeNumber(Loc.Line);
+    Writer.write(':');
+    Writer.writeNumber(Loc.Column);
+    if (Raw) {
+      Writer.write('@');
+      Writer.writeNumber(Loc.Offset);
+    }
+  }
+
+  // The documentation ranges as `loc+length`, separated by commas
+  void writeDocRanges(ArrayRef<DocRangeSummary> Ranges, bool Raw, bool Directives) {
+    if (Ranges.empty())
+      Writer.write("none");
+    for (const DocRangeSummary &Range : Ranges) {
+      if (&Range != Ranges.begin())
+        Writer.write(',');
+      writeLoc(Range.Loc, Raw, Directives);
+      Writer.write('+');
+      Writer.writeNumber(Range.Length);
+    }
+  }
+
+  // The fields of a declaration that changed besides its location, as `name old -> new`. The
+  // directive paths are only written where they differ.
+  void writeDeclChanges(const DeclSummary &Old, const DeclSummary &New) {
+    bool Raw = Old.HasRawLocs && New.HasRawLocs;
+    bool First = true;
+    auto Separate = [&] {
+      Writer.write(First ? ": " : ", ");
+      First = false;
+    };
+    static const char *const LocNames[] = {"loc ", "start ", "end "};
+    for (unsigned I = 0; I < 3; I++) {
+      const LocSummary &OldLoc = Old.Locs[I], &NewLoc = New.Locs[I];
+      if (isSameLoc(OldLoc, NewLoc, Raw))
+        continue;
+      // A moved declaration has its line and column written already
+      if (I == 0 && hasMoved(Old, New) &&
+          (!Raw ||
+           (OldLoc.Offset == NewLoc.Offset && OldLoc.DirectivePath == NewLoc.DirectivePath)))
+        continue;
+      bool Directive = OldLoc.DirectivePath != NewLoc.DirectivePath;
+      Separate();
+      Writer.write(LocNames[I]);
+      writeLoc(OldLoc, Raw, Directive);
+      Writer.write(" -> ");
+      writeLoc(NewLoc, Raw, Directive);
+    }
+    if (!isSameDocRanges(Old.DocRanges, New.DocRanges, Raw)) {
+      bool Directives = false;
+      for (size_t I = 0; I < std::min(Old.DocRanges.size(), New.DocRanges.size()); I++)
+        Directives |= Old.DocRanges[I].Loc.DirectivePath != New.DocRanges[I].Loc.DirectivePath;
+      Separate();
+      Writer.write("doc ranges ");
+      writeDocRanges(Old.DocRanges, Raw, Directives);
+      Writer.write(" -> ");
+      writeDocRanges(New.DocRanges, Raw, Directives);
+    }
+  }
+
+  // The fields of a source file that changed, as `name old -> new`
+  void writeFileChanges(const SourceFileSummary &Old, const SourceFileSummary &New) {
+    bool First = true;
+    auto Separate = [&] {
+      Writer.write(First ? ": " : ", ");
+      First = false;
+    };
+    if (Old.Size != New.Size) {
+      Separate();
+      Writer.write("size ");
+      Writer.writeNumber(Old.Size);
+      Writer.write(" -> ");
+      Writer.writeNumber(New.Size);
+    }
+    if (Old.Timestamp != New.Timestamp) {
+      Separate();
+      Writer.write("timestamp ");
+      Writer.writeNumber(Old.Timestamp);
+      Writer.write(" -> ");
+      Writer.writeNumber(New.Timestamp);
+    }
+    if (Old.Fingerprint != New.Fingerprint) {
+      Separate();
+      Writer.write("fingerprint ");
+      Writer.write(Old.Fingerprint);
+      Writer.write(" -> ");
+      Writer.write(New.Fingerprint);
+    }
+    if (Old.hasOtherFingerprint2(New)) {
+      Separate();
+      Writer.write("fingerprint excluding type members ");
+      Writer.write(Old.Fingerprint2);
+      Writer.write(" -> ");
+      Writer.write(New.Fingerprint2);
+    }
+  }
+
+  void writeText(const SourceInfoChange &Change) {
+    Writer.write(Change.Action == SourceInfoChange::Added     ? "+ "
+                 : Change.Action == SourceInfoChange::Removed ? "- "
+                                                              : "~ ");
+    Writer.write(getKindName(Change.Kind, /*TSV=*/true));
+    Writer.write(' ');
+    Writer.write(Change.Name);
+    if (Change.Kind == SourceInfoChange::SourceFile &&
+        Change.Action == SourceInfoChange::Changed)
+      writeFileChanges(Change.OldFile, Change.NewFile);
+    if (Change.Kind == SourceInfoChange::Decl) {
+      Writer.write(' ');
+      if (Change.Action != SourceInfoChange::Added)
+        writeDeclLoc(Change.OldDecl);
+      if (Change.Action == SourceInfoChange::Moved)
+        Writer.write(" -> ");
+      if (Change.Action == SourceInfoChange::Added || Change.Action == SourceInfoChange::Moved)
+        writeDeclLoc(Change.NewDecl);
+      if (Change.Action == SourceInfoChange::Changed || Change.Action == SourceInfoChange::Moved)
+        writeDeclChanges(Change.OldDecl, Change.NewDecl);
+    }
+    Writer.write('\n');
+  }
+
+  // The fields of one side of a change, left empty on the side that doesn't have it. A
+  // declaration has the columns of `--dump --format=tsv`.
+  void writeTSVSide(const SourceInfoChange &Change, bool Present,
+                    const SourceFileSummary &File, const DeclSummary &Decl) {
+    if (Change.Kind == SourceInfoChange::SourceFile) {
+      Writer.write('\t');
+      if (Present)
+        Writer.writeTSVField(File.Fingerprint);
+      Writer.write('\t');
+      if (Present)
+        Writer.writeTSVField(File.Fingerprint2);
+      Writer.write('\t');
+      if (Present)
+        Writer.writeNumber(File.Timestamp);
+      Writer.write('\t');
+      if (Present)
+        Writer.writeNumber(File.Size);
+    } else if (Change.Kind == SourceInfoChange::Decl) {
+      Writer.write('\t');
+      if (Present)
+        Writer.writeTSVField(Decl.Path);
+      for (const LocSummary &Loc : Decl.Locs) {
+        Writer.write('\t');
+        if (Present && Decl.HasRawLocs)
+          Writer.writeNumber(Loc.Offset);
+        Writer.write('\t');
+        if (Present)
+          Writer.writeNumber(Loc.Line);
+        Writer.write('\t');
+        if (Present)
+          Writer.writeNumber(Loc.Column);
+      }
+      Writer.write('\t');
+      for (const DocRangeSummary &Range : Decl.DocRanges) {
+        if (&Range != Decl.DocRanges.begin())
+          Writer.write(',');
+        if (Decl.HasRawLocs)
+          Writer.writeNumber(Range.Loc.Offset);
+        Writer.write(':');
+        Writer.writeNumber(Range.Loc.Line);
+        Writer.write(':');
+        Writer.writeNumber(Range.Loc.Column);
+        Writer.write(':');
+        Writer.writeNumber(Range.Length);
+      }
+    }
+  }
+
+  void writeTSV(const SourceInfoChange &Change) {
+    Writer.write(getKindName(Change.Kind, /*TSV=*/true));
+    Writer.write('\t');
+    Writer.write(getActionName(Change.Action));
+    Writer.write('\t');
+    Writer.writeTSVField(Change.Name);
+    writeTSVSide(Change, Change.Action != SourceInfoChange::Added, Change.OldFile,
+                 Change.OldDecl);
+    writeTSVSide(Change, Change.Action != SourceInfoChange::Removed, Change.NewFile,
+                 Change.NewDecl);
+    Writer.write('\n');
+  }
+
+  // The fields of a location, with the offset and the directive path on the raw layouts
+  void writeJSONLoc(const LocSummary &Loc, bool Raw) {
+    if (Raw) {
+      Writer.write("\"offset\":");
+      Writer.writeNumber(Loc.Offset);
+      Writer.write(",\"directive\":");
+      Writer.writeJSONString(Loc.DirectivePath);
+      Writer.write(',');
+    }
+    Writer.write("\"line\":");
+    Writer.writeNumber(Loc.Line);
+    Writer.write(",\"column\":");
+    Writer.writeNumber(Loc.Column);
+  }
+
+  // A side of a change, with the fields of `--dump --format=json`
+  void writeJSONSide(StringRef Name, const SourceInfoChange &Change,
+                     const SourceFileSummary &File, const DeclSummary &Decl) {
+    Writer.write(",\"");
+    Writer.write(Name);
+    Writer.write("\":{");
+    if (Change.Kind == SourceInfoChange::SourceFile) {
+      Writer.write("\"fingerprint\":");
+      Writer.writeJSONString(File.Fingerprint);
+      if (File.HasFingerprint2) {
+        Writer.write(",\"fingerprint_excluding_type_members\":");
+        Writer.writeJSONString(File.Fingerprint2);
+      }
+      Writer.write(",\"timestamp_ns\":");
+      Writer.writeNumber(File.Timestamp);
+      Writer.write(",\"size\":");
+      Writer.writeNumber(File.Size);
+    } else {
+      Writer.write("\"path\":");
+      Writer.writeJSONString(Decl.Path);
+      static const char *const LocNames[] = {",\"loc\":{", ",\"start\":{", ",\"end\":{"};
+      for (unsigned I = 0; I < 3; I++) {
+        Writer.write(LocNames[I]);
+        writeJSONLoc(Decl.Locs[I], Decl.HasRawLocs);
+        Writer.write('}');
+      }
+      Writer.write(",\"doc_ranges\":[");
+      for (const DocRangeSummary &Range : Decl.DocRanges) {
+        Writer.write(&Range == Decl.DocRanges.begin() ? "{" : ",{");
+        writeJSONLoc(Range.Loc, Decl.HasRawLocs);
+        Writer.write(",\"length\":");
+        Writer.writeNumber(Range.Length);
+        Writer.write('}');
+      }
+      Writer.write(']');
+    }
+    Writer.write('}');
+  }
+
+  void writeJSON(const SourceInfoChange &Change, bool First) {
+    if (Format == DumpFormat::JSON)
+      Writer.write(First ? "\n" : ",\n");
+    Writer.write("{\"type\":\"");
+    Writer.write(getKindName(Change.Kind, /*TSV=*/false));
+    Writer.write("\",\"change\":\"");
+    Writer.write(getActionName(Change.Action));
+    Writer.write(Change.Kind == SourceInfoChange::Decl ? "\",\"usr\":" : "\",\"path\":");
+    Writer.writeJSONString(Change.Name);
+    if (Change.Kind != SourceInfoChange::Path) {
+      if (Change.Action != SourceInfoChange::Added)
+        writeJSONSide("old", Change, Change.OldFile, Change.OldDecl);
+      if (Change.Action != SourceInfoChange::Removed)
+        writeJSONSide("new", Change, Change.NewFile, Change.NewDecl);
+    }
+    Writer.write(Format == DumpFormat::NDJSON ? "}\n" : "}");
+  }
+
+public:
+  ChangeFormatter(DumpFormat Format, raw_ostream &OS) : Format(Format), Writer(OS) {}
+
+  void write(ArrayRef<SourceInfoChange> Changes) {
+    if (Format == DumpFormat::JSON)
+      Writer.write("{\"changes\":[");
+    for (const SourceInfoChange &Change : Changes) {
+      switch (Format) {
+      case DumpFormat::Text:
+        writeText(Change);
+        break;
+      case DumpFormat::TSV:
+        writeTSV(Change);
+        break;
+      case DumpFormat::NDJSON:
+      case DumpFormat::JSON:
+        writeJSON(Change, &Change == Changes.begin());
+        break;
+      }
+    }
+    if (Format == DumpFormat::JSON)
+      Writer.write(Changes.empty() ? "]}\n" : "\n]}\n");
+  }
+};
+
+} // namespace
+
+void printSourceInfoChanges(ArrayRef<SourceInfoChange> Changes, DumpFormat Format,
+                            raw_ostream &OS) {
+  ChangeFormatter(Format, OS).write(Changes);
+}
@@ -0,0 +1,96 @@
+#ifndef SOURCE_INFO_DIFF_H
+#define SOURCE_INFO_DIFF_H
+
+#include "SourceInfo.h"
+#include "SourceInfoDump.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+#include <vector>
+
+using namespace llvm;
+
+// A source file record, the same for every layout
+struct SourceFileSummary {
+  StringRef Path;
+  // Without the zeros that pad an unset fingerprint
+  StringRef Fingerprint;
+  // The fingerprint excluding type members, on the layouts that have one
+  StringRef Fingerprint2;
+  bool HasFingerprint2 = false;
+  uint64_t Timestamp = 0;
+  uint64_t Size = 0;
+
+  // Whether the second fingerprints differ, when both records have one
+  bool hasOtherFingerprint2(const SourceFileSummary &Other) const {
+    return HasFingerprint2 && Other.HasFingerprint2 && Fingerprint2 != Other.Fingerprint2;
+  }
+
+  bool operator==(const SourceFileSummary &Other) const {
+    return Path == Other.Path && Fingerprint == Other.Fingerprint &&
+           !hasOtherFingerprint2(Other) && Timestamp == Other.Timestamp && Size == Other.Size;
+  }
+};
+
+// A location of a declaration record, the same for every layout
+struct LocSummary {
+  // The offset and the path of the `#sourceLocation` directive, on the layouts with raw locations
+  uint32_t Offset = 0;
+  StringRef DirectivePath;
+  uint32_t Line = 0;
+  uint32_t Column = 0;
+};
+
+struct DocRangeSummary {
+  LocSummary Loc;
+  uint32_t Length = 0;
+};
+
+// A declaration record with its documentation ranges, the same for every layout
+struct DeclSummary {
+  StringRef Path;
+  // The location, the start and the end of the declaration
+  LocSummary Locs[3];
+  SmallVector<DocRangeSummary, 2> DocRanges;
+  // Whether the offsets and the directive paths are set
+  bool HasRawLocs = false;
+};
+
+// One difference between two files, found by `diffSourceInfo`
+struct SourceInfoChange {
+  enum KindType : uint8_t {
+    // A path in TextData
+    Path,
+    // A record of SourceFileList, by its path
+    SourceFile,
+    // A declaration, by its USR
+    Decl,
+  };
+  // A declaration whose location differs has `Moved`, and one whose other fields differ has
+  // `Changed`
+  enum ActionType : uint8_t { Added, Removed, Changed, Moved };
+
+  KindType Kind;
+  ActionType Action;
+  // The path, or the USR
+  StringRef Name;
+  // The source file records before and after, for `SourceFile`
+  SourceFileSummary OldFile, NewFile;
+  // The declaration records before and after, for `Decl`
+  DeclSummary OldDecl, NewDecl;
+};
+
+// Compares two files by content rather than bytes: the set of paths in TextData, the source files
+// by path and the declarations by USR, whatever their FileIDs, versions and the order of their
+// tables. A declaration is compared by its three locations and its documentation ranges, with the
+// offsets and the directive paths only when both files have them. The changes are in that order,
+// each kind sorted by path or USR. Identical files are found with a single comparison, and
+// `StopAtFirst` returns as soon as one change is found.
+std::vector<SourceInfoChange> diffSourceInfo(const SourceInfo &Old, const SourceInfo &New,
+                                             bool StopAtFirst = false);
+
+// Writes `Changes` to `OS` in `Format`: `+`, `-` and `~` lines for the text, and objects or lines
+// tagged with the kind and the action for the structured formats
+void printSourceInfoChanges(ArrayRef<SourceInfoChange> Changes, DumpFormat Format,
+                            raw_ostream &OS);
+
+#endif // SOURCE_INFO_DIFF_H
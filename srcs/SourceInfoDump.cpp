@@ -0,0 +1,281 @@
+#include "SourceInfoDump.h"
+#include "DumpWriter.h"
+#include "ThreadPool.h"
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Formats the records of one file in one of the structured formats. The fields a version doesn't
+// have are left out of the JSON objects, and left empty in the TSV lines.
+template <typename Layout> class RecordFormatter {
+  using SourceFileRecord = typename Layout::SourceFileRecord;
+  using DeclLocRecord = typename Layout::DeclLocRecord;
+  using DocRangeRecord = typename Layout::DocRangeRecord;
+
+  const SourceInfo &SI;
+  DumpFormat Format;
+  DumpWriter Writer;
+  // Consecutive declarations are mostly in the same file
+  uint32_t LastFileID = UINT32_MAX;
+  StringRef LastPath;
+
+  StringRef getPath(uint32_t FileID) {
+    if (FileID != LastFileID) {
+      LastFileID = FileID;
+      Expected<StringRef> Path = SI.getFilePath(FileID);
+      if (!Path) {
+        consumeError(Path.takeError());
+        LastPath = "";
+      } else {
+        LastPath = *Path;
+      }
+    }
+    return LastPath;
+  }
+
+  void writeField(StringRef Name, uint64_t Value) {
+    Writer.write('"');
+    Writer.write(Name);
+    Writer.write("\":");
+    Writer.writeNumber(Value);
+  }
+
+  void writeField(StringRef Name, StringRef Value) {
+    Writer.write('"');
+    Writer.write(Name);
+    Writer.write("\":");
+    Writer.writeJSONString(Value);
+  }
+
+  template <typename LocT> void writeJSONLoc(StringRef Name, const LocT &Loc) {
+    Writer.write(",\"");
+    Writer.write(Name);
+    Writer.write("\":{");
+    if constexpr (Layout::HasRawLocs) {
+      writeField("offset", Loc.Offset);
+      Writer.write(',');
+    }
+    writeField("line", Loc.Line);
+    Writer.write(',');
+    writeField("column", Loc.Column);
+    Writer.write('}');
+  }
+
+  template <typename LocT> void writeTSVLoc(const LocT &Loc) {
+    Writer.write('\t');
+    if constexpr (Layout::HasRawLocs)
+      Writer.writeNumber(Loc.Offset);
+    Writer.write('\t');
+    Writer.writeNumber(Loc.Line);
+    Writer.write('\t');
+    Writer.writeNumber(Loc.Column);
+  }
+
+  // Opens an object of the given type: a line of its own, or an element of the current array
+  void beginObject(StringRef Type, bool First) {
+    if (Format == DumpFormat::NDJSON) {
+      Writer.write("{\"type\":\"");
+      Writer.write(Type);
+      Writer.write("\",");
+    } else {
+      Writer.write(First ? "\n{" : ",\n{");
+    }
+  }
+
+  void endObject() { Writer.write(Format == DumpFormat::NDJSON ? "}\n" : "}"); }
+
+public:
+  RecordFormatter(const SourceInfo &SI, DumpFormat Format, raw_ostream &OS)
+      : SI(SI), Format(Format), Writer(OS) {}
+
+  void write(StringRef S) { Writer.write(S); }
+
+  void writeSourceFile(const SourceFileRecord &File, bool First) {
+    StringRef Path = getPath(File.FileID);
+    // The fingerprints are hex digits, padded with zeros when unset
+    auto IsPadding = [](char C) { return C == '\0'; };
+    StringRef Fingerprint1 = StringRef(reinterpret_cast<const char *>(File.Fingerprint1),
+                                       sizeof(File.Fingerprint1))
+                                 .take_until(IsPadding);
+    StringRef Fingerprint2;
+    if constexpr (Layout::HasFingerprint2)
+      Fingerprint2 = StringRef(reinterpret_cast<const char *>(File.Fingerprint2),
+                               sizeof(File.Fingerprint2))
+                         .take_until(IsPadding);
+
+    if (Format == DumpFormat::TSV) {
+      Writer.write("file\t");
+      Writer.writeTSVField(Path);
+      Writer.write('\t');
+      Writer.writeTSVField(Fingerprint1);
+      Writer.write('\t');
+      Writer.writeTSVField(Fingerprint2);
+      Writer.write('\t');
+      Writer.writeNumber(File.Timestamp);
+      Writer.write('\t');
+      Writer.writeNumber(File.FileSize);
+      Writer.write('\n');
+      return;
+    }
+
+    beginObject("source_file", First);
+    writeField("path", Path);
+    Writer.write(',');
+    writeField("fingerprint", Fingerprint1);
+    Writer.write(',');
+    if constexpr (Layout::HasFingerprint2) {
+      writeField("fingerprint_excluding_type_members", Fingerprint2);
+      Writer.write(',');
+    }
+    writeField("timestamp_ns", File.Timestamp);
+    Writer.write(',');
+    writeField("size", File.FileSize);
+    endObject();
+  }
+
+  void writeDecl(StringRef USR, const DeclLocRecord &Decl, bool First) {
+    StringRef Path = getPath(Decl.FileID);
+    ArrayRef<DocRangeRecord> DocRanges = SI.getDocRanges<Layout>(Decl);
+
+    if (Format == DumpFormat::TSV) {
+      Writer.write("decl\t");
+      Writer.writeTSVField(USR);
+      Writer.write('\t');
+      Writer.writeTSVField(Path);
+      for (const auto &Loc : Decl.Locs)
+        writeTSVLoc(Loc);
+      Writer.write('\t');
+      for (const DocRangeRecord &Range : DocRanges) {
+        if (&Range != DocRanges.begin())
+          Writer.write(',');
+        if constexpr (Layout::HasRawLocs)
+          Writer.writeNumber(Range.Loc.Offset);
+        Writer.write(':');
+        Writer.writeNumber(Range.Loc.Line);
+        Writer.write(':');
+        Writer.writeNumber(Range.Loc.Column);
+        Writer.write(':');
+        Writer.writeNumber(Range.Length);
+      }
+      Writer.write('\n');
+      return;
+    }
+
+    beginObject("decl", First);
+    writeField("usr", USR);
+    Writer.write(',');
+    writeField("path", Path);
+    writeJSONLoc("loc", Decl.Locs[0]);
+    writeJSONLoc("start", Decl.Locs[1]);
+    writeJSONLoc("end", Decl.Locs[2]);
+    Writer.write(",\"doc_ranges\":[");
+    for (const DocRangeRecord &Range : DocRanges) {
+      Writer.write(&Range == DocRanges.begin() ? "{" : ",{");
+      if constexpr (Layout::HasRawLocs) {
+        writeField("offset", Range.Loc.Offset);
+        Writer.write(',');
+      }
+      writeField("line", Range.Loc.Line);
+      Writer.write(',');
+      writeField("column", Range.Loc.Column);
+      Writer.write(',');
+      writeField("length", Range.Length);
+      Writer.write('}');
+    }
+    Writer.write(']');
+    endObject();
+  }
+};
+
+} // namespace
+
+// Below this many declarations, formatting on one thread is faster than handing out chunks
+static const size_t ParallelDeclThreshold = 64 * 1024;
+static const size_t DeclsPerChunk = 16 * 1024;
+
+// Formats the declarations in chunks on a pool, and writes the chunks in order. Only a few chunks
+// per thread are held in memory at a time. Returns whether any declaration was written.
+template <typename Layout>
+static bool writeDeclsInParallel(const SourceInfo &SI, DumpFormat Format, raw_ostream &OS,
+                                 unsigned NumThreads) {
+  ArrayRef<typename Layout::DeclLocRecord> Decls = SI.getDeclLocs<Layout>();
+  std::vector<std::pair<StringRef, uint32_t>> Entries;
+  Entries.reserve(Decls.size());
+  SI.getSections().forEachUSRIndex([&](StringRef USR, uint32_t Index) {
+    if (Index < Decls.size())
+      Entries.emplace_back(USR, Index);
+  });
+
+  size_t NumChunks = (Entries.size() + DeclsPerChunk - 1) / DeclsPerChunk;
+  size_t ChunksPerRound = size_t(NumThreads) * 4;
+  std::vector<std::string> Chunks(std::min(NumChunks, ChunksPerRound));
+  WorkStealingThreadPool Pool(NumThreads);
+
+  for (size_t Round = 0; Round < NumChunks; Round += ChunksPerRound) {
+    size_t RoundChunks = std::min(ChunksPerRound, NumChunks - Round);
+    for (size_t I = 0; I < RoundChunks; I++) {
+      Pool.async([&, I] {
+        size_t Begin = (Round + I) * DeclsPerChunk;
+        size_t End = std::min(Begin + DeclsPerChunk, Entries.size());
+        Chunks[I].clear();
+        raw_string_ostream ChunkOS(Chunks[I]);
+        RecordFormatter<Layout> Formatter(SI, Format, ChunkOS);
+        for (size_t E = Begin; E < End; E++)
+          Formatter.writeDecl(Entries[E].first, Decls[Entries[E].second], E == 0);
+      });
+    }
+    Pool.wait();
+    for (size_t I = 0; I < RoundChunks; I++)
+      OS << Chunks[I];
+  }
+  return !Entries.empty();
+}
+
+template <typename Layout>
+static void dumpRecords(const SourceInfo &SI, DumpFormat Format, raw_ostream &OS,
+                        unsigned NumThreads) {
+  ArrayRef<typename Layout::DeclLocRecord> Decls = SI.getDeclLocs<Layout>();
+  bool Parallel = NumThreads > 1 && Decls.size() >= ParallelDeclThreshold;
+  {
+    RecordFormatter<Layout> Formatter(SI, Format, OS);
+    if (Format == DumpFormat::JSON)
+      Formatter.write("{\"source_files\":[");
+    bool First = true;
+    for (const auto &File : SI.getSourceFiles<Layout>()) {
+      Formatter.writeSourceFile(File, First);
+      First = false;
+    }
+    if (Format == DumpFormat::JSON)
+      Formatter.write(First ? "],\"decls\":[" : "\n],\"decls\":[");
+
+    if (!Parallel) {
+      First = true;
+      SI.getSections().forEachUSRIndex([&](StringRef USR, uint32_t Index) {
+        if (Index >= Decls.size())
+          return;
+        Formatter.writeDecl(USR, Decls[Index], First);
+        First = false;
+      });
+      if (Format == DumpFormat::JSON)
+        Formatter.write(First ? "]}\n" : "\n]}\n");
+      return;
+    }
+  }
+
+  // The formatter above is flushed before the chunks are written
+  bool Written = writeDeclsInParallel<Layout>(SI, Format, OS, NumThreads);
+  if (Format == DumpFormat::JSON)
+    OS << (Written ? "\n]}\n" : "]}\n");
+}
+
+void dumpSourceInfo(const SourceInfo &SI, DumpFormat Format, raw_ostream &OS,
+                    unsigned NumThreads) {
+  if (Format == DumpFormat::Text) {
+    SI.print(OS);
+    return;
+  }
+  SI.withLayout([&](auto L) { dumpRecords<decltype(L)>(SI, Format, OS, NumThreads); });
+}
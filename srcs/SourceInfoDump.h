@@ -0,0 +1,29 @@
+#ifndef SOURCE_INFO_DUMP_H
+#define SOURCE_INFO_DUMP_H
+
+#include "SourceInfo.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+// The machine-readable forms of the whole content, for tools that would otherwise scrape the text
+// output. Unlike the text, they have every field: the full paths, the three locations of each
+// declaration, its documentation ranges, and the fingerprints of the source files.
+enum class DumpFormat {
+  // The human readable content, as printed by `SourceInfo::print`
+  Text,
+  // One JSON object per line: `"type": "source_file"` objects, then `"type": "decl"` objects
+  NDJSON,
+  // One JSON document, `{"source_files": [...], "decls": [...]}`
+  JSON,
+  // Tab-separated lines tagged `file` or `decl`, with tabs, newlines and backslashes escaped
+  TSV,
+};
+
+// Writes the content of `SI` to `OS` in `Format`. The declarations are formatted in the order of
+// the USR table; a large table is split into chunks formatted on up to `NumThreads` threads and
+// written in order, so the output doesn't depend on the thread count.
+void dumpSourceInfo(const SourceInfo &SI, DumpFormat Format, raw_ostream &OS,
+                    unsigned NumThreads = 1);
+
+#endif // SOURCE_INFO_DUMP_H
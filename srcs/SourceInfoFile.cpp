@@ -0,0 +1,564 @@
+#include "SourceInfoFile.h"
+#include "Stats.h"
+#include "SwiftInternals.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileOutputBuffer.h"
+#include "llvm/Support/FileSystem.h"
+#include <array>
+#include <cstring>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <sys/clonefile.h>
+#elif defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+using namespace llvm::support;
+using namespace swift::serialization;
+
+#define DEBUG_TYPE "debug"
+
+bool checkMagicNumber(BitstreamCursor &cursor) {
+  for (unsigned char byte : SWIFTSOURCEINFO_SIGNATURE) {
+    Expected<SimpleBitstreamCursor::word_t> maybeRead = cursor.Read(8);
+    if (maybeRead && maybeRead.get() != byte) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The section in each record of DECL_LOCS_BLOCK, by abbreviation
+static std::optional<LazySections::SectionID> sectionOfAbbrev(SourceInfoLayoutID Layout,
+                                                              unsigned AbbrevID) {
+  return withSourceInfoLayout(Layout, [&](auto L) -> std::optional<LazySections::SectionID> {
+    using LayoutT = decltype(L);
+    // A record the version doesn't have has the abbrev ID 0, which no record uses
+    if (AbbrevID == 0)
+      return std::nullopt;
+    if (AbbrevID == LayoutT::SourceFileListAbbrevID)
+      return LazySections::SourceFileList;
+    if (AbbrevID == LayoutT::BasicDeclLocsAbbrevID)
+      return LazySections::BasicDeclLocs;
+    if (AbbrevID == LayoutT::DeclUSRsAbbrevID)
+      return LazySections::DeclUSRs;
+    if (AbbrevID == LayoutT::TextDataAbbrevID)
+      return LazySections::TextData;
+    if (AbbrevID == LayoutT::DocRangesAbbrevID)
+      return LazySections::DocRanges;
+    return std::nullopt;
+  });
+}
+
+// The layout of the records, from the version in the control block
+static Expected<SourceInfoLayoutID> layoutOfVersion(std::optional<uint64_t> MajorVersion,
+                                                    uint64_t MinorVersion) {
+  if (!MajorVersion)
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "The file has no version in its control block.");
+  if (std::optional<SourceInfoLayoutID> Layout = getSourceInfoLayout(*MajorVersion))
+    return *Layout;
+  return createStringError(std::errc::not_supported,
+                           "The .swiftsourceinfo version %llu.%llu is not supported.",
+                           (unsigned long long)*MajorVersion, (unsigned long long)MinorVersion);
+}
+
+Expected<std::unique_ptr<SwiftSourceInfo>> parseSwiftSourceInfo(BitstreamCursor &Cursor) {
+  // Where each record starts, right after its abbreviation ID
+  struct RecordLocation {
+    unsigned AbbrevID = 0;
+    uint64_t BitNo = 0;
+  };
+  std::array<std::optional<RecordLocation>, LazySections::NumSections> Records;
+  std::optional<uint64_t> MajorVersion;
+  uint64_t MinorVersion = 0;
+  SourceInfoLayoutID Layout = SourceInfoLayoutCurrent::ID;
+
+  // Skim the stream: the version is read from the control block, the other blocks are skipped with
+  // their length words, and the records of DECL_LOCS_BLOCK with the lengths of their blobs,
+  // without reading them
+  unsigned BlockID = 0;
+  bool Done = false;
+  while (!Done && !Cursor.AtEndOfStream()) {
+    BitstreamEntry Entry;
+    RETURN_IF_ERROR(Cursor.advance(BitstreamCursor::AF_DontPopBlockAtEnd).moveInto(Entry));
+
+    switch (Entry.Kind) {
+    case BitstreamEntry::SubBlock:
+      LLVM_DEBUG(dbgs() << "[BitstreamEntry::SubBlock]\tID: " << Entry.ID << "\n");
+      if (Entry.ID != CONTROL_BLOCK_ID && Entry.ID != MODULE_SOURCEINFO_BLOCK_ID &&
+          Entry.ID != DECL_LOCS_BLOCK_ID) {
+        RETURN_IF_ERROR(Cursor.SkipBlock());
+      } else {
+        // A blob running past the end of the data is skipped as if it were empty, so a truncated
+        // file is caught by the length word of its block
+        unsigned NumWords;
+        RETURN_IF_ERROR(Cursor.EnterSubBlock(Entry.ID, &NumWords));
+        if (Cursor.GetCurrentBitNo() / 8 + uint64_t(NumWords) * 4 > Cursor.getBitcodeBytes().size())
+          return createStringError(std::errc::illegal_byte_sequence, "The file is truncated.");
+        BlockID = Entry.ID;
+        // The records are read with the abbrev IDs of the version
+        if (BlockID == DECL_LOCS_BLOCK_ID)
+          RETURN_IF_ERROR(layoutOfVersion(MajorVersion, MinorVersion).moveInto(Layout));
+      }
+      break;
+    case BitstreamEntry::EndBlock:
+      LLVM_DEBUG(dbgs() << "[BitstreamEntry::EndBlock]\tID: \n");
+      // The end of DECL_LOCS_BLOCK isn't popped, so its abbreviations stay for reading the records
+      if (BlockID == DECL_LOCS_BLOCK_ID) {
+        Done = true;
+        break;
+      }
+      if (Cursor.ReadBlockEnd())
+        return UNEXPECTED_BIT_ERROR;
+      BlockID = 0;
+      break;
+
+    case BitstreamEntry::Record: {
+      LLVM_DEBUG(dbgs() << "[BitstreamEntry::Record]\tID: " << Entry.ID << "\n");
+      if (BlockID == CONTROL_BLOCK_ID) {
+        SmallVector<uint64_t, 4> Fields;
+        StringRef Blob;
+        unsigned Code;
+        RETURN_IF_ERROR(Cursor.readRecord(Entry.ID, Fields, &Blob).moveInto(Code));
+        if (Code == CONTROL_METADATA && Fields.size() >= 2) {
+          MajorVersion = Fields[0];
+          MinorVersion = Fields[1];
+        }
+        break;
+      }
+
+      uint64_t BitNo = Cursor.GetCurrentBitNo();
+      RETURN_IF_ERROR(Cursor.skipRecord(Entry.ID).takeError());
+      if (BlockID != DECL_LOCS_BLOCK_ID)
+        break;
+
+      std::optional<LazySections::SectionID> Section = sectionOfAbbrev(Layout, Entry.ID);
+      if (!Section)
+        return UNEXPECTED_BIT_ERROR;
+      Records[*Section] = RecordLocation{Entry.ID, BitNo};
+      break;
+    }
+    default:
+      return UNEXPECTED_BIT_ERROR;
+    }
+  }
+
+  // The cursor keeps the abbreviations of the block. Every read works on a copy of it, so sections
+  // can be read on several threads at once.
+  auto Read = [Cursor, Records](LazySections::SectionID ID) -> SourceInfoRecord {
+    SourceInfoRecord Record;
+    if (!Records[ID])
+      return Record;
+
+    PhaseScope Scope(ImportStats::Parse);
+    BitstreamCursor SectionCursor = Cursor;
+    // The skim has already read the record with the same cursor, so this doesn't fail
+    if (Error Err = SectionCursor.JumpToBit(Records[ID]->BitNo)) {
+      consumeError(std::move(Err));
+      return Record;
+    }
+    Expected<unsigned> Code =
+        SectionCursor.readRecord(Records[ID]->AbbrevID, Record.Fields, &Record.Blob);
+    if (!Code) {
+      consumeError(Code.takeError());
+      return SourceInfoRecord();
+    }
+    return Record;
+  };
+  return std::make_unique<SwiftSourceInfo>(std::make_shared<const LazySections>(Read), Layout);
+}
+
+// Where a block sits in the input. Offsets are in bytes; block contents are always 32-bit aligned.
+struct BlockLocation {
+  // The offset of the 32-bit word that holds the length of the block in words
+  size_t LengthWordOffset;
+  // The end of the block, including its END_BLOCK
+  size_t ContentEnd;
+};
+
+// Skims the bitstream for the nested blocks in `BlockIDs`, skipping everything else. Leaves the
+// cursor right inside the innermost block, with the locations of the blocks in `Path`.
+static Error findBlockPath(BitstreamCursor &Cursor, ArrayRef<unsigned> BlockIDs,
+                           SmallVectorImpl<BlockLocation> &Path) {
+  while (!Cursor.AtEndOfStream()) {
+    BitstreamEntry Entry;
+    RETURN_IF_ERROR(Cursor.advance(BitstreamCursor::AF_DontAutoprocessAbbrevs).moveInto(Entry));
+
+    switch (Entry.Kind) {
+    case BitstreamEntry::SubBlock: {
+      if (Entry.ID != BlockIDs[Path.size()]) {
+        RETURN_IF_ERROR(Cursor.SkipBlock());
+        break;
+      }
+      unsigned NumWords;
+      RETURN_IF_ERROR(Cursor.EnterSubBlock(Entry.ID, &NumWords));
+      size_t ContentStart = Cursor.GetCurrentBitNo() / 8;
+      Path.push_back({ContentStart - sizeof(uint32_t), ContentStart + NumWords * 4});
+      if (Path.size() == BlockIDs.size())
+        return Error::success();
+      break;
+    }
+    case BitstreamEntry::EndBlock:
+      // Left a block on the path without finding the next one
+      return createStringError(std::errc::illegal_byte_sequence, "Block %u is not found.",
+                               BlockIDs[Path.size()]);
+    case BitstreamEntry::Record:
+      if (Entry.ID == bitc::DEFINE_ABBREV) {
+        RETURN_IF_ERROR(Cursor.ReadAbbrevRecord());
+      } else {
+        auto V = Cursor.skipRecord(Entry.ID);
+        if (!V)
+          return V.takeError();
+      }
+      break;
+    default:
+      return UNEXPECTED_BIT_ERROR;
+    }
+  }
+  return createStringError(std::errc::illegal_byte_sequence, "Block %u is not found.",
+                           BlockIDs[Path.size()]);
+}
+
+// Re-encodes the block the cursor has just entered, swapping in the remapped blobs, until its
+// END_BLOCK.
+static Error reencodeBlock(SwiftSourceInfo &SSI, BitstreamCursor &Cursor, BitstreamWriter &Writer,
+                           unsigned BlockID) {
+  int NumAbbrevs = 0;
+  int Depth = 0;
+
+  while (!Cursor.AtEndOfStream()) {
+    BitstreamEntry Entry;
+    RETURN_IF_ERROR(Cursor.advance(BitstreamCursor::AF_DontAutoprocessAbbrevs).moveInto(Entry));
+
+    switch (Entry.Kind) {
+    case BitstreamEntry::SubBlock: {
+      LLVM_DEBUG(dbgs() << "[BitstreamEntry::SubBlock]\tID: " << Entry.ID << "\n");
+      BlockID = Entry.ID;
+      RETURN_IF_ERROR(Cursor.EnterSubBlock(Entry.ID));
+      Writer.EnterSubblock(Entry.ID, Cursor.getAbbrevIDWidth());
+      Depth++;
+      break;
+    }
+    case BitstreamEntry::EndBlock: {
+      LLVM_DEBUG(dbgs() << "[BitstreamEntry::EndBlock]\n");
+      Writer.ExitBlock();
+      NumAbbrevs = 0;
+      if (Depth-- == 0)
+        return Error::success();
+      break;
+    }
+    case BitstreamEntry::Record: {
+      LLVM_DEBUG(dbgs() << "[BitstreamEntry::Record]\t");
+      if (Entry.ID == bitc::DEFINE_ABBREV) {
+        LLVM_DEBUG(dbgs() << "bitc::DEFINE_ABBREV\t");
+        RETURN_IF_ERROR(Cursor.ReadAbbrevRecord());
+
+        NumAbbrevs++;
+
+        auto AbbvID = NumAbbrevs + bitc::FIRST_APPLICATION_ABBREV - 1;
+        Expected<const BitCodeAbbrev *> MaybeAbbv = Cursor.getAbbrev(AbbvID);
+        if (!MaybeAbbv)
+          return MaybeAbbv.takeError();
+        auto Abbv = MaybeAbbv.get();
+        LLVM_DEBUG(dbgs() << "NumOperand: " << Abbv->getNumOperandInfos() << "\n");
+
+        Writer.EmitAbbrev(std::make_shared<BitCodeAbbrev>(*Abbv));
+
+      } else {
+        SmallVector<uint64_t, 64> Record;
+        StringRef Blob;
+        unsigned Code;
+
+        RETURN_IF_ERROR(Cursor.readRecord(Entry.ID, Record, &Blob).moveInto(Code))
+
+        if (Entry.ID == bitc::UNABBREV_RECORD) {
+          LLVM_DEBUG(dbgs() << "bitc::UNABBREV_RECORD\n");
+          Writer.EmitRecord(Code, Record);
+        } else {
+          LLVM_DEBUG(dbgs() << "RecordID: " << Entry.ID << "\n");
+          Record.insert(Record.begin(), Code);
+          if (BlockID == DECL_LOCS_BLOCK_ID) {
+            std::optional<LazySections::SectionID> Section =
+                sectionOfAbbrev(SSI.getLayout(), Entry.ID);
+            if (Section == LazySections::SourceFileList) {
+              Blob = SSI.getSourceFileList();
+            } else if (Section == LazySections::BasicDeclLocs) {
+              Blob = SSI.getBasicDeclLocs();
+            } else if (Section == LazySections::TextData) {
+              Blob = SSI.getTextData();
+            } else if (Section == LazySections::DocRanges) {
+              Blob = SSI.getDocRanges();
+            } else if (Section == LazySections::DeclUSRs) {
+              // We don't need to rewrite DeclUSRsData, because it doesn't reference any file paths.
+            }
+          }
+          Writer.EmitRecordWithBlob(Entry.ID, Record, Blob);
+        }
+      }
+      break;
+    }
+    default:
+      return UNEXPECTED_BIT_ERROR;
+    }
+  }
+  return UNEXPECTED_BIT_ERROR;
+}
+
+Expected<SourceInfoRewrite> prepareRewrite(SwiftSourceInfo &SSI, MemoryBufferRef Input,
+                                           SmallVectorImpl<char> &Block) {
+  BitstreamCursor Cursor{Input};
+  RETURN_IF_ERROR(Cursor.JumpToBit(sizeof(SWIFTSOURCEINFO_SIGNATURE) * 8));
+
+  SmallVector<BlockLocation, 2> Path;
+  RETURN_IF_ERROR(
+      findBlockPath(Cursor, {MODULE_SOURCEINFO_BLOCK_ID, DECL_LOCS_BLOCK_ID}, Path));
+
+  StringRef InputData = Input.getBuffer();
+  const BlockLocation &DeclLocs = Path.back();
+  if (DeclLocs.ContentEnd > InputData.size())
+    return createStringError(std::errc::illegal_byte_sequence, "The block is truncated.");
+
+  // Encode the new block on its own. Its content starts right after the length word.
+  Block.clear();
+  size_t ContentStart;
+  {
+    BitstreamWriter Writer{Block};
+    Writer.EnterSubblock(DECL_LOCS_BLOCK_ID, Cursor.getAbbrevIDWidth());
+    ContentStart = Writer.GetCurrentBitNo() / 8;
+    RETURN_IF_ERROR(reencodeBlock(SSI, Cursor, Writer, DECL_LOCS_BLOCK_ID));
+  }
+
+  SourceInfoRewrite Rewrite;
+  Rewrite.Head = InputData.take_front(DeclLocs.LengthWordOffset);
+  Rewrite.Content = StringRef(Block.data() + ContentStart, Block.size() - ContentStart);
+  Rewrite.Tail = InputData.drop_front(DeclLocs.ContentEnd);
+
+  // The enclosing blocks come before DECL_LOCS_BLOCK, so their length words are in the head.
+  size_t OldContentSize = DeclLocs.ContentEnd - DeclLocs.LengthWordOffset - sizeof(uint32_t);
+  Rewrite.DeltaWords = (int64_t(Rewrite.Content.size()) - int64_t(OldContentSize)) / 4;
+  for (const BlockLocation &Enclosing : ArrayRef<BlockLocation>(Path).drop_back())
+    Rewrite.EnclosingLengthWords.push_back(Enclosing.LengthWordOffset);
+  return std::move(Rewrite);
+}
+
+void SourceInfoRewrite::writeTo(char *Out) const {
+  std::memcpy(Out, Head.data(), Head.size());
+  for (size_t Offset : EnclosingLengthWords)
+    endian::write32le(Out + Offset, endian::read32le(Out + Offset) + DeltaWords);
+  Out += Head.size();
+
+  endian::write32le(Out, Content.size() / 4);
+  Out += sizeof(uint32_t);
+  std::memcpy(Out, Content.data(), Content.size());
+  Out += Content.size();
+  std::memcpy(Out, Tail.data(), Tail.size());
+}
+
+bool SourceInfoRewrite::equals(StringRef Data) const {
+  if (Data.size() != size())
+    return false;
+
+  // The head, with the enclosing length words as they would be written
+  size_t Offset = 0;
+  for (size_t Word : EnclosingLengthWords) {
+    if (Data.slice(Offset, Word) != Head.slice(Offset, Word) ||
+        endian::read32le(Data.data() + Word) !=
+            uint32_t(endian::read32le(Head.data() + Word) + DeltaWords))
+      return false;
+    Offset = Word + sizeof(uint32_t);
+  }
+  if (Data.slice(Offset, Head.size()) != Head.drop_front(Offset))
+    return false;
+  Data = Data.drop_front(Head.size());
+
+  if (endian::read32le(Data.data()) != Content.size() / 4)
+    return false;
+  Data = Data.drop_front(sizeof(uint32_t));
+  return Data.take_front(Content.size()) == Content && Data.drop_front(Content.size()) == Tail;
+}
+
+Error rewriteSwiftSourceInfo(SwiftSourceInfo &SSI, MemoryBufferRef Input,
+                             SmallVectorImpl<char> &Output, SmallVectorImpl<char> &Block) {
+  SourceInfoRewrite Rewrite;
+  RETURN_IF_ERROR(prepareRewrite(SSI, Input, Block).moveInto(Rewrite));
+  Output.resize(Rewrite.size());
+  Rewrite.writeTo(Output.data());
+  return Error::success();
+}
+
+// Returns whether `Path` is a regular file holding `Size` bytes that `Equals` accepts
+template <typename EqualsFn>
+static bool existingFileMatches(StringRef Path, size_t Size, EqualsFn &&Equals) {
+  sys::fs::file_status Status;
+  if (sys::fs::status(Path, Status) || !sys::fs::is_regular_file(Status) ||
+      Status.getSize() != Size)
+    return false;
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Existing =
+      MemoryBuffer::getFile(Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+  return Existing && Equals((*Existing)->getBuffer());
+}
+
+static Error writeFile(StringRef Path, size_t Size, function_ref<void(char *)> Write) {
+  // FileOutputBuffer maps a temporary file next to `Path` and renames it over `Path` on commit. It
+  // falls back to memory for stdout and for special files.
+  std::error_code EC;
+  Expected<std::unique_ptr<FileOutputBuffer>> Buffer = FileOutputBuffer::create(Path, Size);
+  if (!Buffer)
+    EC = errorToErrorCode(Buffer.takeError());
+  else {
+    Write(reinterpret_cast<char *>((*Buffer)->getBufferStart()));
+    EC = errorToErrorCode((*Buffer)->commit());
+  }
+  if (EC)
+    return createStringError(EC, "%s: %s", Path.str().c_str(), EC.message().c_str());
+  ImportStats::get().add(ImportStats::BytesOut, Size);
+  return Error::success();
+}
+
+Error writeSourceInfoFile(StringRef Path, const SourceInfoRewrite &Rewrite) {
+  PhaseScope Scope(ImportStats::Write, Path);
+  auto SameData = [&](StringRef Data) { return Rewrite.equals(Data); };
+  if (Path != "-" && existingFileMatches(Path, Rewrite.size(), SameData)) {
+    ImportStats::get().add(ImportStats::SkippedWrites, 1);
+    return Error::success();
+  }
+  return writeFile(Path, Rewrite.size(), [&](char *Out) { Rewrite.writeTo(Out); });
+}
+
+Error writeFileContent(StringRef Path, StringRef Data) {
+  PhaseScope Scope(ImportStats::Write, Path);
+  auto SameData = [&](StringRef Existing) { return Existing == Data; };
+  if (Path != "-" && existingFileMatches(Path, Data.size(), SameData)) {
+    ImportStats::get().add(ImportStats::SkippedWrites, 1);
+    return Error::success();
+  }
+  return writeFile(Path, Data.size(),
+                   [&](char *Out) { std::memcpy(Out, Data.data(), Data.size()); });
+}
+
+// Clones `From` to `To`, which must not exist, on file systems that share the blocks of a clone
+static std::error_code cloneFile(StringRef From, StringRef To) {
+#if defined(__APPLE__)
+  if (::clonefile(From.str().c_str(), To.str().c_str(), 0) != 0)
+    return std::error_code(errno, std::generic_category());
+  return std::error_code();
+#elif defined(__linux__) && defined(FICLONE)
+  int FromFD, ToFD;
+  if (std::error_code EC = sys::fs::openFileForRead(From, FromFD))
+    return EC;
+  std::error_code EC = sys::fs::openFileForWrite(To, ToFD, sys::fs::CD_CreateNew);
+  if (!EC) {
+    if (::ioctl(ToFD, FICLONE, FromFD) != 0) {
+      EC = std::error_code(errno, std::generic_category());
+      sys::fs::remove(To);
+    }
+    ::close(ToFD);
+  }
+  ::close(FromFD);
+  return EC;
+#else
+  return std::make_error_code(std::errc::operation_not_supported);
+#endif
+}
+
+bool linkFile(StringRef From, StringRef To, bool AllowHardLink) {
+  // Clone or link to a temporary name first, so that `To` is replaced atomically
+  SmallString<256> TempPath;
+  sys::fs::createUniquePath(To + ".tmp%%%%%%%", TempPath, /*MakeAbsolute=*/false);
+  if (cloneFile(From, TempPath) && (!AllowHardLink || sys::fs::create_hard_link(From, TempPath)))
+    return false;
+  if (!sys::fs::rename(TempPath, To))
+    return true;
+  sys::fs::remove(TempPath);
+  return false;
+}
+
+Error copyFileContent(StringRef DataPath, StringRef OutputPath, StringRef Data) {
+  PhaseScope Scope(ImportStats::Write, OutputPath);
+  auto SameData = [&](StringRef Existing) { return Existing == Data; };
+  if (OutputPath != "-" && existingFileMatches(OutputPath, Data.size(), SameData)) {
+    ImportStats::get().add(ImportStats::SkippedWrites, 1);
+    return Error::success();
+  }
+
+  if (DataPath != "-" && OutputPath != "-" && linkFile(DataPath, OutputPath, /*AllowHardLink=*/true))
+    return Error::success();
+  return writeFile(OutputPath, Data.size(),
+                   [&](char *Out) { std::memcpy(Out, Data.data(), Data.size()); });
+}
+
+Expected<std::unique_ptr<MemoryBuffer>> openBitcodeFile(StringRef Path) {
+  // A bitstream doesn't need a null terminator, and asking for one can keep the file from being
+  // memory-mapped.
+  Expected<std::unique_ptr<MemoryBuffer>> MemBufOrErr = errorOrToExpected(
+      MemoryBuffer::getFileOrSTDIN(Path, /*IsText=*/false, /*RequiresNullTerminator=*/false));
+  if (Error E = MemBufOrErr.takeError())
+    return std::move(E);
+
+  std::unique_ptr<MemoryBuffer> MemBuf = std::move(*MemBufOrErr);
+  return std::move(MemBuf);
+}
+
+Expected<std::unique_ptr<MemoryBuffer>> openSourceInfo(StringRef Path) {
+  PhaseScope Scope(ImportStats::Open, Path);
+  Expected<std::unique_ptr<MemoryBuffer>> MB = openBitcodeFile(Path);
+  if (MB)
+    ImportStats::get().add(ImportStats::BytesIn, (*MB)->getBufferSize());
+  return MB;
+}
+
+Expected<std::unique_ptr<MemoryBuffer>> readSourceInfo(StringRef Path) {
+  if (Path == "-")
+    return openSourceInfo(Path);
+  PhaseScope Scope(ImportStats::Open, Path);
+  // A volatile file is read rather than mapped
+  Expected<std::unique_ptr<MemoryBuffer>> MB = errorOrToExpected(
+      MemoryBuffer::getFile(Path, /*IsText=*/false, /*RequiresNullTerminator=*/false,
+                            /*IsVolatile=*/true));
+  if (MB)
+    ImportStats::get().add(ImportStats::BytesIn, (*MB)->getBufferSize());
+  return MB;
+}
+
+Expected<bool> hasSourceInfoSignature(StringRef Path) {
+  PhaseScope Scope(ImportStats::MagicCheck, Path);
+  Expected<sys::fs::file_t> File = sys::fs::openNativeFileForRead(Path);
+  if (!File)
+    return File.takeError();
+  char Head[sizeof(SWIFTSOURCEINFO_SIGNATURE)];
+  Expected<size_t> Size = sys::fs::readNativeFile(*File, Head);
+  sys::fs::closeFile(*File);
+  if (!Size)
+    return Size.takeError();
+  // checkMagicNumber stops at the end of the data, so a shorter file needs its own check
+  if (*Size < sizeof(Head))
+    return false;
+
+  llvm::BitstreamCursor Cursor{ArrayRef<uint8_t>((const uint8_t *)Head, sizeof(Head))};
+  return checkMagicNumber(Cursor);
+}
+
+Expected<std::unique_ptr<SwiftSourceInfo>> parseSourceInfoBuffer(MemoryBufferRef Buffer) {
+  llvm::BitstreamCursor Cursor{Buffer};
+
+  {
+    PhaseScope Scope(ImportStats::MagicCheck);
+    if (!checkMagicNumber(Cursor))
+      return createStringError(std::errc::invalid_argument,
+                               "The input is not a .swiftsourceinfo file.");
+  }
+
+  PhaseScope Scope(ImportStats::Parse);
+  return parseSwiftSourceInfo(Cursor);
+}
+
+Expected<std::unique_ptr<SwiftSourceInfo>> loadSourceInfo(StringRef Path,
+                                                           std::unique_ptr<MemoryBuffer> &MB) {
+  RETURN_IF_ERROR(openSourceInfo(Path).moveInto(MB));
+  return parseSourceInfoBuffer(MB->getMemBufferRef());
+}
@@ -0,0 +1,96 @@
+#ifndef SOURCE_INFO_FILE_H
+#define SOURCE_INFO_FILE_H
+
+// Reading and writing whole .swiftsourceinfo files: the bitstream layer around `SwiftSourceInfo`.
+
+#include "SwiftSourceInfo.h"
+#include "llvm/Bitstream/BitstreamReader.h"
+#include "llvm/Bitstream/BitstreamWriter.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <memory>
+
+using namespace llvm;
+
+#define RETURN_IF_ERROR(Err)                                                                       \
+  if (auto _err = (Err)) {                                                                         \
+    return std::move(_err);                                                                        \
+  }
+
+#define UNEXPECTED_BIT_ERROR                                                                       \
+  llvm::createStringError(std::errc::illegal_byte_sequence, "Unexpected bit in bitstream. (%d)",   \
+                          __LINE__)
+
+// Reads the signature and returns whether it's the one of .swiftsourceinfo
+bool checkMagicNumber(BitstreamCursor &cursor);
+
+// Finds the sections of DECL_LOCS_BLOCK. The sections point into the cursor's buffer.
+Expected<std::unique_ptr<SwiftSourceInfo>> parseSwiftSourceInfo(BitstreamCursor &Cursor);
+
+// A rewritten file, kept as the pieces it's made of until it's written out: the input up to the
+// length word of DECL_LOCS_BLOCK, the re-encoded content of the block, and the rest of the input.
+struct SourceInfoRewrite {
+  StringRef Head;
+  StringRef Content;
+  StringRef Tail;
+  // The offsets in `Head` of the length words of the blocks enclosing DECL_LOCS_BLOCK, outermost
+  // first. Each of them changes by `DeltaWords`.
+  SmallVector<size_t, 2> EnclosingLengthWords;
+  int64_t DeltaWords = 0;
+
+  size_t size() const { return Head.size() + sizeof(uint32_t) + Content.size() + Tail.size(); }
+
+  // Writes the `size()` bytes of the file to `Out`
+  void writeTo(char *Out) const;
+
+  // Returns whether `Data` is the file, without writing it anywhere
+  bool equals(StringRef Data) const;
+};
+
+// Re-encodes DECL_LOCS_BLOCK, the one block that references file paths, into `Block`. Everything
+// else, including the control block and the USR table, is taken verbatim from the input, and only
+// the length words of DECL_LOCS_BLOCK and its enclosing block are fixed up.
+Expected<SourceInfoRewrite> prepareRewrite(SwiftSourceInfo &SSI, MemoryBufferRef Input,
+                                           SmallVectorImpl<char> &Block);
+
+// Writes the remapped source info to `Output`. `Block` is scratch space for encoding the new block.
+Error rewriteSwiftSourceInfo(SwiftSourceInfo &SSI, MemoryBufferRef Input,
+                             SmallVectorImpl<char> &Output, SmallVectorImpl<char> &Block);
+
+// Writes the file to `Path` through a pre-sized, memory-mapped temporary file that is renamed over
+// it. An existing file with the same bytes is left alone, so its mtime doesn't change.
+Error writeSourceInfoFile(StringRef Path, const SourceInfoRewrite &Rewrite);
+
+// Writes `Data` to `Path` like `writeSourceInfoFile`, for an output already in memory
+Error writeFileContent(StringRef Path, StringRef Data);
+
+// Replaces `To` with a clone of `From`, or with a hard link to it if `AllowHardLink`. Returns false
+// when the file system supports neither.
+bool linkFile(StringRef From, StringRef To, bool AllowHardLink);
+
+// Makes `OutputPath` a copy of the file at `DataPath`, whose content is `Data`: a clone, or a hard
+// link, when the file system allows it. An output that already holds `Data` is left alone.
+Error copyFileContent(StringRef DataPath, StringRef OutputPath, StringRef Data);
+
+// Opens a file, or stdin for `-`
+Expected<std::unique_ptr<MemoryBuffer>> openBitcodeFile(StringRef Path);
+
+// Opens a .swiftsourceinfo file, or stdin for `-`, without parsing it
+Expected<std::unique_ptr<MemoryBuffer>> openSourceInfo(StringRef Path);
+
+// Reads a .swiftsourceinfo file into memory instead of mapping it, so the I/O is done on the
+// calling thread rather than on page faults while it's parsed. Stdin is read as with
+// `openSourceInfo`.
+Expected<std::unique_ptr<MemoryBuffer>> readSourceInfo(StringRef Path);
+
+// Whether the file starts with the .swiftsourceinfo signature. Only the signature is read.
+Expected<bool> hasSourceInfoSignature(StringRef Path);
+
+// Checks the signature and parses the file in `Buffer`. The parsed sections point into it.
+Expected<std::unique_ptr<SwiftSourceInfo>> parseSourceInfoBuffer(MemoryBufferRef Buffer);
+
+// Opens and parses a .swiftsourceinfo file. The parsed sections point into `MB`.
+Expected<std::unique_ptr<SwiftSourceInfo>> loadSourceInfo(StringRef Path,
+                                                          std::unique_ptr<MemoryBuffer> &MB);
+
+#endif // SOURCE_INFO_FILE_H
@@ -0,0 +1,181 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <chrono>
+#include <sys/resource.h>
+
+using namespace llvm;
+
+// The phase timings and counters behind --stats. Everything is summed over all the files and
+// threads. When --stats is off, the counters cost a relaxed load and nothing is timed.
+class ImportStats {
+public:
+  enum Phase {
+    Open,
+    CacheLookup,
+    MagicCheck,
+    Parse,
+    Verify,
+    PathRemap,
+    RecordPatch,
+    Rewrite,
+    Write,
+    NumPhases
+  };
+
+  enum Counter {
+    Files,
+    UnchangedFiles,
+    SkippedWrites,
+    SourceFileRecords,
+    DeclLocRecords,
+    DocRangeRecords,
+    UniqueFileIDs,
+    UniquePaths,
+    PathCacheHits,
+    PathCacheMisses,
+    ResultCacheHits,
+    ResultCacheMisses,
+    BytesIn,
+    BytesOut,
+    NumCounters
+  };
+
+  static ImportStats &get() {
+    static ImportStats Stats;
+    return Stats;
+  }
+
+  static StringRef getPhaseName(Phase P) {
+    static const char *const Names[] = {"Open",         "Cache lookup", "Magic check",
+                                        "Parse",        "Verify",       "Path remap",
+                                        "Record patch", "Rewrite",      "Write"};
+    return Names[P];
+  }
+
+  void enable() { Enabled = true; }
+  bool isEnabled() const { return Enabled.load(std::memory_order_relaxed); }
+
+  void add(Counter C, uint64_t N) {
+    if (isEnabled())
+      Counters[C].fetch_add(N, std::memory_order_relaxed);
+  }
+
+  void addTime(Phase P, std::chrono::nanoseconds Time) {
+    PhaseNanos[P].fetch_add(Time.count(), std::memory_order_relaxed);
+  }
+
+  void print(raw_ostream &OS, double WallSeconds) const {
+    auto Count = [&](Counter C) { return Counters[C].load(std::memory_order_relaxed); };
+
+    OS << "source-info-import: stats\n";
+    for (unsigned P = 0; P < NumPhases; P++)
+      OS << formatv("  {0,-22} {1,10:f3} ms\n", getPhaseName(Phase(P)),
+                    PhaseNanos[P].load(std::memory_order_relaxed) / 1e6);
+    OS << formatv("  {0,-22} {1,10:f3} ms\n", "Wall time", WallSeconds * 1e3);
+
+    OS << formatv("  {0,-22} {1,10}\n", "Files", Count(Files));
+    OS << formatv("  {0,-22} {1,10}\n", "Unchanged files", Count(UnchangedFiles));
+    OS << formatv("  {0,-22} {1,10}\n", "Skipped writes", Count(SkippedWrites));
+    OS << formatv("  {0,-22} {1,10}\n", "Source file records", Count(SourceFileRecords));
+    OS << formatv("  {0,-22} {1,10}\n", "Decl loc records", Count(DeclLocRecords));
+    OS << formatv("  {0,-22} {1,10}\n", "Doc range records", Count(DocRangeRecords));
+    OS << formatv("  {0,-22} {1,10}\n", "Unique FileIDs", Count(UniqueFileIDs));
+    OS << formatv("  {0,-22} {1,10}\n", "Unique paths", Count(UniquePaths));
+
+    uint64_t Lookups = Count(PathCacheHits) + Count(PathCacheMisses);
+    OS << formatv("  {0,-22} {1,9:f1}% ({2} hits, {3} misses)\n", "Path cache hit rate",
+                  Lookups ? 100.0 * Count(PathCacheHits) / Lookups : 0.0, Count(PathCacheHits),
+                  Count(PathCacheMisses));
+
+    uint64_t CacheLookups = Count(ResultCacheHits) + Count(ResultCacheMisses);
+    OS << formatv("  {0,-22} {1,9:f1}% ({2} hits, {3} misses)\n", "Result cache hit rate",
+                  CacheLookups ? 100.0 * Count(ResultCacheHits) / CacheLookups : 0.0,
+                  Count(ResultCacheHits), Count(ResultCacheMisses));
+
+    OS << formatv("  {0,-22} {1,10}\n", "Bytes in", Count(BytesIn));
+    OS << formatv("  {0,-22} {1,10}\n", "Bytes out", Count(BytesOut));
+    OS << formatv("  {0,-22} {1,10:f1} MB\n", "Peak RSS", getPeakRSS() / 1e6);
+  }
+
+private:
+  static uint64_t getPeakRSS() {
+    struct rusage Usage;
+    if (getrusage(RUSAGE_SELF, &Usage) != 0)
+      return 0;
+#ifdef __APPLE__
+    return Usage.ru_maxrss; // bytes
+#else
+    return uint64_t(Usage.ru_maxrss) * 1024; // kilobytes
+#endif
+  }
+
+  std::atomic<bool> Enabled{false};
+  std::atomic<uint64_t> PhaseNanos[NumPhases] = {};
+  std::atomic<uint64_t> Counters[NumCounters] = {};
+};
+
+// Times a phase for --stats, and makes it a span in the --time-trace output
+class PhaseScope {
+  ImportStats::Phase P;
+  bool Timing;
+  std::chrono::steady_clock::time_point Start;
+  TimeTraceScope Trace;
+
+public:
+  explicit PhaseScope(ImportStats::Phase P, StringRef Detail = "")
+      : P(P), Timing(ImportStats::get().isEnabled()),
+        Trace(ImportStats::getPhaseName(P), Detail) {
+    if (Timing)
+      Start = std::chrono::steady_clock::now();
+  }
+
+  ~PhaseScope() {
+    if (Timing)
+      ImportStats::get().addTime(P, std::chrono::steady_clock::now() - Start);
+  }
+};
+
+// The span of a whole file in the --time-trace output. The profiler is per thread: the main thread
+// starts it in `main`, and a worker thread starts its own on its first file and hands it over to
+// the main thread when it exits.
+class FileScope {
+  struct ThreadProfiler {
+    ThreadProfiler() { timeTraceProfilerInitialize(/*TimeTraceGranularity=*/0, ProcessName); }
+    ~ThreadProfiler() { timeTraceProfilerFinishThread(); }
+  };
+
+  static constexpr const char *ProcessName = "source-info-import";
+
+  static std::atomic<bool> &isTracing() {
+    static std::atomic<bool> Tracing{false};
+    return Tracing;
+  }
+
+  static void ensureThreadProfiler() {
+    if (isTracing().load(std::memory_order_relaxed) && !timeTraceProfilerEnabled()) {
+      static thread_local ThreadProfiler Profiler;
+      (void)Profiler;
+    }
+  }
+
+  TimeTraceScope Trace;
+
+public:
+  explicit FileScope(StringRef Path) : Trace((ensureThreadProfiler(), "File"), Path) {
+    ImportStats::get().add(ImportStats::Files, 1);
+  }
+
+  // Starts the profiler of the main thread
+  static void startTracing() {
+    timeTraceProfilerInitialize(/*TimeTraceGranularity=*/0, ProcessName);
+    isTracing() = true;
+  }
+};
+
+#endif // STATS_H
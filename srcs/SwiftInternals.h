@@ -2,10 +2,15 @@
 #define SWIFT_INTERNALS_H
 
 // The file contains the internal data structures and constants for .swiftsourceinfo format.
-// Those are not guaranteed to be stable across the Swift versions.
+// Those are not guaranteed to be stable across the Swift versions; the ones known to have changed
+// are described per version of the format.
 
 #include "llvm/Support/DJB.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/OnDiskHashTable.h"
+#include <array>
+#include <cstddef>
+#include <optional>
 
 using namespace llvm;
 
@@ -22,18 +27,15 @@ const unsigned CONTROL_BLOCK_ID = 9;
 const unsigned MODULE_SOURCEINFO_BLOCK_ID = 192;
 const unsigned DECL_LOCS_BLOCK_ID = 193;
 
-// Abbrev IDs
-// Derived from swift/lib/Serialization/SourceInfoFormat.h
-const unsigned SOURCE_FILE_LIST_ABBREV_ID = 4;
-const unsigned BASIC_DECL_LOCS_ABBREV_ID = 5;
-const unsigned DECL_USRS_ABBREV_ID = 6;
-const unsigned TEXT_DATA_ABBREV_ID = 7;
-const unsigned DOC_RANGES_ABBREV_ID = 8;
+// The record code of the version in CONTROL_BLOCK: the major and minor versions of the format, then
+// the compiler version
+// Copied from swift/lib/Serialization/ModuleFormat.h
+const unsigned CONTROL_METADATA = 1;
 
 // Copied from swift/lib/Serialization/SourceInfoFormat.h
 const uint32_t SWIFTSOURCEINFO_HASH_SEED = 5387;
 
-// The memory layout of the items in source info blob
+// The memory layout of the items in source info blob, as written by the current compilers
 // Derived from swift/lib/Serialization/ModuleFile.cpp
 struct __attribute__((packed)) SourceFileRecord {
   uint32_t FileID;
@@ -43,26 +45,148 @@ struct __attribute__((packed)) SourceFileRecord {
   uint64_t FileSize;
 };
 
+// A location: the position in the file, and the #sourceLocation directive it is under, whose file
+// name is a FileID too
+struct __attribute__((packed)) RawLocRecord {
+  uint32_t Offset;
+  uint32_t Line;
+  uint32_t Column;
+  uint32_t Skipped[3]; // data not interesting for us
+  uint32_t FileID;
+};
+
 struct __attribute__((packed)) DeclLocRecord {
   uint32_t FileID;
   uint32_t DocRanges;
-  struct __attribute__((packed)) {
-    uint32_t Offset;
-    uint32_t Line;
-    uint32_t Column;
-    uint32_t Skipped[3]; // data not interesting for us
-    uint32_t FileID;
-  } Locs[3];
+  RawLocRecord Locs[3]; // the location, the start and the end of the declaration
 };
 
 struct __attribute__((packed)) DocRangeRecord {
-  struct __attribute__((packed)) {
-    uint32_t Skipped[6];
-    uint32_t FileID;
-  } Loc;
-  uint32_t Skipped;
+  RawLocRecord Loc;
+  uint32_t Length;
 };
 
+// The records of the versions before the external source locations, whose locations are only a
+// line and a column, and whose source files have one fingerprint
+// Derived from the history of swift/lib/Serialization/SerializeDoc.cpp
+struct __attribute__((packed)) LineColumnRecord {
+  uint32_t Line;
+  uint32_t Column;
+};
+
+struct __attribute__((packed)) LineColumnDeclLocRecord {
+  uint32_t FileID;
+  uint32_t DocRanges;
+  LineColumnRecord Locs[3];
+};
+
+struct __attribute__((packed)) LineColumnDocRangeRecord {
+  LineColumnRecord Loc;
+  uint32_t Length;
+};
+
+struct __attribute__((packed)) SingleFingerprintSourceFileRecord {
+  uint32_t FileID;
+  uint8_t Fingerprint1[32];
+  uint64_t Timestamp;
+  uint64_t FileSize;
+};
+
+// The versions of the format this tool reads, each described by a layout type below. The layout
+// is picked once per file from the major version in CONTROL_BLOCK, and the loops over the records
+// are instantiated for each layout, so the record sizes and field offsets are constants in them.
+enum class SourceInfoLayoutID : uint8_t { V1, V2, V3 };
+
+// Version 1: no SourceFileList
+struct SourceInfoLayoutV1 {
+  static constexpr SourceInfoLayoutID ID = SourceInfoLayoutID::V1;
+  static constexpr unsigned MajorVersion = 1;
+
+  // The abbrev IDs of the records in DECL_LOCS_BLOCK, in the order the compiler defines them. Zero
+  // for a record the version doesn't have.
+  static constexpr unsigned SourceFileListAbbrevID = 0;
+  static constexpr unsigned BasicDeclLocsAbbrevID = 4;
+  static constexpr unsigned DeclUSRsAbbrevID = 5;
+  static constexpr unsigned TextDataAbbrevID = 6;
+  static constexpr unsigned DocRangesAbbrevID = 7;
+
+  using SourceFileRecord = SingleFingerprintSourceFileRecord;
+  using DeclLocRecord = LineColumnDeclLocRecord;
+  using DocRangeRecord = LineColumnDocRangeRecord;
+  // Whether the locations have an offset and a directive FileID, besides the line and column
+  static constexpr bool HasRawLocs = false;
+  static constexpr bool HasFingerprint2 = false;
+
+  // The byte offsets of the FileID fields in the records
+  static constexpr std::array<size_t, 1> SourceFileRecordFileIDs = {
+      offsetof(SourceFileRecord, FileID)};
+  static constexpr std::array<size_t, 1> DeclLocRecordFileIDs = {offsetof(DeclLocRecord, FileID)};
+  static constexpr std::array<size_t, 0> DocRangeRecordFileIDs = {};
+};
+
+// Version 2: SourceFileList is added, as the first record
+struct SourceInfoLayoutV2 : SourceInfoLayoutV1 {
+  static constexpr SourceInfoLayoutID ID = SourceInfoLayoutID::V2;
+  static constexpr unsigned MajorVersion = 2;
+
+  static constexpr unsigned SourceFileListAbbrevID = 4;
+  static constexpr unsigned BasicDeclLocsAbbrevID = 5;
+  static constexpr unsigned DeclUSRsAbbrevID = 6;
+  static constexpr unsigned TextDataAbbrevID = 7;
+  static constexpr unsigned DocRangesAbbrevID = 8;
+};
+
+// Version 3: the locations are external source locations, and the source files have the
+// fingerprints including and excluding the type members
+struct SourceInfoLayoutV3 : SourceInfoLayoutV2 {
+  static constexpr SourceInfoLayoutID ID = SourceInfoLayoutID::V3;
+  static constexpr unsigned MajorVersion = 3;
+
+  using SourceFileRecord = swift::serialization::SourceFileRecord;
+  using DeclLocRecord = swift::serialization::DeclLocRecord;
+  using DocRangeRecord = swift::serialization::DocRangeRecord;
+  static constexpr bool HasRawLocs = true;
+  static constexpr bool HasFingerprint2 = true;
+
+  static constexpr std::array<size_t, 1> SourceFileRecordFileIDs = {
+      offsetof(SourceFileRecord, FileID)};
+  static constexpr std::array<size_t, 4> DeclLocRecordFileIDs = {
+      offsetof(DeclLocRecord, FileID), offsetof(DeclLocRecord, Locs[0].FileID),
+      offsetof(DeclLocRecord, Locs[1].FileID), offsetof(DeclLocRecord, Locs[2].FileID)};
+  static constexpr std::array<size_t, 1> DocRangeRecordFileIDs = {
+      offsetof(DocRangeRecord, Loc.FileID)};
+};
+
+// The layout of the files written by the current compilers
+using SourceInfoLayoutCurrent = SourceInfoLayoutV3;
+
+// The layout of a major version, if it's one this tool reads
+inline std::optional<SourceInfoLayoutID> getSourceInfoLayout(uint64_t MajorVersion) {
+  switch (MajorVersion) {
+  case SourceInfoLayoutV1::MajorVersion:
+    return SourceInfoLayoutID::V1;
+  case SourceInfoLayoutV2::MajorVersion:
+    return SourceInfoLayoutID::V2;
+  case SourceInfoLayoutV3::MajorVersion:
+    return SourceInfoLayoutID::V3;
+  default:
+    return std::nullopt;
+  }
+}
+
+// Calls `F` with the layout type of `ID`. This is the one branch on the version; everything `F`
+// does with the records is compiled for that layout.
+template <typename Fn> decltype(auto) withSourceInfoLayout(SourceInfoLayoutID ID, Fn &&F) {
+  switch (ID) {
+  case SourceInfoLayoutID::V1:
+    return F(SourceInfoLayoutV1());
+  case SourceInfoLayoutID::V2:
+    return F(SourceInfoLayoutV2());
+  case SourceInfoLayoutID::V3:
+    return F(SourceInfoLayoutV3());
+  }
+  llvm_unreachable("unknown layout");
+}
 
 // Copied from swift/lib/Serialization/SerializationFormat.h
 template <typename value_type, typename CharT>
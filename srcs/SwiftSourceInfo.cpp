@@ -1,36 +1,36 @@
 #include "SwiftSourceInfo.h"
+#include "Stats.h"
 #include "SwiftInternals.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/Support/Chrono.h"
 #include "llvm/Support/Endian.h"
 #include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/Path.h"
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <thread>
 
 using namespace swift::serialization;
 
-// Allocate new memory for the given data and store the pointer to prevent the memory from being
-// freed.
-static StringRef duplicateData(StringRef Data,
-                               SmallVector<std::unique_ptr<char[]>, 4> &PointerHolder) {
-  std::unique_ptr<char[]> NewDataPtr(new char[Data.size()]);
-  std::memcpy(NewDataPtr.get(), Data.data(), Data.size());
-  auto NewData = StringRef(NewDataPtr.get(), Data.size());
-  PointerHolder.push_back(std::move(NewDataPtr));
-  return NewData;
-}
-
 static StringRef filePathFromID(int ID, StringRef TextDataData) {
   auto filePath = TextDataData.substr(ID);
   size_t terminatorOffset = filePath.find('\0');
   return filePath.slice(0, terminatorOffset);
 }
 
-static void printSourceListInfo(StringRef SourceFileListData, StringRef TextDataData) {
+template <typename Layout>
+static void printSourceListInfo(StringRef SourceFileListData, StringRef TextDataData,
+                                raw_ostream &OS) {
+  using SourceFileRecord = typename Layout::SourceFileRecord;
   auto *Cursor = SourceFileListData.bytes_begin();
-  auto *End = SourceFileListData.bytes_end();
+  auto *End = Cursor + SourceFileListData.size() / sizeof(SourceFileRecord) *
+                           sizeof(SourceFileRecord);
   while (Cursor < End) {
     auto Record = reinterpret_cast<const SourceFileRecord *>(Cursor);
 
-    llvm::outs() << llvm::formatv(
+    OS << llvm::formatv(
         "  {0} ({1}, {2} bytes)\n", filePathFromID(Record->FileID, TextDataData),
         llvm::sys::TimePoint<>(std::chrono::nanoseconds(Record->Timestamp)), Record->FileSize);
 
@@ -51,77 +51,632 @@ static std::unique_ptr<ModuleFileSharedCore::SerializedDeclUSRTable>
   );
 }
 
-static void printUSRInfo(std::pair<SmallVector<uint64_t>, StringRef> DeclUSRsData,
-                         StringRef BasicDeclLocsData, StringRef TextDataData) {
-  std::unique_ptr<ModuleFileSharedCore::SerializedDeclUSRTable> DeclUSRsTable =
-    readDeclUSRsTable(DeclUSRsData.first, DeclUSRsData.second);
-
-  for (const auto &key : DeclUSRsTable->keys()) {
-    auto Val = DeclUSRsTable->find(key);
+template <typename Layout> static void printUSRInfo(const SwiftSourceInfo &SSI, raw_ostream &OS) {
+  using DeclLocRecord = typename Layout::DeclLocRecord;
+  StringRef BasicDeclLocsData = SSI.getBasicDeclLocs();
+  StringRef TextDataData = SSI.getTextData();
+  size_t NumRecords = BasicDeclLocsData.size() / sizeof(DeclLocRecord);
 
-    auto UsrId = *Val;
+  SSI.forEachUSRIndex([&](StringRef USR, uint32_t Index) {
+    if (Index >= NumRecords)
+      return;
     auto Record = reinterpret_cast<const DeclLocRecord *>(BasicDeclLocsData.data() +
-                                                          sizeof(DeclLocRecord) * UsrId);
+                                                          sizeof(DeclLocRecord) * Index);
 
     auto filePath = filePathFromID(Record->FileID, TextDataData);
 
-    llvm::outs() << llvm::formatv("  {0} ({1}:{2}:{3})\n", key, llvm::sys::path::filename(filePath),
-                                  Record->Locs[0].Line, Record->Locs[0].Column);
+    OS << llvm::formatv("  {0} ({1}:{2}:{3})\n", USR, llvm::sys::path::filename(filePath),
+                        Record->Locs[0].Line, Record->Locs[0].Column);
+  });
+}
+
+std::optional<SwiftSourceInfo::DeclLocation> SwiftSourceInfo::declLocationAt(uint32_t Index) const {
+  StringRef BasicDeclLocsData = getBasicDeclLocs();
+  return withSourceInfoLayout(Layout, [&](auto L) -> std::optional<DeclLocation> {
+    using DeclLocRecord = typename decltype(L)::DeclLocRecord;
+    uint64_t RecordOffset = uint64_t(Index) * sizeof(DeclLocRecord);
+    if (RecordOffset + sizeof(DeclLocRecord) > BasicDeclLocsData.size())
+      return std::nullopt;
+
+    DeclLocRecord Record;
+    std::memcpy(&Record, BasicDeclLocsData.data() + RecordOffset, sizeof(Record));
+    return DeclLocation{filePathFromID(Record.FileID, getTextData()), Record.Locs[0].Line,
+                        Record.Locs[0].Column};
+  });
+}
+
+std::optional<SwiftSourceInfo::DeclLocation> SwiftSourceInfo::lookupUSR(StringRef USR) const {
+  std::unique_ptr<ModuleFileSharedCore::SerializedDeclUSRTable> DeclUSRsTable =
+      readDeclUSRsTable(getDeclUSRs().Fields, getDeclUSRs().Blob);
+  if (!DeclUSRsTable || USR.empty())
+    return std::nullopt;
+
+  auto Val = DeclUSRsTable->find(USR);
+  if (Val == DeclUSRsTable->end())
+    return std::nullopt;
+
+  // Decode only the matching record
+  return declLocationAt(*Val);
+}
+
+void SwiftSourceInfo::forEachUSRIndex(
+    function_ref<void(StringRef USR, uint32_t Index)> Callback) const {
+  std::unique_ptr<ModuleFileSharedCore::SerializedDeclUSRTable> DeclUSRsTable =
+      readDeclUSRsTable(getDeclUSRs().Fields, getDeclUSRs().Blob);
+  if (!DeclUSRsTable)
+    return;
+
+  // The key and data iterators walk the same entries in the same order
+  auto Data = DeclUSRsTable->data_begin();
+  for (auto Key = DeclUSRsTable->key_begin(), End = DeclUSRsTable->key_end(); Key != End;
+       ++Key, ++Data)
+    Callback(*Key, *Data);
+}
+
+void SwiftSourceInfo::forEachUSR(
+    function_ref<void(StringRef USR, const DeclLocation &Loc)> Callback) const {
+  forEachUSRIndex([&](StringRef USR, uint32_t Index) {
+    if (auto Loc = declLocationAt(Index))
+      Callback(USR, *Loc);
+  });
+}
+
+void SwiftSourceInfo::joinUSRs(
+    const SwiftSourceInfo &Other,
+    function_ref<bool(StringRef USR, std::optional<uint32_t> Here, std::optional<uint32_t> There)>
+        Callback) const {
+  std::unique_ptr<ModuleFileSharedCore::SerializedDeclUSRTable> HereTable =
+      readDeclUSRsTable(getDeclUSRs().Fields, getDeclUSRs().Blob);
+  std::unique_ptr<ModuleFileSharedCore::SerializedDeclUSRTable> ThereTable =
+      readDeclUSRsTable(Other.getDeclUSRs().Fields, Other.getDeclUSRs().Blob);
+
+  size_t NumFoundThere = 0;
+  if (HereTable) {
+    auto Data = HereTable->data_begin();
+    for (auto Key = HereTable->key_begin(), End = HereTable->key_end(); Key != End;
+         ++Key, ++Data) {
+      std::optional<uint32_t> There;
+      if (ThereTable && !(*Key).empty()) {
+        auto Val = ThereTable->find(*Key);
+        if (Val != ThereTable->end()) {
+          NumFoundThere++;
+          There = *Val;
+        }
+      }
+      if (!Callback(*Key, *Data, There))
+        return;
+    }
+  }
+
+  // Every USR of `Other` has been seen, unless it has more than were found
+  if (!ThereTable || NumFoundThere == ThereTable->getNumEntries())
+    return;
+  auto Data = ThereTable->data_begin();
+  for (auto Key = ThereTable->key_begin(), End = ThereTable->key_end(); Key != End;
+       ++Key, ++Data) {
+    if (HereTable && !(*Key).empty() && HereTable->find(*Key) != HereTable->end())
+      continue;
+    if (!Callback(*Key, std::nullopt, *Data))
+      return;
   }
 }
 
-void SwiftSourceInfo::printContent() {
-  llvm::outs() << "Source Files:\n";
-  printSourceListInfo(SourceFileListData, TextDataData);
+void SwiftSourceInfo::printContent(raw_ostream &OS) const {
+  withSourceInfoLayout(Layout, [&](auto L) {
+    OS << "Source Files:\n";
+    printSourceListInfo<decltype(L)>(getSourceFileList(), getTextData(), OS);
 
-  llvm::outs() << "USRs:\n";
-  printUSRInfo(DeclUSRsData, BasicDeclLocsData, TextDataData);
+    OS << "USRs:\n";
+    printUSRInfo<decltype(L)>(*this, OS);
+  });
 }
 
-void SwiftSourceInfo::remapFilePath(FileIDRemapper &FIDRemapper, bool Quiet) {
+// BasicDeclLocs larger than this are patched on several threads
+static const size_t ParallelPatchThreshold = 8 << 20;
+
+// Translates the FileID fields of `NumRecords` fixed-size records in place. The records are
+// processed in chunks. The loop over a chunk is a plain table lookup per field, without calls or
+// unpredictable branches, so compilers can unroll it and use gathers where the target has them. A
+// FileID that isn't in the table (one in the middle of a string, or past TextData) makes the chunk
+// take `SlowPath`, which is only expected for malformed files.
+template <size_t RecordSize, size_t NumFields, typename SlowPathFn>
+static void translateFileIDs(char *Records, size_t NumRecords,
+                             const std::array<size_t, NumFields> &Fields, ArrayRef<uint32_t> Table,
+                             SlowPathFn &&SlowPath) {
+  static_assert(NumFields > 0, "Records without FileIDs are left as they are.");
+  const size_t ChunkSize = 64;
+  const uint32_t *Lookup = Table.data();
+  const uint32_t LastSlot = Table.size() - 1;
+  uint32_t OldIDs[ChunkSize * NumFields];
+
+  for (size_t Begin = 0; Begin < NumRecords; Begin += ChunkSize) {
+    size_t Count = std::min(ChunkSize, NumRecords - Begin);
+    char *Chunk = Records + Begin * RecordSize;
+
+    uint32_t Missing = 0;
+    for (size_t I = 0; I < Count; I++) {
+      for (size_t F = 0; F < NumFields; F++) {
+        char *Field = Chunk + I * RecordSize + Fields[F];
+        uint32_t OldID;
+        std::memcpy(&OldID, Field, sizeof(OldID));
+        uint32_t NewID = Lookup[OldID < LastSlot ? OldID : LastSlot];
+        Missing |= NewID == FileIDRemapper::InvalidFileID;
+        OldIDs[I * NumFields + F] = OldID;
+        std::memcpy(Field, &NewID, sizeof(NewID));
+      }
+    }
+    if (LLVM_LIKELY(!Missing))
+      continue;
+
+    for (size_t I = 0; I < Count * NumFields; I++) {
+      char *Field = Chunk + (I / NumFields) * RecordSize + Fields[I % NumFields];
+      uint32_t NewID;
+      std::memcpy(&NewID, Field, sizeof(NewID));
+      if (NewID == FileIDRemapper::InvalidFileID) {
+        NewID = SlowPath(OldIDs[I]);
+        std::memcpy(Field, &NewID, sizeof(NewID));
+      }
+    }
+  }
+}
+
+// Sets the FileIDs of `NumRecords` fixed-size records in `Referenced`. The ones past its end are
+// left for the slow path of `translateFileIDs`.
+template <size_t RecordSize, size_t NumFields>
+static void markFileIDs(const char *Records, size_t NumRecords,
+                        const std::array<size_t, NumFields> &Fields, BitVector &Referenced) {
+  for (size_t I = 0; I < NumRecords; I++) {
+    for (size_t F = 0; F < NumFields; F++) {
+      uint32_t FileID;
+      std::memcpy(&FileID, Records + I * RecordSize + Fields[F], sizeof(FileID));
+      if (FileID < Referenced.size())
+        Referenced.set(FileID);
+    }
+  }
+}
+
+// Calls `Callback` with the records and the count of each group of DocRanges, which is a count
+// followed by that many fixed-size records. Returns the number of records.
+template <size_t RecordSize, typename CharT, typename CallbackFn>
+static size_t forEachDocRangeGroup(CharT *Begin, CharT *End, CallbackFn &&Callback) {
+  CharT *Cursor = Begin + 1; // Skip the reserved number
+  size_t NumRecords = 0;
+  while (Cursor + sizeof(uint32_t) <= End) {
+    uint32_t Nums;
+    std::memcpy(&Nums, Cursor, sizeof(Nums));
+    Cursor += 4;
+
+    size_t Count = std::min<size_t>(Nums, (End - Cursor) / RecordSize);
+    Callback(Cursor, Count);
+    Cursor += Count * RecordSize;
+    NumRecords += Count;
+    if (Count < Nums)
+      break;
+  }
+  return NumRecords;
+}
+
+template <typename Layout> BitVector SwiftSourceInfo::referencedFileIDs() const {
+  using SourceFileRecord = typename Layout::SourceFileRecord;
+  using DeclLocRecord = typename Layout::DeclLocRecord;
+  using DocRangeRecord = typename Layout::DocRangeRecord;
+
+  BitVector Referenced(getTextData().size());
+  // The empty path at offset 0 stands for no file, so it stays even if nothing uses it now
+  if (getTextData().startswith(StringRef("\0", 1)))
+    Referenced.set(0);
+  StringRef SourceFileListData = getSourceFileList();
+  markFileIDs<sizeof(SourceFileRecord)>(SourceFileListData.data(),
+                                        SourceFileListData.size() / sizeof(SourceFileRecord),
+                                        Layout::SourceFileRecordFileIDs, Referenced);
+  StringRef BasicDeclLocsData = getBasicDeclLocs();
+  markFileIDs<sizeof(DeclLocRecord)>(BasicDeclLocsData.data(),
+                                     BasicDeclLocsData.size() / sizeof(DeclLocRecord),
+                                     Layout::DeclLocRecordFileIDs, Referenced);
+  StringRef DocRangesData = getDocRanges();
+  if (!DocRangesData.empty())
+    forEachDocRangeGroup<sizeof(DocRangeRecord)>(
+        DocRangesData.begin(), DocRangesData.end(), [&](const char *Records, size_t Count) {
+          markFileIDs<sizeof(DocRangeRecord)>(Records, Count, Layout::DocRangeRecordFileIDs,
+                                              Referenced);
+        });
+  return Referenced;
+}
+
+// The modification time of the `Index`th record of SourceFileList
+template <typename Layout> static uint64_t timestampAt(StringRef SourceFileList, size_t Index) {
+  using SourceFileRecord = typename Layout::SourceFileRecord;
+  uint64_t Timestamp;
+  std::memcpy(&Timestamp,
+              SourceFileList.data() + Index * sizeof(SourceFileRecord) +
+                  offsetof(SourceFileRecord, Timestamp),
+              sizeof(Timestamp));
+  return Timestamp;
+}
+
+bool SwiftSourceInfo::remapFilePath(FileIDRemapper &FIDRemapper, bool Quiet,
+                                    unsigned PatchThreads, NormalizeOptions Normalize) {
+  return withSourceInfoLayout(Layout, [&](auto L) {
+    return remapRecords<decltype(L)>(FIDRemapper, Quiet, PatchThreads, Normalize);
+  });
+}
+
+template <typename Layout>
+bool SwiftSourceInfo::remapRecords(FileIDRemapper &FIDRemapper, bool Quiet, unsigned PatchThreads,
+                                   NormalizeOptions Normalize) {
+  using SourceFileRecord = typename Layout::SourceFileRecord;
+  using DeclLocRecord = typename Layout::DeclLocRecord;
+  using DocRangeRecord = typename Layout::DocRangeRecord;
+  // The locations of the older layouts have no FileID, so their doc ranges don't change
+  constexpr bool DocRangesHaveFileIDs = !Layout::DocRangeRecordFileIDs.empty();
+
+  StringRef SourceFileListData = getSourceFileList();
+  StringRef BasicDeclLocsData = getBasicDeclLocs();
+  StringRef DocRangesData = getDocRanges();
+  StringRef TextDataData = getTextData();
+
+  // Size the arena for all the sections up front. Remapped paths are usually no longer than the
+  // original ones, so the TextData estimate leaves some room for growth.
+  SourceInfoArena &Arena = FIDRemapper.getArena();
+  Arena.reset(SourceFileListData.size() + BasicDeclLocsData.size() +
+              (DocRangesHaveFileIDs ? DocRangesData.size() : 0) + TextDataData.size() * 3 / 2 +
+              4096);
+
+  // Copy the sections first, so that the new TextData can grow in the tail of the arena while the
+  // records are patched.
+  auto NewSourceFileListData = Arena.copy(SourceFileListData);
+  auto NewBasicDeclLocsData = Arena.copy(BasicDeclLocsData);
+  auto NewDocRangesData = Arena.copy(DocRangesHaveFileIDs ? DocRangesData : StringRef());
+
+  // Remap every path once, then patching the records is only table lookups
+  {
+    PhaseScope Scope(ImportStats::PathRemap);
+    if (Normalize.DropUnusedPaths) {
+      BitVector Referenced = referencedFileIDs<Layout>();
+      FIDRemapper.buildTranslationTable(TextDataData, Quiet, &Referenced);
+    } else {
+      FIDRemapper.buildTranslationTable(TextDataData, Quiet);
+    }
+    if (Normalize.SortTextData)
+      FIDRemapper.sortTextData();
+  }
+  size_t NumSourceFiles = SourceFileListData.size() / sizeof(SourceFileRecord);
+  bool ZeroesTimestamps = false;
+  if (Normalize.ZeroTimestamps)
+    for (size_t I = 0; I < NumSourceFiles && !ZeroesTimestamps; I++)
+      ZeroesTimestamps = timestampAt<Layout>(SourceFileListData, I) != 0;
+
+  // Every path mapped to itself, at its old offset, so the records already point to the same
+  // paths. A FileID into the middle of a path reads the same string either way.
+  if (FIDRemapper.getNewTextDataData() == TextDataData && !ZeroesTimestamps)
+    return false;
+
+  ArrayRef<uint32_t> Table = FIDRemapper.getTranslationTable();
+  PhaseScope Scope(ImportStats::RecordPatch);
+
+  std::mutex SlowPathLock;
+  auto SlowPath = [&](uint32_t FileID) {
+    std::lock_guard<std::mutex> Guard(SlowPathLock);
+    return FIDRemapper.mapFileID(FileID, TextDataData, Quiet);
+  };
+
   // Remap SourceFileListData
-  auto NewSourceFileListData = duplicateData(SourceFileListData, PointerHolder);
-  auto *Cursor = NewSourceFileListData.bytes_begin();
-  auto *End = NewSourceFileListData.bytes_end();
-  while (Cursor < End) {
-    auto *Record = reinterpret_cast<SourceFileRecord *>(const_cast<unsigned char *>(Cursor));
-    Record->FileID = FIDRemapper.mapFileID(Record->FileID, TextDataData, Quiet);
-    Cursor += sizeof(SourceFileRecord);
+  translateFileIDs<sizeof(SourceFileRecord)>(NewSourceFileListData.data(),
+                                             NewSourceFileListData.size() /
+                                                 sizeof(SourceFileRecord),
+                                             Layout::SourceFileRecordFileIDs, Table, SlowPath);
+  if (ZeroesTimestamps)
+    for (size_t I = 0; I < NumSourceFiles; I++)
+      std::memset(NewSourceFileListData.data() + I * sizeof(SourceFileRecord) +
+                      offsetof(SourceFileRecord, Timestamp),
+                  0, sizeof(uint64_t));
+  Replaced[LazySections::SourceFileList] =
+      StringRef(NewSourceFileListData.data(), NewSourceFileListData.size());
+  ImportStats::get().add(ImportStats::SourceFileRecords, NumSourceFiles);
+
+  // Remap BasicDeclLocsData, splitting it across threads if it's large
+  size_t NumDeclLocs = NewBasicDeclLocsData.size() / sizeof(DeclLocRecord);
+  auto PatchDeclLocs = [&](size_t Begin, size_t End) {
+    translateFileIDs<sizeof(DeclLocRecord)>(NewBasicDeclLocsData.data() +
+                                                Begin * sizeof(DeclLocRecord),
+                                            End - Begin, Layout::DeclLocRecordFileIDs, Table,
+                                            SlowPath);
+  };
+  if (PatchThreads > 1 && NewBasicDeclLocsData.size() >= ParallelPatchThreshold) {
+    size_t PerThread = (NumDeclLocs + PatchThreads - 1) / PatchThreads;
+    std::vector<std::thread> Threads;
+    for (size_t Begin = 0; Begin < NumDeclLocs; Begin += PerThread)
+      Threads.emplace_back(PatchDeclLocs, Begin, std::min(Begin + PerThread, NumDeclLocs));
+    for (auto &Thread : Threads)
+      Thread.join();
+  } else {
+    PatchDeclLocs(0, NumDeclLocs);
   }
-  SourceFileListData = NewSourceFileListData;
+  Replaced[LazySections::BasicDeclLocs] =
+      StringRef(NewBasicDeclLocsData.data(), NewBasicDeclLocsData.size());
+  ImportStats::get().add(ImportStats::DeclLocRecords, NumDeclLocs);
 
-  // Remap BasicDeclLocsData
-  auto NewBasicDeclLocsData = duplicateData(BasicDeclLocsData, PointerHolder);
-  Cursor = NewBasicDeclLocsData.bytes_begin();
-  End = NewBasicDeclLocsData.bytes_end();
-  while (Cursor < End) {
-    auto *Record = reinterpret_cast<DeclLocRecord *>(const_cast<unsigned char *>(Cursor));
-    Record->FileID = FIDRemapper.mapFileID(Record->FileID, TextDataData, Quiet);
+  // Remap DocRangesData. Each entry is a count followed by that many fixed-size records.
+  if constexpr (DocRangesHaveFileIDs) {
+    size_t NumDocRanges = 0;
+    if (!NewDocRangesData.empty())
+      NumDocRanges = forEachDocRangeGroup<sizeof(DocRangeRecord)>(
+          NewDocRangesData.begin(), NewDocRangesData.end(), [&](char *Records, size_t Count) {
+            translateFileIDs<sizeof(DocRangeRecord)>(Records, Count, Layout::DocRangeRecordFileIDs,
+                                                     Table, SlowPath);
+          });
+    Replaced[LazySections::DocRanges] =
+        StringRef(NewDocRangesData.data(), NewDocRangesData.size());
+    ImportStats::get().add(ImportStats::DocRangeRecords, NumDocRanges);
+  }
+  ImportStats::get().add(ImportStats::UniqueFileIDs, FIDRemapper.getNumFileIDs());
+  ImportStats::get().add(ImportStats::UniquePaths, FIDRemapper.getNumPaths());
+
+  // The new TextData is the tail the remapper has built
+  Replaced[LazySections::TextData] = FIDRemapper.getNewTextDataData();
+  return true;
+}
+
+Error SwiftSourceInfo::checkNormalized(const FilePathRemapper &PathRemapper,
+                                       NormalizeOptions Normalize) const {
+  StringRef TextDataData = getTextData();
+  if (!TextDataData.empty() && TextDataData.back() != '\0')
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "The last path in TextData isn't terminated.");
+
+  BitVector Referenced;
+  if (Normalize.DropUnusedPaths)
+    Referenced =
+        withSourceInfoLayout(Layout, [&](auto L) { return referencedFileIDs<decltype(L)>(); });
+
+  StringRef Previous;
+  DenseSet<StringRef> Seen;
+  bool First = true;
+  for (StringRef Rest = TextDataData; !Rest.empty(); First = false) {
+    auto [Path, Next] = Rest.split('\0');
+    if (PathRemapper.remap(Path) != Path)
+      return createStringError(std::errc::invalid_argument, "'%s' isn't remapped.",
+                               Path.str().c_str());
+    if (Normalize.SortTextData && !First && Path <= Previous)
+      return createStringError(std::errc::invalid_argument,
+                               "TextData isn't sorted: '%s' comes after '%s'.",
+                               Path.str().c_str(), Previous.str().c_str());
+    // Sorted paths are unique if they are in order, so only the unsorted ones need the set
+    if (!Normalize.SortTextData && !Seen.insert(Path).second)
+      return createStringError(std::errc::invalid_argument, "'%s' is in TextData twice.",
+                               Path.str().c_str());
+    if (Normalize.DropUnusedPaths && !Referenced.test(Path.data() - TextDataData.data()))
+      return createStringError(std::errc::invalid_argument, "'%s' isn't used by any record.",
+                               Path.str().c_str());
+    Previous = Path;
+    Rest = Next;
+  }
+
+  if (Normalize.ZeroTimestamps)
+    return withSourceInfoLayout(Layout, [&](auto L) { return checkTimestamps<decltype(L)>(); });
+  return Error::success();
+}
 
-    for (int i = 0; i < 3; i++) {
-      Record->Locs[i].FileID = FIDRemapper.mapFileID(Record->Locs[i].FileID, TextDataData, Quiet);
+template <typename Layout> Error SwiftSourceInfo::checkTimestamps() const {
+  using SourceFileRecord = typename Layout::SourceFileRecord;
+  StringRef SourceFileListData = getSourceFileList();
+  for (size_t I = 0; I < SourceFileListData.size() / sizeof(SourceFileRecord); I++) {
+    if (timestampAt<Layout>(SourceFileListData, I) == 0)
+      continue;
+    uint32_t FileID;
+    std::memcpy(&FileID,
+                SourceFileListData.data() + I * sizeof(SourceFileRecord) +
+                    offsetof(SourceFileRecord, FileID),
+                sizeof(FileID));
+    StringRef Path = getTextData().substr(FileID).take_until([](char C) { return C == '\0'; });
+    return createStringError(std::errc::invalid_argument, "'%s' has a timestamp.",
+                             Path.str().c_str());
+  }
+  return Error::success();
+}
+
+// Finds the first of `NumRecords` fixed-size records that has a FileID past `Limit` or fails
+// `IsValid`. Each chunk takes the maximum of its FileIDs without a branch per field, and only a
+// chunk with a bad record is looked at again.
+template <size_t RecordSize, size_t NumFields, typename IsValidFn>
+static std::optional<size_t> findBadRecord(const char *Records, size_t NumRecords,
+                                           const std::array<size_t, NumFields> &Fields,
+                                           uint64_t Limit, IsValidFn &&IsValid) {
+  const size_t ChunkSize = 256;
+  auto FileIDsFit = [&](const char *Record) {
+    uint32_t Max = 0;
+    for (size_t F = 0; F < NumFields; F++) {
+      uint32_t FileID;
+      std::memcpy(&FileID, Record + Fields[F], sizeof(FileID));
+      Max = std::max(Max, FileID);
     }
-    Cursor += sizeof(DeclLocRecord);
+    return Max < Limit;
+  };
+
+  for (size_t Begin = 0; Begin < NumRecords; Begin += ChunkSize) {
+    size_t Count = std::min(ChunkSize, NumRecords - Begin);
+    const char *Chunk = Records + Begin * RecordSize;
+    bool Valid = true;
+    for (size_t I = 0; I < Count; I++)
+      Valid &= FileIDsFit(Chunk + I * RecordSize) & IsValid(Chunk + I * RecordSize);
+    if (LLVM_LIKELY(Valid))
+      continue;
+    for (size_t I = 0; I < Count; I++)
+      if (!FileIDsFit(Chunk + I * RecordSize) || !IsValid(Chunk + I * RecordSize))
+        return Begin + I;
   }
-  BasicDeclLocsData = NewBasicDeclLocsData;
+  return std::nullopt;
+}
 
-  // Remap DocRangesData
-  auto NewDocRangesData = duplicateData(DocRangesData, PointerHolder);
-  Cursor = NewDocRangesData.bytes_begin();
-  End = NewDocRangesData.bytes_end();
-  Cursor += 1; // Skip the reserved number
-  while (Cursor < End) {
-    uint32_t Nums = *reinterpret_cast<const uint32_t *>(Cursor);
-    Cursor += 4;
+template <typename RecordT> static Error checkWholeRecords(StringRef Data, const char *Section) {
+  if (Data.size() % sizeof(RecordT) == 0)
+    return Error::success();
+  return createStringError(std::errc::illegal_byte_sequence,
+                           "%s is %zu bytes, which isn't a whole number of %zu-byte records.",
+                           Section, Data.size(), sizeof(RecordT));
+}
+
+Error SwiftSourceInfo::verify() const {
+  PhaseScope Scope(ImportStats::Verify);
+  return withSourceInfoLayout(Layout, [&](auto L) { return verifyRecords<decltype(L)>(); });
+}
+
+template <typename Layout> Error SwiftSourceInfo::verifyRecords() const {
+  using SourceFileRecord = typename Layout::SourceFileRecord;
+  using DeclLocRecord = typename Layout::DeclLocRecord;
+  using DocRangeRecord = typename Layout::DocRangeRecord;
+
+  StringRef TextDataData = getTextData();
+  if (!TextDataData.empty() && TextDataData.back() != '\0')
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "The last path in TextData isn't terminated.");
+  // Zero stands for no file, even in a file without paths
+  uint64_t FileIDLimit = std::max<size_t>(TextDataData.size(), 1);
+  auto AnyRecord = [](const char *) { return true; };
 
-    for (int i = 0; i < Nums; i++) {
-      auto Record = reinterpret_cast<DocRangeRecord *>(const_cast<unsigned char *>(Cursor));
-      Record->Loc.FileID = FIDRemapper.mapFileID(Record->Loc.FileID, TextDataData, Quiet);
-      Cursor += sizeof(DocRangeRecord);
+  StringRef SourceFileListData = getSourceFileList();
+  if (Error Err = checkWholeRecords<SourceFileRecord>(SourceFileListData, "SourceFileList"))
+    return Err;
+  if (auto Bad = findBadRecord<sizeof(SourceFileRecord)>(
+          SourceFileListData.data(), SourceFileListData.size() / sizeof(SourceFileRecord),
+          Layout::SourceFileRecordFileIDs, FileIDLimit, AnyRecord))
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "Record %zu of SourceFileList has a FileID past the end of TextData.",
+                             *Bad);
+
+  // Each group is a count followed by that many records, after the reserved number. The offsets of
+  // the groups are noted for the declarations that refer to them.
+  StringRef DocRangesData = getDocRanges();
+  BitVector DocRangeGroups(DocRangesData.size());
+  for (size_t Offset = 1, NumDocRanges = 0; Offset < DocRangesData.size();) {
+    if (Offset + sizeof(uint32_t) > DocRangesData.size())
+      return createStringError(std::errc::illegal_byte_sequence,
+                               "DocRanges ends in the count of the group at offset %zu.", Offset);
+    uint32_t Count;
+    std::memcpy(&Count, DocRangesData.data() + Offset, sizeof(Count));
+    const char *Records = DocRangesData.data() + Offset + sizeof(Count);
+    if (uint64_t(Count) * sizeof(DocRangeRecord) > size_t(DocRangesData.end() - Records))
+      return createStringError(std::errc::illegal_byte_sequence,
+                               "The %u records of the DocRanges group at offset %zu run past its "
+                               "end.",
+                               Count, Offset);
+    if (auto Bad = findBadRecord<sizeof(DocRangeRecord)>(
+            Records, Count, Layout::DocRangeRecordFileIDs, FileIDLimit, AnyRecord))
+      return createStringError(std::errc::illegal_byte_sequence,
+                               "Record %zu of DocRanges has a FileID past the end of TextData.",
+                               NumDocRanges + *Bad);
+    DocRangeGroups.set(Offset);
+    Offset += sizeof(Count) + Count * sizeof(DocRangeRecord);
+    NumDocRanges += Count;
+  }
+
+  StringRef BasicDeclLocsData = getBasicDeclLocs();
+  if (Error Err = checkWholeRecords<DeclLocRecord>(BasicDeclLocsData, "BasicDeclLocs"))
+    return Err;
+  size_t NumDeclLocs = BasicDeclLocsData.size() / sizeof(DeclLocRecord);
+  auto DocRangesOf = [](const char *Record) {
+    uint32_t DocRanges;
+    std::memcpy(&DocRanges, Record + offsetof(DeclLocRecord, DocRanges), sizeof(DocRanges));
+    return DocRanges;
+  };
+  // Zero is the reserved number, for the declarations without documentation
+  auto HasDocRangeGroup = [&](const char *Record) {
+    uint32_t DocRanges = DocRangesOf(Record);
+    return DocRanges == 0 || (DocRanges < DocRangeGroups.size() && DocRangeGroups.test(DocRanges));
+  };
+  if (auto Bad = findBadRecord<sizeof(DeclLocRecord)>(BasicDeclLocsData.data(), NumDeclLocs,
+                                                      Layout::DeclLocRecordFileIDs, FileIDLimit,
+                                                      HasDocRangeGroup)) {
+    const char *Record = BasicDeclLocsData.data() + *Bad * sizeof(DeclLocRecord);
+    if (!HasDocRangeGroup(Record))
+      return createStringError(std::errc::illegal_byte_sequence,
+                               "Record %zu of BasicDeclLocs refers to offset %u of DocRanges, "
+                               "which isn't the start of a group.",
+                               *Bad, DocRangesOf(Record));
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "Record %zu of BasicDeclLocs has a FileID past the end of TextData.",
+                             *Bad);
+  }
+
+  return verifyDeclUSRs(NumDeclLocs);
+}
+
+Error SwiftSourceInfo::verifyDeclUSRs(size_t NumDeclLocs) const {
+  const SourceInfoRecord &DeclUSRs = getDeclUSRs();
+  StringRef Blob = DeclUSRs.Blob;
+  // There is no table to read then
+  if (DeclUSRs.Fields.empty() || Blob.empty())
+    return Error::success();
+  auto Read32 = [&](uint64_t Offset) {
+    uint32_t Value;
+    std::memcpy(&Value, Blob.data() + Offset, sizeof(Value));
+    return Value;
+  };
+
+  // The table: the number of buckets and of entries, then the offset of each bucket
+  uint64_t TableOffset = DeclUSRs.Fields.front();
+  if (TableOffset < sizeof(uint32_t) || TableOffset + 2 * sizeof(uint32_t) > Blob.size())
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "The hash table of DeclUSRs is at offset %llu, outside its %zu bytes.",
+                             (unsigned long long)TableOffset, Blob.size());
+  if (reinterpret_cast<uintptr_t>(Blob.data() + TableOffset) % alignof(uint32_t) != 0)
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "The hash table of DeclUSRs isn't aligned.");
+  uint32_t NumBuckets = Read32(TableOffset);
+  uint32_t NumEntries = Read32(TableOffset + sizeof(uint32_t));
+  // A lookup masks the hash with the number of buckets
+  if (!isPowerOf2_32(NumBuckets))
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "The hash table of DeclUSRs has %u buckets, which isn't a power of "
+                             "two.",
+                             NumBuckets);
+  uint64_t BucketsOffset = TableOffset + 2 * sizeof(uint32_t);
+  if (BucketsOffset + uint64_t(NumBuckets) * sizeof(uint32_t) > Blob.size())
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "The %u buckets of DeclUSRs run past its end.", NumBuckets);
+
+  // The entries, walked like the iterators do, from after the reserved number to the table. Each
+  // bucket is a 16-bit count followed by its entries, and each entry a hash, the length of the
+  // USR, the USR and the index of its record in BasicDeclLocs.
+  BitVector BucketStarts(TableOffset);
+  uint64_t Offset = sizeof(uint32_t);
+  for (uint32_t Left = NumEntries; Left > 0;) {
+    uint16_t Count = 0;
+    if (Offset + sizeof(Count) <= TableOffset)
+      std::memcpy(&Count, Blob.data() + Offset, sizeof(Count));
+    if (Count == 0 || Count > Left)
+      return createStringError(std::errc::illegal_byte_sequence,
+                               "The bucket of DeclUSRs at offset %llu doesn't have between 1 and "
+                               "the %u entries left.",
+                               (unsigned long long)Offset, Left);
+    BucketStarts.set(Offset);
+    Offset += sizeof(Count);
+
+    for (; Count > 0; Count--, Left--) {
+      uint64_t KeyOffset = Offset + 2 * sizeof(uint32_t);
+      uint32_t KeyLength = KeyOffset <= TableOffset ? Read32(Offset + sizeof(uint32_t)) : 0;
+      if (KeyLength == 0 || KeyOffset + KeyLength + sizeof(uint32_t) > TableOffset)
+        return createStringError(std::errc::illegal_byte_sequence,
+                                 "The entry of DeclUSRs at offset %llu is empty or runs into the "
+                                 "hash table.",
+                                 (unsigned long long)Offset);
+      Offset = KeyOffset + KeyLength + sizeof(uint32_t);
+      uint32_t Index = Read32(Offset - sizeof(uint32_t));
+      if (Index >= NumDeclLocs)
+        return createStringError(std::errc::illegal_byte_sequence,
+                                 "'%s' indexes record %u of BasicDeclLocs, which has %zu.",
+                                 Blob.substr(KeyOffset, KeyLength).str().c_str(), Index,
+                                 NumDeclLocs);
     }
   }
-  DocRangesData = NewDocRangesData;
 
-  // Remap TextDataData
-  TextDataData = duplicateData(FIDRemapper.getNewTextDataData(), PointerHolder);
+  for (uint32_t B = 0; B < NumBuckets; B++) {
+    uint32_t BucketOffset = Read32(BucketsOffset + B * sizeof(uint32_t));
+    // Zero is an empty bucket
+    if (BucketOffset != 0 && (BucketOffset >= TableOffset || !BucketStarts.test(BucketOffset)))
+      return createStringError(std::errc::illegal_byte_sequence,
+                               "Bucket %u of DeclUSRs is at offset %u, where no bucket starts.", B,
+                               BucketOffset);
+  }
+  return Error::success();
 }
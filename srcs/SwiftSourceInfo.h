@@ -2,45 +2,167 @@
 #define SWIFT_SOURCE_INFO_H
 
 #include "Remapper.h"
+#include "SwiftInternals.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+// What --normalize does on top of remapping, so that the same sources give the same bytes wherever
+// they were built
+struct NormalizeOptions {
+  // Sort the paths in TextData and renumber the FileIDs to match
+  bool SortTextData = false;
+  // Zero the modification times in SourceFileList
+  bool ZeroTimestamps = false;
+  // Leave the paths no record refers to out of TextData
+  bool DropUnusedPaths = false;
+};
+
+// A record of DECL_LOCS_BLOCK: its fields and its blob
+struct SourceInfoRecord {
+  SmallVector<uint64_t, 1> Fields;
+  StringRef Blob;
+};
+
+// The sections of a file, read the first time they are used. The parser only notes where each
+// record is, so a command that needs one section doesn't touch the pages of the others. Shared by
+// the copies of a `SwiftSourceInfo`, and safe to use from several threads.
+class LazySections {
+public:
+  enum SectionID : unsigned {
+    SourceFileList,
+    BasicDeclLocs,
+    DeclUSRs,
+    TextData,
+    DocRanges,
+    NumSections
+  };
+
+  // Reads a section. Returns an empty record for a section the file doesn't have.
+  using ReadFn = std::function<SourceInfoRecord(SectionID ID)>;
+
+  explicit LazySections(ReadFn Read) : Read(std::move(Read)) {}
+
+  const SourceInfoRecord &get(SectionID ID) const {
+    std::call_once(Once[ID], [&] { Records[ID] = Read(ID); });
+    return Records[ID];
+  }
+
+private:
+  ReadFn Read;
+  mutable std::once_flag Once[NumSections];
+  mutable SourceInfoRecord Records[NumSections];
+};
+
+using swift::serialization::SourceInfoLayoutID;
 
 class SwiftSourceInfo {
 public:
+  using SectionID = LazySections::SectionID;
+
+  SwiftSourceInfo(std::shared_ptr<const LazySections> Sections, SourceInfoLayoutID Layout)
+      : Sections(std::move(Sections)), Layout(Layout) {}
+
+  // The layout of the records, given by the version of the file
+  SourceInfoLayoutID getLayout() const { return Layout; }
+
   // The binary content of SourceFileList, which is a list of fix-sized records representing the
   // source file information
-  StringRef SourceFileListData;
+  StringRef getSourceFileList() const { return getSection(LazySections::SourceFileList); }
 
   // The binary content of BasicDeclLocs, which is a list of fix-sized records representing the USR
   // location information
-  StringRef BasicDeclLocsData;
+  StringRef getBasicDeclLocs() const { return getSection(LazySections::BasicDeclLocs); }
 
   // The binary content of DocRanges, which have records representing the USR's documentation
   // ranges
-  StringRef DocRangesData;
+  StringRef getDocRanges() const { return getSection(LazySections::DocRanges); }
 
   // The binary content of TextData, which is a '\0' terminated strings of actual file paths
-  StringRef TextDataData;
+  StringRef getTextData() const { return getSection(LazySections::TextData); }
 
-  // The binary content DeclUSRs, which is a serialized  `llvm::OnDiskIterableChainedHashTable`.
-  // The key is a USR and the value is the index of records in BASIC_DECL_LOCS
-  std::pair<SmallVector<uint64_t>, StringRef> DeclUSRsData;
+  // DeclUSRs, which is a serialized `llvm::OnDiskIterableChainedHashTable`. The key is a USR and
+  // the value is the index of records in BASIC_DECL_LOCS. The first field is the table offset.
+  const SourceInfoRecord &getDeclUSRs() const { return Sections->get(LazySections::DeclUSRs); }
 
-  SwiftSourceInfo(StringRef TextDataData, StringRef SourceFileListData, StringRef BasicDeclLocsData,
-                  StringRef DocRangesData, std::pair<SmallVector<uint64_t>, StringRef> DeclUSRsData)
-      : TextDataData(TextDataData), SourceFileListData(SourceFileListData),
-        BasicDeclLocsData(BasicDeclLocsData), DocRangesData(DocRangesData),
-        DeclUSRsData(DeclUSRsData) {}
+  // Where a declaration is, as found by `lookupUSR`
+  struct DeclLocation {
+    StringRef FilePath;
+    uint32_t Line;
+    uint32_t Column;
+  };
 
   // Print the human readable content of the source info
-  void printContent();
+  void printContent(raw_ostream &OS = llvm::outs()) const;
+
+  // Finds the declaration of `USR` with a single probe of the on-disk hash table in DeclUSRs. Only
+  // the matching record and its path are decoded.
+  std::optional<DeclLocation> lookupUSR(StringRef USR) const;
+
+  // Calls `Callback` with every USR in DeclUSRs and the index of its record in BasicDeclLocs, in
+  // the order of the table. The table is walked once, without a lookup per key.
+  void forEachUSRIndex(function_ref<void(StringRef USR, uint32_t Index)> Callback) const;
+
+  // Calls `Callback` for every USR in DeclUSRs, in the order of the table
+  void forEachUSR(function_ref<void(StringRef USR, const DeclLocation &Loc)> Callback) const;
 
-  // Remap the file paths in the source info
-  void remapFilePath(FileIDRemapper &FIDRemapper, bool Quiet);
+  // Calls `Callback` once for every USR of this file or `Other`, with the index of its record in
+  // BasicDeclLocs of each file that declares it. This table is walked once, probing the table of
+  // `Other` for each USR; `Other` is only walked as well when it has USRs this file doesn't. Stops
+  // when `Callback` returns false.
+  void joinUSRs(const SwiftSourceInfo &Other,
+                function_ref<bool(StringRef USR, std::optional<uint32_t> Here,
+                                  std::optional<uint32_t> There)>
+                    Callback) const;
+
+  // Remap the file paths in the source info. Paths remapped to the same path share one string in
+  // the new TextData. The new sections are allocated from the arena of `FIDRemapper`, which is
+  // reset first, so they live until the arena is reset for the next file.
+  // A large BasicDeclLocs is patched on up to `PatchThreads` threads. Returns false, leaving the
+  // sections as they are, when nothing changed.
+  bool remapFilePath(FileIDRemapper &FIDRemapper, bool Quiet, unsigned PatchThreads = 1,
+                     NormalizeOptions Normalize = {});
+
+  // Checks that normalizing wouldn't change anything, without copying any section: every path is
+  // remapped to itself and written once, and TextData and the timestamps are as `Normalize` makes
+  // them. Returns the first difference found.
+  Error checkNormalized(const FilePathRemapper &PathRemapper, NormalizeOptions Normalize) const;
+
+  // Checks the structure of every section in one pass, so that an untrusted file can be rejected
+  // before anything reads its records: the record sections hold whole records, every FileID is
+  // inside TextData and its last path is terminated, the groups of DocRanges fit and each
+  // declaration refers to the start of one, and the hash table of DeclUSRs stays inside its blob
+  // with every USR indexing a record of BasicDeclLocs. Returns the first problem found.
+  Error verify() const;
 
 private:
-  // When remapping the file paths, we need allocate new memory spaces for the new data of the above
-  // sections. Therefore, we need hold the pointers to prevent the memory from being freed.
-  SmallVector<std::unique_ptr<char[]>, 4> PointerHolder;
+  // The location in the `Index`th record of BasicDeclLocs
+  std::optional<DeclLocation> declLocationAt(uint32_t Index) const;
+
+  // `remapFilePath` and `checkNormalized`, compiled for each layout
+  template <typename Layout>
+  bool remapRecords(FileIDRemapper &FIDRemapper, bool Quiet, unsigned PatchThreads,
+                    NormalizeOptions Normalize);
+  template <typename Layout> Error checkTimestamps() const;
+  template <typename Layout> Error verifyRecords() const;
+  Error verifyDeclUSRs(size_t NumDeclLocs) const;
+  // The offsets in TextData that the records use as FileIDs
+  template <typename Layout> BitVector referencedFileIDs() const;
+
+  StringRef getSection(SectionID ID) const {
+    return Replaced[ID] ? *Replaced[ID] : Sections->get(ID).Blob;
+  }
+
+  std::shared_ptr<const LazySections> Sections;
+  SourceInfoLayoutID Layout;
+  // The sections `remapFilePath` has rewritten, which hide the ones in the file
+  std::optional<StringRef> Replaced[LazySections::NumSections];
 };
 
 #endif // SWIFT_SOURCE_INFO_H
@@ -0,0 +1,416 @@
+#include "TarStream.h"
+#include "SourceInfoFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#if defined(__linux__)
+#include <fcntl.h>
+#endif
+
+static const size_t TarBlockSize = 512;
+
+// Entries that aren't rewritten and are at least this large are copied straight from the input to
+// the output, once the entries before them are written, instead of being queued in memory.
+static const uint64_t DirectCopyThreshold = 1 << 20;
+
+// How much output may wait for an earlier entry to be rewritten
+static const size_t MaxQueuedBytes = 64 << 20;
+
+// The fields of a ustar header used here
+static const size_t NameOffset = 0, NameSize = 100;
+static const size_t SizeOffset = 124, SizeSize = 12;
+static const size_t ChecksumOffset = 148, ChecksumSize = 8;
+static const size_t TypeOffset = 156;
+static const size_t MagicOffset = 257;
+static const size_t PrefixOffset = 345, PrefixSize = 155;
+
+static uint64_t paddedSize(uint64_t Size) {
+  return (Size + TarBlockSize - 1) / TarBlockSize * TarBlockSize;
+}
+
+static Error errnoError(const Twine &Message) {
+  std::error_code EC(errno, std::generic_category());
+  return createStringError(EC, "%s: %s", Message.str().c_str(), EC.message().c_str());
+}
+
+// Reads `Size` bytes, or fewer at the end of the input. Returns the number of bytes read, or -1.
+static ssize_t readFull(int FD, char *Data, size_t Size) {
+  size_t Done = 0;
+  while (Done < Size) {
+    ssize_t N = ::read(FD, Data + Done, Size - Done);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N < 0)
+      return -1;
+    if (N == 0)
+      break;
+    Done += N;
+  }
+  return Done;
+}
+
+static bool writeAll(int FD, const char *Data, size_t Size) {
+  while (Size > 0) {
+    ssize_t N = ::write(FD, Data, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Data += N;
+    Size -= N;
+  }
+  return true;
+}
+
+// Copies `Size` bytes, or everything up to the end of the input if `Size` is -1
+static Error copyDirect(int InFD, int OutFD, uint64_t Size) {
+#if defined(__linux__)
+  // The bytes move between the pipe buffers without being copied through user space
+  while (Size > 0) {
+    ssize_t N = ::splice(InFD, nullptr, OutFD, nullptr, std::min<uint64_t>(Size, 1 << 20),
+                         SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N < 0 && (errno == EINVAL || errno == ENOSYS))
+      break; // Neither side is a pipe
+    if (N < 0)
+      return errnoError("Cannot copy the tar stream");
+    if (N == 0)
+      break;
+    if (Size != uint64_t(-1))
+      Size -= N;
+  }
+  if (Size == 0)
+    return Error::success();
+#endif
+
+  std::vector<char> Buffer(1 << 20);
+  while (Size > 0) {
+    ssize_t N = readFull(InFD, Buffer.data(), std::min<uint64_t>(Size, Buffer.size()));
+    if (N < 0)
+      return errnoError("Cannot read the tar stream");
+    if (N == 0)
+      break;
+    if (!writeAll(OutFD, Buffer.data(), N))
+      return errnoError("Cannot write the tar stream");
+    if (Size != uint64_t(-1))
+      Size -= N;
+  }
+  if (Size != 0 && Size != uint64_t(-1))
+    return createStringError(std::errc::illegal_byte_sequence, "The tar stream is truncated.");
+  return Error::success();
+}
+
+// Parses a numeric field: octal, or the base-256 encoding GNU tar uses for large values
+static bool parseNumber(StringRef Field, uint64_t &Value) {
+  if (!Field.empty() && (uint8_t(Field[0]) & 0x80)) {
+    Value = uint8_t(Field[0]) & 0x7f;
+    for (char C : Field.drop_front())
+      Value = Value << 8 | uint8_t(C);
+    return true;
+  }
+  Field = Field.take_until([](char C) { return C == '\0'; }).trim(' ');
+  Value = 0;
+  return Field.empty() || !Field.getAsInteger(8, Value);
+}
+
+static unsigned computeChecksum(const char *Header) {
+  unsigned Sum = 0;
+  for (size_t I = 0; I < TarBlockSize; I++)
+    Sum += I >= ChecksumOffset && I < ChecksumOffset + ChecksumSize ? ' ' : uint8_t(Header[I]);
+  return Sum;
+}
+
+static bool isZeroBlock(const char *Block) {
+  return std::all_of(Block, Block + TarBlockSize, [](char C) { return C == '\0'; });
+}
+
+// The name in a ustar header, with its prefix
+static std::string headerName(const char *Header) {
+  auto Field = [&](size_t Offset, size_t Size) {
+    return StringRef(Header + Offset, Size).take_until([](char C) { return C == '\0'; });
+  };
+  StringRef Name = Field(NameOffset, NameSize);
+  if (StringRef(Header + MagicOffset, 5) != "ustar")
+    return Name.str();
+  StringRef Prefix = Field(PrefixOffset, PrefixSize);
+  return Prefix.empty() ? Name.str() : (Prefix + "/" + Name).str();
+}
+
+// Sets the size field and the checksum of a ustar header. The size must fit in 11 octal digits.
+static void setHeaderSize(char *Header, uint64_t Size) {
+  char Field[SizeSize + 1];
+  std::snprintf(Field, sizeof(Field), "%011llo", (unsigned long long)Size);
+  std::memcpy(Header + SizeOffset, Field, SizeSize);
+
+  char Checksum[ChecksumSize + 1];
+  std::snprintf(Checksum, sizeof(Checksum), "%06o", computeChecksum(Header) & 0777777);
+  std::memcpy(Header + ChecksumOffset, Checksum, 7);
+  Header[ChecksumOffset + 7] = ' ';
+}
+
+// Reads the `path` and `size` records of a pax extended header: "<length> <key>=<value>\n"
+static void parsePaxRecords(StringRef Data, std::string &Path, std::optional<uint64_t> &Size) {
+  while (!Data.empty()) {
+    size_t Space = Data.find(' ');
+    uint64_t Length;
+    if (Space == StringRef::npos || Data.take_front(Space).getAsInteger(10, Length) ||
+        Length <= Space || Length > Data.size())
+      return;
+    StringRef Record = Data.slice(Space + 1, Length).rtrim('\n');
+    auto [Key, Value] = Record.split('=');
+    uint64_t Number;
+    if (Key == "path")
+      Path = Value.str();
+    else if (Key == "size" && !Value.getAsInteger(10, Number))
+      Size = Number;
+    Data = Data.drop_front(Length);
+  }
+}
+
+namespace {
+
+// An entry of the output: its header, its content and the zeros padding it to a block
+struct OutputEntry {
+  std::string Header;
+  std::shared_ptr<const std::string> Data;
+  StringRef Content;
+  size_t Padding = 0;
+  std::string Log;
+  bool Failed = false;
+};
+
+// Writes the entries in the order they were queued, on a thread of its own, as their futures
+// become ready
+class OrderedOutput {
+  int FD;
+  raw_ostream &Log;
+  size_t MaxQueuedEntries;
+
+  std::mutex Lock;
+  std::condition_variable Changed;
+  std::deque<std::pair<std::future<OutputEntry>, size_t>> Queue;
+  size_t QueuedBytes = 0;
+  bool Writing = false;
+  bool Done = false;
+  int WriteErrno = 0;
+  size_t NumFailed = 0;
+  std::thread Writer;
+
+  void writeLoop() {
+    static const char Zeros[TarBlockSize] = {};
+    std::unique_lock<std::mutex> Guard(Lock);
+    while (true) {
+      Changed.wait(Guard, [&] { return !Queue.empty() || Done; });
+      if (Queue.empty())
+        return;
+      auto [Future, Size] = std::move(Queue.front());
+      Queue.pop_front();
+      Writing = true;
+      Guard.unlock();
+
+      OutputEntry Entry = Future.get();
+      bool Written = WriteErrno == 0 && writeAll(FD, Entry.Header.data(), Entry.Header.size()) &&
+                     writeAll(FD, Entry.Content.data(), Entry.Content.size()) &&
+                     writeAll(FD, Zeros, Entry.Padding);
+      Log << Entry.Log;
+
+      Guard.lock();
+      if (!Written && WriteErrno == 0)
+        WriteErrno = errno ? errno : EIO;
+      NumFailed += Entry.Failed;
+      QueuedBytes -= Size;
+      Writing = false;
+      Changed.notify_all();
+    }
+  }
+
+public:
+  OrderedOutput(int FD, raw_ostream &Log, size_t MaxQueuedEntries)
+      : FD(FD), Log(Log), MaxQueuedEntries(MaxQueuedEntries), Writer([this] { writeLoop(); }) {}
+
+  ~OrderedOutput() {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Done = true;
+    }
+    Changed.notify_all();
+    Writer.join();
+  }
+
+  // Queues an entry of about `Size` bytes. Blocks while too much is queued already.
+  void push(std::future<OutputEntry> Entry, size_t Size) {
+    std::unique_lock<std::mutex> Guard(Lock);
+    Changed.wait(Guard, [&] {
+      return Queue.empty() || (QueuedBytes + Size <= MaxQueuedBytes &&
+                               Queue.size() < MaxQueuedEntries);
+    });
+    QueuedBytes += Size;
+    Queue.emplace_back(std::move(Entry), Size);
+    Changed.notify_all();
+  }
+
+  void push(OutputEntry Entry) {
+    std::promise<OutputEntry> Ready;
+    size_t Size = Entry.Header.size() + Entry.Content.size();
+    Ready.set_value(std::move(Entry));
+    push(Ready.get_future(), Size);
+  }
+
+  // Waits until everything queued is written. The caller can then write to the output itself,
+  // until it queues something again.
+  Error drain() {
+    std::unique_lock<std::mutex> Guard(Lock);
+    Changed.wait(Guard, [&] { return Queue.empty() && !Writing; });
+    if (WriteErrno) {
+      errno = WriteErrno;
+      return errnoError("Cannot write the tar stream");
+    }
+    return Error::success();
+  }
+
+  size_t getNumFailed() {
+    std::lock_guard<std::mutex> Guard(Lock);
+    return NumFailed;
+  }
+};
+
+} // end anonymous namespace
+
+Expected<size_t> rewriteTarStream(int InFD, int OutFD, unsigned NumThreads,
+                                  TarEntryMatcher Matches, const TarEntryRewriter &Rewrite,
+                                  raw_ostream &Log) {
+  if (NumThreads == 0)
+    NumThreads = std::max(1u, std::thread::hardware_concurrency());
+  // The pool is destroyed first, so every rewrite has finished before the output stops
+  OrderedOutput Output(OutFD, Log, NumThreads * 4);
+  WorkStealingThreadPool Pool(NumThreads);
+
+  // What the GNU and pax headers say about the next entry
+  std::string NextName;
+  std::optional<uint64_t> NextSize;
+
+  // Appends `Size` bytes of the input to `Data`
+  auto ReadContent = [&](std::string &Data, uint64_t Size) -> Error {
+    size_t Old = Data.size();
+    Data.resize(Old + Size);
+    ssize_t N = readFull(InFD, Data.data() + Old, Size);
+    if (N < 0)
+      return errnoError("Cannot read the tar stream");
+    if (uint64_t(N) != Size)
+      return createStringError(std::errc::illegal_byte_sequence, "The tar stream is truncated.");
+    return Error::success();
+  };
+
+  while (true) {
+    char Header[TarBlockSize];
+    ssize_t N = readFull(InFD, Header, TarBlockSize);
+    if (N < 0)
+      return errnoError("Cannot read the tar stream");
+    if (N == 0)
+      break;
+    if (size_t(N) < TarBlockSize)
+      return createStringError(std::errc::illegal_byte_sequence, "The tar stream is truncated.");
+
+    // The end of the archive: copy it, and whatever follows, as it is
+    if (isZeroBlock(Header)) {
+      RETURN_IF_ERROR(Output.drain());
+      if (!writeAll(OutFD, Header, TarBlockSize))
+        return errnoError("Cannot write the tar stream");
+      RETURN_IF_ERROR(copyDirect(InFD, OutFD, uint64_t(-1)));
+      break;
+    }
+
+    uint64_t Checksum, HeaderSize;
+    if (!parseNumber(StringRef(Header + ChecksumOffset, ChecksumSize), Checksum) ||
+        Checksum != computeChecksum(Header) ||
+        !parseNumber(StringRef(Header + SizeOffset, SizeSize), HeaderSize))
+      return createStringError(std::errc::illegal_byte_sequence,
+                               "The input is not a tar stream.");
+
+    bool SizeFromPax = NextSize.has_value();
+    uint64_t Size = NextSize.value_or(HeaderSize);
+    uint64_t Padded = paddedSize(Size);
+    std::string Name = NextName.empty() ? headerName(Header) : NextName;
+    NextName.clear();
+    NextSize.reset();
+
+    char Type = Header[TypeOffset];
+    auto Data = std::make_shared<std::string>();
+    OutputEntry Entry;
+    Entry.Header.assign(Header, TarBlockSize);
+
+    // GNU long names and pax extended headers describe the next entry
+    if (Type == 'L' || Type == 'x') {
+      RETURN_IF_ERROR(ReadContent(*Data, Padded));
+      StringRef Content = StringRef(*Data).take_front(Size);
+      if (Type == 'L')
+        NextName = Content.take_until([](char C) { return C == '\0'; }).str();
+      else
+        parsePaxRecords(Content, NextName, NextSize);
+      Entry.Data = Data;
+      Entry.Content = *Data;
+      Output.push(std::move(Entry));
+      continue;
+    }
+
+    bool Regular = Type == '0' || Type == '\0' || Type == '7';
+    if (Regular && !SizeFromPax && Size > 0) {
+      RETURN_IF_ERROR(ReadContent(*Data, std::min<uint64_t>(Padded, TarBlockSize)));
+      if (Matches(StringRef(*Data).take_front(Size))) {
+        RETURN_IF_ERROR(ReadContent(*Data, Padded - Data->size()));
+        auto Promise = std::make_shared<std::promise<OutputEntry>>();
+        Output.push(Promise->get_future(), TarBlockSize + Padded);
+        Pool.async([&Rewrite, Promise, Data, Size, Name, Entry] {
+          TarEntryResult Result = Rewrite(Name, StringRef(*Data).take_front(Size));
+          OutputEntry Out = Entry;
+          Out.Log = std::move(Result.Log);
+          if (!Result.Error.empty()) {
+            Out.Log += Result.Error + "\n";
+            Out.Failed = true;
+          }
+          if (Out.Failed || !Result.Data) {
+            Out.Data = Data;
+            Out.Content = *Data;
+          } else {
+            auto NewData = std::make_shared<const std::string>(std::move(*Result.Data));
+            setHeaderSize(Out.Header.data(), NewData->size());
+            Out.Data = NewData;
+            Out.Content = *NewData;
+            Out.Padding = paddedSize(NewData->size()) - NewData->size();
+          }
+          Promise->set_value(std::move(Out));
+        });
+        continue;
+      }
+    }
+
+    // Everything else is copied as it is: small entries through the queue, and large ones straight
+    // to the output once it has caught up
+    uint64_t Rest = Padded - Data->size();
+    if (Padded < DirectCopyThreshold) {
+      RETURN_IF_ERROR(ReadContent(*Data, Rest));
+      Entry.Data = Data;
+      Entry.Content = *Data;
+      Output.push(std::move(Entry));
+    } else {
+      RETURN_IF_ERROR(Output.drain());
+      if (!writeAll(OutFD, Header, TarBlockSize) || !writeAll(OutFD, Data->data(), Data->size()))
+        return errnoError("Cannot write the tar stream");
+      RETURN_IF_ERROR(copyDirect(InFD, OutFD, Rest));
+    }
+  }
+
+  RETURN_IF_ERROR(Output.drain());
+  return Output.getNumFailed();
+}
@@ -0,0 +1,47 @@
+#ifndef TAR_STREAM_H
+#define TAR_STREAM_H
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <functional>
+#include <optional>
+#include <string>
+
+using namespace llvm;
+
+// Rewriting the files inside a tar stream as it goes by, without extracting it. The stream is read
+// one header at a time. The files to rewrite are read into memory and rewritten on a pool, and
+// everything else is copied as it is. The output keeps the order of the input: an entry is written
+// once the entries before it are, and the ones behind it wait in memory up to a bound.
+//
+// ustar, GNU and pax archives are supported. The long names of GNU and pax headers are used in the
+// messages, and an entry whose size is given by a pax header is never rewritten, since only the
+// size field of the ustar header is updated.
+
+// What rewriting an entry gave
+struct TarEntryResult {
+  // The new content, or std::nullopt to keep the entry as it is
+  std::optional<std::string> Data;
+  // Copied to the log, in the order of the entries
+  std::string Log;
+  // If not empty, the entry is kept as it is, and this line is copied to the log
+  std::string Error;
+};
+
+// Decides from the first bytes of a regular file (at most a block) whether to rewrite it
+using TarEntryMatcher = function_ref<bool(StringRef Head)>;
+
+// Rewrites a file. Called on the pool threads.
+using TarEntryRewriter = std::function<TarEntryResult(StringRef Name, StringRef Data)>;
+
+// Copies the tar stream from `InFD` to `OutFD`, rewriting the regular files that `Matches` picks on
+// up to `NumThreads` threads. Large entries that aren't rewritten are copied without going through
+// memory, with `splice` when one side is a pipe on Linux. Returns the number of entries that
+// failed to rewrite.
+Expected<size_t> rewriteTarStream(int InFD, int OutFD, unsigned NumThreads,
+                                  TarEntryMatcher Matches, const TarEntryRewriter &Rewrite,
+                                  raw_ostream &Log);
+
+#endif // TAR_STREAM_H
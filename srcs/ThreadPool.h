@@ -0,0 +1,151 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small work-stealing thread pool. Every worker owns a queue. A worker takes tasks from the back
+// of its own queue, and steals from the front of the other queues when its own runs dry, so a few
+// large files don't leave the other cores idle.
+class WorkStealingThreadPool {
+  struct WorkQueue {
+    std::mutex Lock;
+    std::deque<std::function<void()>> Tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> Queues;
+  std::vector<std::thread> Workers;
+
+  std::mutex StateLock;
+  std::condition_variable WorkAvailable;
+  std::condition_variable AllDone;
+  // The number of tasks sitting in the queues
+  size_t NumQueued = 0;
+  // The number of tasks that were submitted but haven't finished yet
+  size_t NumPending = 0;
+  bool ShuttingDown = false;
+
+  std::atomic<unsigned> NextQueue{0};
+
+  // The pool and the queue index of the worker running on the current thread
+  struct WorkerIdentity {
+    const WorkStealingThreadPool *Pool = nullptr;
+    unsigned Index = 0;
+  };
+
+  static WorkerIdentity &currentWorker() {
+    static thread_local WorkerIdentity Identity;
+    return Identity;
+  }
+
+  bool popTask(unsigned Index, std::function<void()> &Task) {
+    // Own queue first, LIFO for cache locality
+    {
+      WorkQueue &Own = *Queues[Index];
+      std::lock_guard<std::mutex> Guard(Own.Lock);
+      if (!Own.Tasks.empty()) {
+        Task = std::move(Own.Tasks.back());
+        Own.Tasks.pop_back();
+        return true;
+      }
+    }
+
+    // Steal from the others, FIFO
+    for (unsigned I = 1; I < Queues.size(); I++) {
+      WorkQueue &Victim = *Queues[(Index + I) % Queues.size()];
+      std::lock_guard<std::mutex> Guard(Victim.Lock);
+      if (!Victim.Tasks.empty()) {
+        Task = std::move(Victim.Tasks.front());
+        Victim.Tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void workerLoop(unsigned Index) {
+    currentWorker() = {this, Index};
+    while (true) {
+      std::function<void()> Task;
+      if (popTask(Index, Task)) {
+        {
+          std::lock_guard<std::mutex> Guard(StateLock);
+          NumQueued--;
+        }
+        Task();
+
+        std::lock_guard<std::mutex> Guard(StateLock);
+        if (--NumPending == 0)
+          AllDone.notify_all();
+        continue;
+      }
+
+      std::unique_lock<std::mutex> Guard(StateLock);
+      WorkAvailable.wait(Guard, [&] { return NumQueued > 0 || ShuttingDown; });
+      if (ShuttingDown && NumQueued == 0)
+        return;
+    }
+  }
+
+public:
+  // Creates a pool with `NumThreads` workers. Zero means one worker per hardware thread.
+  explicit WorkStealingThreadPool(unsigned NumThreads = 0) {
+    if (NumThreads == 0)
+      NumThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned I = 0; I < NumThreads; I++)
+      Queues.push_back(std::make_unique<WorkQueue>());
+    for (unsigned I = 0; I < NumThreads; I++)
+      Workers.emplace_back([this, I] { workerLoop(I); });
+  }
+
+  ~WorkStealingThreadPool() {
+    wait();
+    {
+      std::lock_guard<std::mutex> Guard(StateLock);
+      ShuttingDown = true;
+    }
+    WorkAvailable.notify_all();
+    for (auto &Worker : Workers)
+      Worker.join();
+  }
+
+  WorkStealingThreadPool(const WorkStealingThreadPool &) = delete;
+  WorkStealingThreadPool &operator=(const WorkStealingThreadPool &) = delete;
+
+  // Schedules a task. Tasks submitted from a worker go to that worker's own queue; the others are
+  // spread round-robin.
+  void async(std::function<void()> Task) {
+    {
+      std::lock_guard<std::mutex> Guard(StateLock);
+      NumQueued++;
+      NumPending++;
+    }
+
+    const WorkerIdentity &Current = currentWorker();
+    unsigned Index = Current.Pool == this ? Current.Index : NextQueue++ % Queues.size();
+    {
+      std::lock_guard<std::mutex> Guard(Queues[Index]->Lock);
+      Queues[Index]->Tasks.push_back(std::move(Task));
+    }
+    WorkAvailable.notify_one();
+  }
+
+  // Blocks until every submitted task, including the ones submitted by other tasks, has finished.
+  // Must not be called from inside a task.
+  void wait() {
+    std::unique_lock<std::mutex> Guard(StateLock);
+    AllDone.wait(Guard, [&] { return NumPending == 0; });
+  }
+
+  unsigned getThreadCount() const { return Workers.size(); }
+};
+
+#endif // THREAD_POOL_H
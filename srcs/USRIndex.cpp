@@ -0,0 +1,204 @@
+#include "USRIndex.h"
+#include "SwiftInternals.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace swift::serialization;
+
+static const char USRIndexMagic[] = {'S', 'I', 'U', 'X'};
+static const uint32_t USRIndexVersion = 1;
+
+// Magic, version, strings offset, strings size, table offset
+static const size_t USRIndexHeaderSize = 4 + 4 * sizeof(uint32_t);
+
+namespace {
+// What the table stores for a USR. Module and FilePath are offsets into the strings.
+struct EntryData {
+  uint32_t Module;
+  uint32_t FilePath;
+  uint32_t Line;
+  uint32_t Column;
+};
+
+const unsigned EntryDataSize = 4 * sizeof(uint32_t);
+
+class USRIndexWriterInfo {
+public:
+  using key_type = StringRef;
+  using key_type_ref = StringRef;
+  using data_type = EntryData;
+  using data_type_ref = const EntryData &;
+  using hash_value_type = uint32_t;
+  using offset_type = uint32_t;
+
+  hash_value_type ComputeHash(key_type_ref Key) {
+    return llvm::djbHash(Key, SWIFTSOURCEINFO_HASH_SEED);
+  }
+
+  std::pair<offset_type, offset_type> EmitKeyDataLength(raw_ostream &Out, key_type_ref Key,
+                                                        data_type_ref) {
+    support::endian::write<uint32_t>(Out, Key.size(), llvm::endianness::little);
+    return {Key.size(), EntryDataSize};
+  }
+
+  void EmitKey(raw_ostream &Out, key_type_ref Key, offset_type) { Out << Key; }
+
+  void EmitData(raw_ostream &Out, key_type_ref, data_type_ref Data, offset_type) {
+    for (uint32_t Field : {Data.Module, Data.FilePath, Data.Line, Data.Column})
+      support::endian::write<uint32_t>(Out, Field, llvm::endianness::little);
+  }
+};
+
+// The same as `DeclUSRTableInfo`, with the entry as the data
+class USRIndexReaderInfo {
+public:
+  using internal_key_type = StringRef;
+  using external_key_type = StringRef;
+  using data_type = EntryData;
+  using hash_value_type = uint32_t;
+  using offset_type = uint32_t;
+
+  internal_key_type GetInternalKey(external_key_type Key) { return Key; }
+
+  external_key_type GetExternalKey(internal_key_type Key) { return Key; }
+
+  hash_value_type ComputeHash(internal_key_type Key) {
+    return llvm::djbHash(Key, SWIFTSOURCEINFO_HASH_SEED);
+  }
+
+  static bool EqualKey(internal_key_type LHS, internal_key_type RHS) { return LHS == RHS; }
+
+  static std::pair<unsigned, unsigned> ReadKeyDataLength(const uint8_t *&Data) {
+    unsigned KeyLength = readNext<uint32_t>(Data);
+    return {KeyLength, EntryDataSize};
+  }
+
+  static internal_key_type ReadKey(const uint8_t *Data, unsigned Length) {
+    return StringRef(reinterpret_cast<const char *>(Data), Length);
+  }
+
+  data_type ReadData(internal_key_type, const uint8_t *Data, unsigned) {
+    EntryData Entry;
+    Entry.Module = readNext<uint32_t>(Data);
+    Entry.FilePath = readNext<uint32_t>(Data);
+    Entry.Line = readNext<uint32_t>(Data);
+    Entry.Column = readNext<uint32_t>(Data);
+    return Entry;
+  }
+};
+} // namespace
+
+class USRIndexBuilder::Generator : public OnDiskChainedHashTableGenerator<USRIndexWriterInfo> {};
+
+class USRIndex::Table : public OnDiskChainedHashTable<USRIndexReaderInfo> {
+public:
+  using OnDiskChainedHashTable::OnDiskChainedHashTable;
+};
+
+USRIndexBuilder::USRIndexBuilder() : Table(std::make_unique<Generator>()) {}
+USRIndexBuilder::~USRIndexBuilder() = default;
+
+uint32_t USRIndexBuilder::intern(StringRef String) {
+  auto [It, Inserted] = StringOffsets.try_emplace(String, Strings.size());
+  if (Inserted) {
+    Strings.append(String.data(), String.size());
+    Strings.push_back('\0');
+  }
+  return It->second;
+}
+
+bool USRIndexBuilder::add(StringRef USR, StringRef Module, StringRef FilePath, uint32_t Line,
+                          uint32_t Column) {
+  if (USR.empty() || !USRs.insert(USR).second)
+    return false;
+  Table->insert(USR, EntryData{intern(Module), intern(FilePath), Line, Column});
+  return true;
+}
+
+Error USRIndexBuilder::write(StringRef Path) {
+  SmallString<0> Buffer;
+  raw_svector_ostream Out(Buffer);
+
+  // The header is patched once the offsets are known
+  Out.write(USRIndexMagic, sizeof(USRIndexMagic));
+  Out.write_zeros(USRIndexHeaderSize - sizeof(USRIndexMagic));
+
+  uint32_t StringsOffset = Out.tell();
+  Out << Strings;
+  uint32_t TableOffset = Table->Emit(Out);
+
+  char *Header = Buffer.data() + sizeof(USRIndexMagic);
+  for (uint32_t Field : {USRIndexVersion, StringsOffset, uint32_t(Strings.size()), TableOffset}) {
+    support::endian::write32le(Header, Field);
+    Header += sizeof(uint32_t);
+  }
+
+  std::error_code EC;
+  raw_fd_ostream OutFile(Path, EC);
+  if (EC)
+    return createStringError(EC, "%s: %s", Path.str().c_str(), EC.message().c_str());
+  OutFile.write(Buffer.data(), Buffer.size());
+  OutFile.close();
+  if (OutFile.has_error()) {
+    EC = OutFile.error();
+    OutFile.clear_error();
+    return createStringError(EC, "%s: %s", Path.str().c_str(), EC.message().c_str());
+  }
+  return Error::success();
+}
+
+USRIndex::USRIndex() = default;
+USRIndex::~USRIndex() = default;
+
+Expected<std::unique_ptr<USRIndex>> USRIndex::open(StringRef Path) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> MB =
+      MemoryBuffer::getFile(Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+  if (!MB)
+    return createStringError(MB.getError(), "%s: %s", Path.str().c_str(),
+                             MB.getError().message().c_str());
+
+  StringRef Data = (*MB)->getBuffer();
+  auto Invalid = [&] {
+    return createStringError(std::errc::illegal_byte_sequence, "%s: not a USR index.",
+                             Path.str().c_str());
+  };
+  if (Data.size() < USRIndexHeaderSize || !Data.startswith(StringRef(USRIndexMagic, 4)))
+    return Invalid();
+
+  const char *Header = Data.data() + sizeof(USRIndexMagic);
+  uint32_t Version = support::endian::read32le(Header);
+  uint32_t StringsOffset = support::endian::read32le(Header + 4);
+  uint32_t StringsSize = support::endian::read32le(Header + 8);
+  uint32_t TableOffset = support::endian::read32le(Header + 12);
+  if (Version != USRIndexVersion)
+    return createStringError(std::errc::illegal_byte_sequence,
+                             "%s: unsupported USR index version %u.", Path.str().c_str(),
+                             Version);
+  if (uint64_t(StringsOffset) + StringsSize > Data.size() ||
+      uint64_t(TableOffset) + 2 * sizeof(uint32_t) > Data.size() ||
+      TableOffset % alignof(uint32_t) != 0)
+    return Invalid();
+
+  std::unique_ptr<USRIndex> Index(new USRIndex());
+  Index->Buffer = std::move(*MB);
+  Index->Strings = Data.substr(StringsOffset, StringsSize);
+  auto Base = reinterpret_cast<const uint8_t *>(Data.data());
+  const uint8_t *Buckets = Base + TableOffset;
+  auto [NumBuckets, NumEntries] = Table::readNumBucketsAndEntries(Buckets);
+  Index->USRs = std::make_unique<Table>(NumBuckets, NumEntries, Buckets, Base);
+  return std::move(Index);
+}
+
+StringRef USRIndex::stringAt(uint32_t Offset) const {
+  StringRef String = Strings.substr(Offset);
+  return String.slice(0, String.find('\0'));
+}
+
+std::optional<USRIndexEntry> USRIndex::lookup(StringRef USR) const {
+  auto It = USRs->find(USR);
+  if (It == USRs->end())
+    return std::nullopt;
+
+  EntryData Data = *It;
+  return USRIndexEntry{stringAt(Data.Module), stringAt(Data.FilePath), Data.Line, Data.Column};
+}
@@ -0,0 +1,78 @@
+#ifndef USR_INDEX_H
+#define USR_INDEX_H
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <memory>
+#include <optional>
+#include <string>
+
+using namespace llvm;
+
+// A merged index of the declarations of many modules, so a USR can be found across a whole
+// workspace without parsing any .swiftsourceinfo file. The index is a single file that is
+// memory-mapped and used as is:
+//
+//   Header   "SIUX", the version, the offset and size of the strings, the offset of the table
+//   Strings  the module names and file paths, interned and '\0' terminated
+//   Table    an `llvm::OnDiskChainedHashTable` from a USR to the offsets of its module and path in
+//            Strings, and its line and column. USRs are hashed like in DeclUSRs, with `djbHash`
+//            and SWIFTSOURCEINFO_HASH_SEED.
+//
+// All the integers are 32-bit little-endian.
+struct USRIndexEntry {
+  StringRef Module;
+  StringRef FilePath;
+  uint32_t Line;
+  uint32_t Column;
+};
+
+class USRIndexBuilder {
+public:
+  class Generator;
+
+  USRIndexBuilder();
+  ~USRIndexBuilder();
+
+  // Adds a declaration. The first declaration of a USR wins, and the later ones are ignored and
+  // return false. The USR isn't copied, so it must outlive the builder.
+  bool add(StringRef USR, StringRef Module, StringRef FilePath, uint32_t Line, uint32_t Column);
+
+  size_t size() const { return USRs.size(); }
+
+  Error write(StringRef Path);
+
+private:
+  uint32_t intern(StringRef String);
+
+  std::unique_ptr<Generator> Table;
+  DenseSet<StringRef> USRs;
+  StringMap<uint32_t> StringOffsets;
+  std::string Strings;
+};
+
+class USRIndex {
+public:
+  class Table;
+
+  ~USRIndex();
+
+  // Maps the index file and checks its header. Nothing else is read up front.
+  static Expected<std::unique_ptr<USRIndex>> open(StringRef Path);
+
+  std::optional<USRIndexEntry> lookup(StringRef USR) const;
+
+private:
+  USRIndex();
+
+  StringRef stringAt(uint32_t Offset) const;
+
+  std::unique_ptr<MemoryBuffer> Buffer;
+  StringRef Strings;
+  std::unique_ptr<Table> USRs;
+};
+
+#endif // USR_INDEX_H
@@ -1,34 +1,44 @@
+#include "FilePipeline.h"
 #include "Remapper.h"
+#include "ResultCache.h"
 #include "SwiftInternals.h"
+#include "Server.h"
+#include "SourceInfo.h"
+#include "SourceInfoDiff.h"
+#include "SourceInfoDump.h"
+#include "SourceInfoFile.h"
+#include "Stats.h"
 #include "SwiftSourceInfo.h"
+#include "TarStream.h"
+#include "ThreadPool.h"
+#include "USRIndex.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Bitstream/BitstreamReader.h"
 #include "llvm/Bitstream/BitstreamWriter.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/LineIterator.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <chrono>
 #include <iomanip>
 #include <iostream>
-#include <regex>
+#include <mutex>
+#include <unistd.h>
 
 using namespace llvm;
 using namespace llvm::support;
 using namespace swift::serialization;
 
-#define DEBUG_TYPE "debug"
-
-#define RETURN_IF_ERROR(Err)                                                                       \
-  if (auto _err = (Err)) {                                                                         \
-    return std::move(_err);                                                                        \
-  }
-
-#define UNEXPECTED_BIT_ERROR                                                                       \
-  llvm::createStringError(std::errc::illegal_byte_sequence, "Unexpected bit in bitstream. (%d)",   \
-                          __LINE__)
-
 static cl::OptionCategory DefaultCategory("Basic Options");
 static cl::opt<std::string> InputFilename(cl::Positional, cl::desc("<input swiftsourceinfo>"),
                                           cl::cat(DefaultCategory));
@@ -39,237 +49,1313 @@ static cl::list<std::string> PathRemaps("remap", cl::desc("Path remapping substi
                                         cl::cat(DefaultCategory));
 static cl::opt<bool> Quiet("quiet", cl::desc("Suppress any output"), cl::init(false),
                            cl::cat(DefaultCategory));
+static cl::list<std::string>
+    LookupUSRs("lookup",
+               cl::desc("Print where the USR is declared, instead of the whole content. Use `-` "
+                        "to read USRs from stdin, one per line."),
+               cl::value_desc("USR"), cl::cat(DefaultCategory));
+static cl::opt<DumpFormat> OutputFormat(
+    "format", cl::desc("The format of the content printed when there is nothing to remap."),
+    cl::values(clEnumValN(DumpFormat::Text, "text", "Human readable (default)"),
+               clEnumValN(DumpFormat::NDJSON, "ndjson", "One JSON object per record"),
+               clEnumValN(DumpFormat::JSON, "json", "One JSON document"),
+               clEnumValN(DumpFormat::TSV, "tsv", "Tab-separated records")),
+    cl::init(DumpFormat::Text), cl::cat(DefaultCategory));
+
+static cl::OptionCategory BatchCategory("Batch Options");
+static cl::opt<std::string>
+    BatchManifest("batch",
+                  cl::desc("Remap every file listed in the manifest, one "
+                           "'<input>\\t<output>' pair per line ('-' for stdin)."),
+                  cl::value_desc("manifest"), cl::cat(BatchCategory));
+static cl::opt<std::string>
+    InputDir("input-dir",
+             cl::desc("Remap every .swiftsourceinfo file under this directory (requires "
+                      "--output-dir)."),
+             cl::value_desc("dir"), cl::cat(BatchCategory));
+static cl::opt<std::string>
+    OutputDir("output-dir",
+              cl::desc("Where the files found under --input-dir are written, keeping their "
+                       "relative paths."),
+              cl::value_desc("dir"), cl::cat(BatchCategory));
+static cl::opt<unsigned> NumJobs("j",
+                                 cl::desc("The number of worker threads in batch mode, or the "
+                                          "number of threads patching a large file otherwise "
+                                          "(default: the number of cores)."),
+                                 cl::init(0), cl::cat(BatchCategory));
+static cl::opt<unsigned>
+    IOThreads("io-threads",
+              cl::desc("The number of threads reading the inputs ahead and writing the outputs "
+                       "behind in batch mode (default: 8)."),
+              cl::init(8), cl::cat(BatchCategory));
+static cl::opt<uint64_t>
+    IOMemoryMB("io-memory",
+               cl::desc("The memory in megabytes that the files read ahead and waiting to be "
+                        "written may hold in batch mode (default: 512)."),
+               cl::init(512), cl::cat(BatchCategory));
+static cl::opt<std::string>
+    ScanDir("scan",
+            cl::desc("Walks this directory in parallel for .swiftsourceinfo files, in "
+                     ".swiftmodule bundles and elsewhere, and remaps them (in place, or under "
+                     "--output-dir) or prints them as they are found."),
+            cl::value_desc("dir"), cl::cat(BatchCategory));
+static cl::opt<bool>
+    TarMode("tar",
+            cl::desc("Reads a tar stream from the input (default: stdin) and writes it to the "
+                     "output (default: stdout), remapping the .swiftsourceinfo files in it and "
+                     "copying everything else as it is."),
+            cl::init(false), cl::cat(BatchCategory));
+
+static cl::OptionCategory IndexCategory("Index Options");
+static cl::opt<std::string>
+    BuildIndex("build-index",
+               cl::desc("Merges the USRs of all the .swiftsourceinfo files under --input-dir into "
+                        "one index file."),
+               cl::value_desc("index"), cl::cat(IndexCategory));
+static cl::opt<std::string> IndexFile("index",
+                                      cl::desc("Answers --lookup from an index written by "
+                                               "--build-index, instead of a .swiftsourceinfo file."),
+                                      cl::value_desc("index"), cl::cat(IndexCategory));
+
+static cl::OptionCategory ServerCategory("Server Options");
+static cl::opt<std::string>
+    ServeSocket("serve",
+                cl::desc("Serves remap, inspect and lookup requests on a Unix domain socket, "
+                         "with the --remap rules compiled once."),
+                cl::value_desc("socket"), cl::cat(ServerCategory));
+static cl::opt<std::string>
+    ConnectSocket("connect",
+                  cl::desc("Sends the request to a --serve server instead of running it here."),
+                  cl::value_desc("socket"), cl::cat(ServerCategory));
+static cl::opt<bool> ShutdownServer("shutdown", cl::desc("Stops the --connect server."),
+                                    cl::init(false), cl::cat(ServerCategory));
+
+static cl::OptionCategory NormalizeCategory("Normalize Options");
+static cl::opt<bool>
+    Normalize("normalize",
+              cl::desc("Writes byte-deterministic output: the paths in TextData are sorted and "
+                       "deduplicated, and the FileIDs renumbered to match."),
+              cl::init(false), cl::cat(NormalizeCategory));
+static cl::list<std::string>
+    NormalizeRoots("normalize-root",
+                   cl::desc("Replaces this directory at the start of the paths with "
+                            "--normalize-placeholder. Applied before the --remap rules."),
+                   cl::value_desc("dir"), cl::cat(NormalizeCategory));
+static cl::opt<std::string>
+    NormalizePlaceholder("normalize-placeholder",
+                         cl::desc("What --normalize-root is replaced with (default: "
+                                  "/SOURCE_ROOT)."),
+                         cl::init("/SOURCE_ROOT"), cl::value_desc("path"),
+                         cl::cat(NormalizeCategory));
+static cl::opt<bool> ZeroTimestamps("zero-timestamps",
+                                    cl::desc("Zeroes the modification times of the source files."),
+                                    cl::init(false), cl::cat(NormalizeCategory));
+static cl::opt<bool>
+    DropUnusedPaths("drop-unused-paths",
+                    cl::desc("Leaves the paths that no record refers to out of TextData, and "
+                             "renumbers the FileIDs to match."),
+                    cl::init(false), cl::cat(NormalizeCategory));
+static cl::opt<bool>
+    CheckNormalized("check-normalized",
+                    cl::desc("Checks that the input, or every file under --input-dir, is already "
+                             "normalized with the given options, without writing anything. The "
+                             "exit code is 1 if one isn't."),
+                    cl::init(false), cl::cat(NormalizeCategory));
+
+static cl::OptionCategory FreshnessCategory("Freshness Options");
+static cl::opt<bool>
+    CheckFresh("check-fresh",
+               cl::desc("Checks that the source files named by the input, or by every file under "
+                        "--input-dir, exist locally with the size and modification time they were "
+                        "built from, after the --remap rules. The stale ones are printed, and the "
+                        "exit code is 1 if there are any."),
+               cl::init(false), cl::cat(FreshnessCategory));
+
+static cl::OptionCategory VerifyCategory("Verify Options");
+static cl::opt<bool>
+    Verify("verify",
+           cl::desc("Checks the structure of every section of the input, or of every file under "
+                    "--input-dir, in one pass, and exits with 1 if one is corrupt. With other "
+                    "options, checks each file before it is read or remapped, and fails the "
+                    "corrupt ones."),
+           cl::init(false), cl::cat(VerifyCategory));
+
+static cl::OptionCategory DiffCategory("Diff Options");
+static cl::opt<bool>
+    Diff("diff",
+         cl::desc("Compares the two files given by content: the paths in TextData, the source "
+                  "files by path and the declarations by USR, and prints what was added, "
+                  "removed or changed in the --format. Two directories compare the "
+                  ".swiftsourceinfo files at the same relative paths. The exit code is 0 if "
+                  "they are the same, 1 if they differ and 2 on errors."),
+         cl::init(false), cl::cat(DiffCategory));
+static cl::opt<bool> BriefDiff("brief",
+                               cl::desc("With --diff, only reports which files differ, stopping "
+                                        "at the first difference in each."),
+                               cl::init(false), cl::cat(DiffCategory));
+
+static cl::OptionCategory CacheCategory("Cache Options");
+static cl::opt<std::string>
+    CacheDir("cache-dir",
+             cl::desc("Caches the remapped files in this directory, keyed on the input and the "
+                      "--remap rules. A hit is cloned or hard-linked to the output without "
+                      "parsing the input."),
+             cl::value_desc("dir"), cl::cat(CacheCategory));
+static cl::opt<uint64_t> CacheSizeMB("cache-size",
+                                     cl::desc("The size bound of --cache-dir in megabytes, past "
+                                              "which the least recently used files are removed "
+                                              "(default: 1024)."),
+                                     cl::init(1024), cl::cat(CacheCategory));
+
+// `-stats` is LLVM's own option, so it isn't declared here. With it, the phase timings and the
+// counts of files, records and bytes are printed to stderr on exit.
+static cl::OptionCategory DiagnosticsCategory("Diagnostics Options");
+static cl::opt<std::string>
+    TimeTrace("time-trace",
+              cl::desc("Writes a Chrome trace (chrome://tracing, Perfetto) with a span per file "
+                       "and phase on every thread."),
+              cl::value_desc("file"), cl::cat(DiagnosticsCategory));
+
+static ExitOnError ExitOnErr("source-info-import: ");
+
+// Compiles the --remap options once, so that every file in the process shares them.
+static Expected<FilePathRemapper> buildPathRemapper() {
+  FilePathRemapper FPathRemapper;
+  // A root only matches whole directories, so `/work` doesn't take `/workspace` along
+  std::string Placeholder = StringRef(NormalizePlaceholder).rtrim('/').str();
+  for (StringRef Root : NormalizeRoots) {
+    std::string Dir = Root.rtrim('/').str() + "/";
+    std::string Replacement;
+    for (char C : Placeholder + "/")
+      Replacement += C == '$' ? "$$" : std::string(1, C);
+    FPathRemapper.addRemap("^" + Regex::escape(Dir), Replacement);
+  }
+  for (const auto &remap : PathRemaps) {
+    auto divider = remap.find('=');
+    if (divider == std::string::npos)
+      return createStringError(std::errc::invalid_argument,
+                               "Invalid --remap '%s', expecting 'regex=replacement'.",
+                               remap.c_str());
+    auto pattern = remap.substr(0, divider);
+    auto replacement = remap.substr(divider + 1);
+    FPathRemapper.addRemap(pattern, replacement);
+  }
+  return std::move(FPathRemapper);
+}
+
+// The result cache of --cache-dir, if any
+static std::unique_ptr<ResultCache> OutputCache;
+
+// The digest of everything that changes the output of a file besides its content. Bump the version
+// when the output of the same input and rules changes.
+static uint64_t getConfigDigest() {
+  std::string Config = "source-info-import result v2";
+  auto Add = [&](StringRef Value) {
+    Config += '\0';
+    Config += Value;
+  };
+  for (const auto &Remap : PathRemaps)
+    Add(Remap);
+  for (const auto &Root : NormalizeRoots)
+    Add("normalize-root=" + Root);
+  Add("normalize-placeholder=" + NormalizePlaceholder);
+  Add(Normalize ? "normalize" : "");
+  Add(ZeroTimestamps ? "zero-timestamps" : "");
+  Add(DropUnusedPaths ? "drop-unused-paths" : "");
+  Add(Verify ? "verify" : "");
+  return ResultCache::digest(Config);
+}
+
+// Rejects a corrupt file with --verify, before anything reads its records
+static Expected<std::unique_ptr<SourceInfo>>
+verifyInput(Expected<std::unique_ptr<SourceInfo>> SI) {
+  if (SI && Verify)
+    RETURN_IF_ERROR((*SI)->verify());
+  return SI;
+}
+
+// Whether the options change files, rather than only inspect them
+static bool rewritesFiles() {
+  return !PathRemaps.empty() || !NormalizeRoots.empty() || Normalize || ZeroTimestamps ||
+         DropUnusedPaths;
+}
+
+static NormalizeOptions getNormalizeOptions() {
+  NormalizeOptions Options;
+  Options.SortTextData = Normalize;
+  Options.ZeroTimestamps = ZeroTimestamps;
+  Options.DropUnusedPaths = DropUnusedPaths;
+  return Options;
+}
 
-static bool checkMagicNumber(BitstreamCursor &cursor) {
-  for (unsigned char byte : SWIFTSOURCEINFO_SIGNATURE) {
-    Expected<SimpleBitstreamCursor::word_t> maybeRead = cursor.Read(8);
-    if (maybeRead && maybeRead.get() != byte) {
-      return false;
+// Remaps a file already in memory, and returns the write of the result. With `Deferred`, the
+// write owns a copy of the output, so it can run on another thread after this one has moved on;
+// otherwise it must run before the next remap on this thread. `Log` receives the "old -> new"
+// lines. A file whose paths don't change is copied as it is, and an output that already has the
+// right bytes isn't touched.
+static Expected<FilePipeline::WriteFn>
+prepareRemappedFile(StringRef InputPath, StringRef OutputPath, std::unique_ptr<MemoryBuffer> MB,
+                    const FilePathRemapper &FPathRemapper, raw_ostream &Log,
+                    unsigned PatchThreads, bool Deferred) {
+  std::string CacheEntry;
+  if (OutputCache) {
+    {
+      PhaseScope Scope(ImportStats::CacheLookup);
+      CacheEntry = OutputCache->getEntryPath(MB->getBuffer());
     }
+    bool Hit;
+    RETURN_IF_ERROR(OutputCache->materialize(CacheEntry, OutputPath).moveInto(Hit));
+    if (Hit)
+      return FilePipeline::WriteFn([] { return Error::success(); });
   }
-  return true;
+
+  std::unique_ptr<SourceInfo> Parsed;
+  RETURN_IF_ERROR(verifyInput(SourceInfo::parse(std::move(MB), InputPath)).moveInto(Parsed));
+  std::shared_ptr<const SourceInfo> SI = std::move(Parsed);
+  RemapOptions Options;
+  Options.Normalize = getNormalizeOptions();
+  Options.PatchThreads = PatchThreads;
+  Options.Log = Quiet ? nullptr : &Log;
+  std::optional<SourceInfoRewrite> Rewrite;
+  RETURN_IF_ERROR(SI->prepareRemap(FPathRemapper, Options).moveInto(Rewrite));
+
+  // The write may outlive the strings of the caller
+  std::string Input = InputPath.str(), Output = OutputPath.str();
+  auto Commit = [Output, CacheEntry](Error Err) {
+    if (!Err && OutputCache)
+      OutputCache->insert(CacheEntry, Output);
+    return Err;
+  };
+  if (!Rewrite)
+    return FilePipeline::WriteFn([=] {
+      ImportStats::get().add(ImportStats::UnchangedFiles, 1);
+      return Commit(copyFileContent(Input, Output, SI->getBuffer().getBuffer()));
+    });
+  // The rewrite points into the input, which the write keeps alive, and into memory that the next
+  // remap on this thread reuses
+  if (!Deferred)
+    return FilePipeline::WriteFn([SI, Output, Commit, Rewrite = *Rewrite] {
+      return Commit(writeSourceInfoFile(Output, Rewrite));
+    });
+  auto Bytes = std::make_shared<std::string>(Rewrite->size(), '\0');
+  Rewrite->writeTo(Bytes->data());
+  return FilePipeline::WriteFn([=] { return Commit(writeFileContent(Output, *Bytes)); });
+}
+
+// Reads, remaps and writes a single file. `Log` receives the "old -> new" lines.
+static Error remapFile(StringRef InputPath, StringRef OutputPath,
+                       const FilePathRemapper &FPathRemapper, raw_ostream &Log,
+                       unsigned PatchThreads = 1) {
+  FileScope File(InputPath);
+  std::unique_ptr<MemoryBuffer> MB;
+  RETURN_IF_ERROR(openSourceInfo(InputPath).moveInto(MB));
+  FilePipeline::WriteFn Write;
+  RETURN_IF_ERROR(prepareRemappedFile(InputPath, OutputPath, std::move(MB), FPathRemapper, Log,
+                                      PatchThreads, /*Deferred=*/false)
+                      .moveInto(Write));
+  return Write();
+}
+
+using FilePairs = std::vector<std::pair<std::string, std::string>>;
+
+// Reads the `<input>\t<output>` lines of a batch manifest. Blank lines and '#' comments are
+// ignored.
+static Expected<FilePairs> readBatchManifest(StringRef ManifestPath) {
+  std::unique_ptr<MemoryBuffer> MB;
+  RETURN_IF_ERROR(openBitcodeFile(ManifestPath).moveInto(MB));
+
+  FilePairs Pairs;
+  for (line_iterator Line(*MB, /*SkipBlanks=*/true, '#'); !Line.is_at_eof(); ++Line) {
+    auto [Input, Output] = Line->rtrim("\r").split('\t');
+    if (Input.empty() || Output.empty())
+      return createStringError(std::errc::invalid_argument,
+                               "%s:%d: expecting '<input>\\t<output>'.",
+                               ManifestPath.str().c_str(), Line.line_number());
+    Pairs.emplace_back(Input.str(), Output.str());
+  }
+  return std::move(Pairs);
+}
+
+// Finds every .swiftsourceinfo file under `InDir`. Links to files are followed, like --scan does,
+// but not links to directories.
+static Expected<std::vector<std::string>> collectSourceInfoFiles(StringRef InDir) {
+  std::vector<std::string> Paths;
+  std::error_code EC;
+  for (sys::fs::recursive_directory_iterator It(InDir, EC, /*follow_symlinks=*/false), End;
+       It != End && !EC; It.increment(EC)) {
+    StringRef Path = It->path();
+    if (sys::path::extension(Path) != ".swiftsourceinfo")
+      continue;
+    sys::fs::file_type Type = It->type();
+    sys::fs::file_status Status;
+    if ((Type == sys::fs::file_type::symlink_file || Type == sys::fs::file_type::type_unknown) &&
+        !sys::fs::status(Path, Status))
+      Type = Status.type();
+    if (Type == sys::fs::file_type::regular_file)
+      Paths.push_back(Path.str());
+  }
+  if (EC)
+    return createStringError(EC, "%s: %s", InDir.str().c_str(), EC.message().c_str());
+  return std::move(Paths);
 }
 
-static Expected<std::unique_ptr<SwiftSourceInfo>> parseSwiftSourceInfo(BitstreamCursor &Cursor) {
-  StringRef SourceFileListData;
-  StringRef BasicDeclLocsData;
-  std::pair<SmallVector<uint64_t>, StringRef> DeclUSRsData;
-  StringRef TextDataData;
-  StringRef DocRangesData;
+// Pairs every .swiftsourceinfo file under `InDir` with the same relative path under `OutDir`.
+static Expected<FilePairs> collectDirectoryPairs(StringRef InDir, StringRef OutDir) {
+  std::vector<std::string> Inputs;
+  RETURN_IF_ERROR(collectSourceInfoFiles(InDir).moveInto(Inputs));
 
-  unsigned BlockID = 0;
+  FilePairs Pairs;
+  for (std::string &Input : Inputs) {
+    SmallString<256> OutPath(OutDir);
+    sys::path::append(OutPath, StringRef(Input).drop_front(InDir.size()));
+    Pairs.emplace_back(std::move(Input), OutPath.str().str());
+  }
+  return std::move(Pairs);
+}
+
+// Adds the path cache counters of the remapper to --stats
+static void recordPathCacheStats(const FilePathRemapper &FPathRemapper) {
+  const RemappedPathCache &Cache = FPathRemapper.getCache();
+  ImportStats::get().add(ImportStats::PathCacheHits, Cache.getHits());
+  ImportStats::get().add(ImportStats::PathCacheMisses, Cache.getMisses());
+}
+
+// Creates the directory an output goes in
+static Error createParentDirectory(StringRef Output) {
+  SmallString<256> OutParent(sys::path::parent_path(Output));
+  if (std::error_code EC =
+          OutParent.empty() ? std::error_code() : sys::fs::create_directories(OutParent))
+    return createStringError(EC, "%s: %s", OutParent.c_str(), EC.message().c_str());
+  return Error::success();
+}
 
-  while (!Cursor.AtEndOfStream()) {
-    BitstreamEntry Entry;
-    RETURN_IF_ERROR(Cursor.advance().moveInto(Entry));
+// Remaps one file of a batch, creating the directory of the output. The log and the error are
+// printed under `OutputLock`, so the lines of two files don't mix. Returns false if the file failed.
+static bool remapBatchFile(StringRef Input, StringRef Output,
+                           const FilePathRemapper &FPathRemapper, std::mutex &OutputLock) {
+  std::string LogText;
+  raw_string_ostream Log(LogText);
 
-    switch (Entry.Kind) {
-    case BitstreamEntry::SubBlock:
-      LLVM_DEBUG(dbgs() << "[BitstreamEntry::SubBlock]\tID: " << Entry.ID << "\n");
-      if (Entry.ID != MODULE_SOURCEINFO_BLOCK_ID && Entry.ID != DECL_LOCS_BLOCK_ID) {
-        RETURN_IF_ERROR(Cursor.SkipBlock());
-      } else {
-        RETURN_IF_ERROR(Cursor.EnterSubBlock(Entry.ID));
+  Error Err = createParentDirectory(Output);
+  if (!Err)
+    Err = remapFile(Input, Output, FPathRemapper, Log);
+
+  std::lock_guard<std::mutex> Guard(OutputLock);
+  llvm::outs() << Log.str();
+  if (!Err)
+    return true;
+  llvm::errs() << "source-info-import: " << Input << ": " << toString(std::move(Err)) << "\n";
+  return false;
+}
+
+// Prints the summary of a batch. Returns 0 if every file succeeded, 1 if some failed and 2 if all
+// of them failed.
+static int reportBatch(size_t NumFiles, size_t NumFailed, const FilePathRemapper &FPathRemapper) {
+  llvm::outs().flush();
+  if (!Quiet || NumFailed > 0)
+    llvm::errs() << llvm::formatv("source-info-import: remapped {0} of {1} files, {2} failed.\n",
+                                  NumFiles - NumFailed, NumFiles, NumFailed);
+  if (!Quiet) {
+    const RemappedPathCache &PathCache = FPathRemapper.getCache();
+    llvm::errs() << llvm::formatv("source-info-import: path cache: {0} hits, {1} misses.\n",
+                                  PathCache.getHits(), PathCache.getMisses());
+    if (OutputCache)
+      llvm::errs() << llvm::formatv("source-info-import: result cache: {0} hits, {1} misses.\n",
+                                    OutputCache->getHits(), OutputCache->getMisses());
+  }
+
+  if (NumFailed == 0)
+    return 0;
+  return NumFailed == NumFiles ? 2 : 1;
+}
+
+// Remaps all the files through a pipeline that reads ahead and writes behind on --io-threads,
+// with the remapping on -j threads. An error only fails its own file; the batch keeps going.
+static int runBatch(const FilePairs &Pairs, const FilePathRemapper &FPathRemapper) {
+  std::mutex OutputLock;
+  std::atomic<size_t> NumFailed{0};
+  std::vector<std::string> Inputs, Logs(Pairs.size());
+  for (const auto &Pair : Pairs)
+    Inputs.push_back(Pair.first);
+
+  FilePipeline Pipeline(NumJobs, IOThreads, IOMemoryMB << 20);
+  Pipeline.run(
+      Inputs,
+      [&](size_t I, std::unique_ptr<MemoryBuffer> MB) -> Expected<FilePipeline::WriteFn> {
+        FileScope File(Pairs[I].first);
+        raw_string_ostream Log(Logs[I]);
+        RETURN_IF_ERROR(createParentDirectory(Pairs[I].second));
+        return prepareRemappedFile(Pairs[I].first, Pairs[I].second, std::move(MB),
+                                   FPathRemapper, Log, /*PatchThreads=*/1, /*Deferred=*/true);
+      },
+      [&](size_t I, Error Err) {
+        std::lock_guard<std::mutex> Guard(OutputLock);
+        llvm::outs() << Logs[I];
+        Logs[I] = std::string();
+        if (!Err)
+          return;
+        NumFailed++;
+        llvm::errs() << "source-info-import: " << Pairs[I].first << ": "
+                     << toString(std::move(Err)) << "\n";
+      });
+
+  return reportBatch(Pairs.size(), NumFailed, FPathRemapper);
+}
+
+// Walks `Root` for .swiftsourceinfo files and remaps or prints each one as soon as it is found.
+// Every directory is listed by a task of its own on the pool that also processes the files, so
+// the walk and the processing overlap. Inside a `.swiftmodule` bundle only `Project/` is walked.
+// A candidate is confirmed by reading its signature before it is loaded. The remapped files are
+// written under --output-dir, keeping their paths relative to `Root`, or in place without it.
+static int runScan(StringRef Root, const FilePathRemapper *FPathRemapper) {
+  std::mutex OutputLock;
+  std::atomic<size_t> NumFiles{0}, NumFailed{0}, NumScanErrors{0};
+
+  auto ReportError = [&](StringRef Path, Error Err) {
+    std::lock_guard<std::mutex> Guard(OutputLock);
+    llvm::errs() << "source-info-import: " << Path << ": " << toString(std::move(Err)) << "\n";
+  };
+
+  auto ProcessFile = [&](const std::string &Path) {
+    bool IsSourceInfo;
+    if (Error Err = hasSourceInfoSignature(Path).moveInto(IsSourceInfo)) {
+      ReportError(Path, std::move(Err));
+      NumScanErrors++;
+      return;
+    }
+    if (!IsSourceInfo)
+      return;
+    NumFiles++;
+
+    if (FPathRemapper) {
+      SmallString<256> OutPath(Path);
+      if (OutputDir != "") {
+        OutPath = OutputDir;
+        sys::path::append(OutPath, StringRef(Path).drop_front(Root.size()));
       }
-      BlockID = Entry.ID;
-      break;
-    case BitstreamEntry::EndBlock:
-      LLVM_DEBUG(dbgs() << "[BitstreamEntry::EndBlock]\tID: \n");
-      break;
-
-    case BitstreamEntry::Record: {
-      LLVM_DEBUG(dbgs() << "[BitstreamEntry::Record]\tID: " << Entry.ID << "\n");
-      if (BlockID != DECL_LOCS_BLOCK_ID) {
-        auto V = Cursor.skipRecord(Entry.ID);
-        if (!V)
-          return V.takeError();
-        break;
+      if (!remapBatchFile(Path, OutPath, *FPathRemapper, OutputLock))
+        NumFailed++;
+      return;
+    }
+
+    FileScope File(Path);
+    std::string Content;
+    raw_string_ostream OS(Content);
+    std::unique_ptr<SourceInfo> SI;
+    if (Error Err = verifyInput(SourceInfo::open(Path)).moveInto(SI)) {
+      ReportError(Path, std::move(Err));
+      NumFailed++;
+      return;
+    }
+    OS << Path << ":\n";
+    SI->print(OS);
+    std::lock_guard<std::mutex> Guard(OutputLock);
+    llvm::outs() << OS.str();
+  };
+
+  WorkStealingThreadPool Pool(NumJobs);
+  std::function<void(std::string)> ScanDirectory = [&](std::string Dir) {
+    bool InBundle = sys::path::extension(Dir) == ".swiftmodule";
+    std::error_code EC;
+    for (sys::fs::directory_iterator It(Dir, EC, /*follow_symlinks=*/false), End;
+         It != End && !EC; It.increment(EC)) {
+      std::string Path = It->path();
+      StringRef Name = sys::path::filename(Path);
+      sys::fs::file_type Type = It->type();
+      sys::fs::file_status Status;
+      if (Type == sys::fs::file_type::type_unknown &&
+          !sys::fs::status(Path, Status, /*follow=*/false))
+        Type = Status.type();
+      if (Type == sys::fs::file_type::symlink_file) {
+        // Links to files are followed, but not links to directories, which could make a cycle
+        if (sys::fs::status(Path, Status) || Status.type() != sys::fs::file_type::regular_file)
+          continue;
+        Type = Status.type();
       }
-      SmallVector<uint64_t> Record;
-      StringRef Blob;
-      unsigned Code;
-      RETURN_IF_ERROR(Cursor.readRecord(Entry.ID, Record, &Blob).moveInto(Code))
-
-      switch (Entry.ID) {
-      case SOURCE_FILE_LIST_ABBREV_ID:
-        SourceFileListData = Blob;
-        break;
-      case BASIC_DECL_LOCS_ABBREV_ID:
-        BasicDeclLocsData = Blob;
-        break;
-      case DECL_USRS_ABBREV_ID:
-        DeclUSRsData = {Record, Blob};
-        break;
-      case TEXT_DATA_ABBREV_ID:
-        TextDataData = Blob;
-        break;
-      case DOC_RANGES_ABBREV_ID:
-        DocRangesData = Blob;
-        break;
-      default:
-        return UNEXPECTED_BIT_ERROR;
+
+      if (Type == sys::fs::file_type::directory_file) {
+        if (!InBundle || Name == "Project")
+          Pool.async([&ScanDirectory, Path] { ScanDirectory(Path); });
+      } else if (Type == sys::fs::file_type::regular_file && !InBundle &&
+                 sys::path::extension(Name) == ".swiftsourceinfo") {
+        Pool.async([&ProcessFile, Path] { ProcessFile(Path); });
       }
-      break;
     }
-    default:
-      return UNEXPECTED_BIT_ERROR;
+    if (EC) {
+      ReportError(Dir, errorCodeToError(EC));
+      NumScanErrors++;
     }
-  }
+  };
+  Pool.async([&] { ScanDirectory(Root.str()); });
+  Pool.wait();
 
-  return std::make_unique<SwiftSourceInfo>(TextDataData, SourceFileListData, BasicDeclLocsData,
-                                           DocRangesData, std::move(DeclUSRsData));
+  if (!FPathRemapper)
+    return NumFailed + NumScanErrors == 0 ? 0 : 1;
+  int ExitCode = reportBatch(NumFiles, NumFailed, *FPathRemapper);
+  return ExitCode == 0 && NumScanErrors > 0 ? 1 : ExitCode;
 }
 
-static Error rewriteSwiftSourceInfo(SwiftSourceInfo &SSI, BitstreamCursor &Cursor,
-                                    BitstreamWriter &Writer) {
-  RETURN_IF_ERROR(Cursor.JumpToBit(sizeof(SWIFTSOURCEINFO_SIGNATURE) * 8));
-  for (unsigned char byte : SWIFTSOURCEINFO_SIGNATURE)
-    Writer.Emit(byte, 8);
-
-  int NumAbbrevs = 0;
-  unsigned BlockID = 0;
+// Remaps the .swiftsourceinfo files of a tar stream, found by their signature rather than their
+// names, on -j threads. The "old -> new" lines and the errors go to stderr, since stdout is usually
+// the stream. Returns 1 if a file failed; it is then copied as it is.
+static Expected<int> runTar(const FilePathRemapper &FPathRemapper) {
+  int InFD = STDIN_FILENO, OutFD = STDOUT_FILENO;
+  auto CloseFiles = make_scope_exit([&] {
+    if (InFD != STDIN_FILENO)
+      ::close(InFD);
+    if (OutFD != STDOUT_FILENO)
+      ::close(OutFD);
+  });
+  if (InputFilename != "" && InputFilename != "-") {
+    if (std::error_code EC = sys::fs::openFileForRead(InputFilename, InFD))
+      return createStringError(EC, "%s: %s", InputFilename.c_str(), EC.message().c_str());
+  }
+  if (OutputFilename != "" && OutputFilename != "-") {
+    if (std::error_code EC = sys::fs::openFileForWrite(OutputFilename, OutFD))
+      return createStringError(EC, "%s: %s", OutputFilename.c_str(), EC.message().c_str());
+  }
 
-  while (!Cursor.AtEndOfStream()) {
-    BitstreamEntry Entry;
-    RETURN_IF_ERROR(Cursor.advance(BitstreamCursor::AF_DontAutoprocessAbbrevs).moveInto(Entry));
+  auto IsSourceInfo = [](StringRef Head) {
+    return Head.startswith(StringRef((const char *)SWIFTSOURCEINFO_SIGNATURE,
+                                     sizeof(SWIFTSOURCEINFO_SIGNATURE)));
+  };
+  auto RemapEntry = [&](StringRef Name, StringRef Data) {
+    FileScope File(Name);
+    ImportStats::get().add(ImportStats::BytesIn, Data.size());
+    TarEntryResult Result;
+    raw_string_ostream Log(Result.Log);
+    auto Remap = [&]() -> Error {
+      std::unique_ptr<SourceInfo> SI;
+      RETURN_IF_ERROR(verifyInput(SourceInfo::parse(MemoryBufferRef(Data, Name))).moveInto(SI));
+      RemapOptions Options;
+      Options.Normalize = getNormalizeOptions();
+      Options.Log = Quiet ? nullptr : &Log;
+      std::optional<SourceInfoRewrite> Rewrite;
+      RETURN_IF_ERROR(SI->prepareRemap(FPathRemapper, Options).moveInto(Rewrite));
+      if (!Rewrite) {
+        ImportStats::get().add(ImportStats::UnchangedFiles, 1);
+        return Error::success();
+      }
 
-    switch (Entry.Kind) {
-    case BitstreamEntry::SubBlock: {
-      LLVM_DEBUG(dbgs() << "[BitstreamEntry::SubBlock]\tID: " << Entry.ID << "\n");
-      BlockID = Entry.ID;
-      RETURN_IF_ERROR(Cursor.EnterSubBlock(Entry.ID));
-      Writer.EnterSubblock(Entry.ID, Cursor.getAbbrevIDWidth());
-      break;
+      Result.Data.emplace(Rewrite->size(), '\0');
+      Rewrite->writeTo(Result.Data->data());
+      ImportStats::get().add(ImportStats::BytesOut, Result.Data->size());
+      return Error::success();
+    };
+    if (Error Err = Remap()) {
+      Result.Data.reset();
+      Result.Error = ("source-info-import: " + Name + ": " + toString(std::move(Err))).str();
     }
-    case BitstreamEntry::EndBlock: {
-      LLVM_DEBUG(dbgs() << "[BitstreamEntry::EndBlock]\n");
-      Writer.ExitBlock();
-      NumAbbrevs = 0;
-      break;
+    Log.flush();
+    return Result;
+  };
+
+  size_t NumFailed;
+  RETURN_IF_ERROR(rewriteTarStream(InFD, OutFD, NumJobs, IsSourceInfo, RemapEntry, llvm::errs())
+                      .moveInto(NumFailed));
+  return NumFailed == 0 ? 0 : 1;
+}
+
+// Runs `Check` on every file, in parallel, and reports the ones that fail in order, followed by how
+// many are `Passed`. Returns 0 if all of them pass, and 1 otherwise.
+static int checkEachFile(const std::vector<std::string> &Inputs,
+                         function_ref<Error(const SourceInfo &SI)> Check, StringRef Passed) {
+  std::vector<std::string> Errors(Inputs.size());
+  {
+    WorkStealingThreadPool Pool(NumJobs);
+    for (size_t I = 0; I < Inputs.size(); I++) {
+      Pool.async([&, I] {
+        FileScope File(Inputs[I]);
+        std::unique_ptr<SourceInfo> SI;
+        Error Err = SourceInfo::open(Inputs[I]).moveInto(SI);
+        if (!Err)
+          Err = Check(*SI);
+        if (Err)
+          Errors[I] = toString(std::move(Err));
+      });
     }
-    case BitstreamEntry::Record: {
-      LLVM_DEBUG(dbgs() << "[BitstreamEntry::Record]\t");
-      if (Entry.ID == bitc::DEFINE_ABBREV) {
-        LLVM_DEBUG(dbgs() << "bitc::DEFINE_ABBREV\t");
-        RETURN_IF_ERROR(Cursor.ReadAbbrevRecord());
-
-        NumAbbrevs++;
-
-        auto AbbvID = NumAbbrevs + bitc::FIRST_APPLICATION_ABBREV - 1;
-        Expected<const BitCodeAbbrev *> MaybeAbbv = Cursor.getAbbrev(AbbvID);
-        if (!MaybeAbbv)
-          return MaybeAbbv.takeError();
-        auto Abbv = MaybeAbbv.get();
-        LLVM_DEBUG(dbgs() << "NumOperand: " << Abbv->getNumOperandInfos() << "\n");
-
-        Writer.EmitAbbrev(std::make_shared<BitCodeAbbrev>(*Abbv));
-
-      } else {
-        SmallVector<uint64_t, 64> Record;
-        StringRef Blob;
-        unsigned Code;
-
-        RETURN_IF_ERROR(Cursor.readRecord(Entry.ID, Record, &Blob).moveInto(Code))
-
-        if (Entry.ID == bitc::UNABBREV_RECORD) {
-          LLVM_DEBUG(dbgs() << "bitc::UNABBREV_RECORD\n");
-          Writer.EmitRecord(Code, Record);
-        } else {
-          LLVM_DEBUG(dbgs() << "RecordID: " << Entry.ID << "\n");
-          Record.insert(Record.begin(), Code);
-          if (BlockID == DECL_LOCS_BLOCK_ID) {
-            if (Entry.ID == SOURCE_FILE_LIST_ABBREV_ID) {
-              Blob = SSI.SourceFileListData;
-            } else if (Entry.ID == BASIC_DECL_LOCS_ABBREV_ID) {
-              Blob = SSI.BasicDeclLocsData;
-            } else if (Entry.ID == TEXT_DATA_ABBREV_ID) {
-              Blob = SSI.TextDataData;
-            } else if (Entry.ID == DOC_RANGES_ABBREV_ID) {
-              Blob = SSI.DocRangesData;
-            } else if (Entry.ID == DECL_USRS_ABBREV_ID) {
-              // We don't need to rewrite DeclUSRsData, because it doesn't reference any file paths.
+  }
+
+  size_t NumFailed = 0;
+  for (size_t I = 0; I < Inputs.size(); I++) {
+    if (Errors[I].empty())
+      continue;
+    NumFailed++;
+    llvm::errs() << "source-info-import: " << Inputs[I] << ": " << Errors[I] << "\n";
+  }
+  if (!Quiet)
+    llvm::errs() << llvm::formatv("source-info-import: {0} of {1} files are {2}.\n",
+                                  Inputs.size() - NumFailed, Inputs.size(), Passed);
+  return NumFailed == 0 ? 0 : 1;
+}
+
+// Checks that every file is already normalized
+static int runCheckNormalized(const std::vector<std::string> &Inputs,
+                              const FilePathRemapper &FPathRemapper) {
+  return checkEachFile(
+      Inputs,
+      [&](const SourceInfo &SI) -> Error {
+        if (Verify)
+          RETURN_IF_ERROR(SI.verify());
+        return SI.checkNormalized(FPathRemapper, getNormalizeOptions());
+      },
+      "normalized");
+}
+
+// Checks the source files of every input against the local files their remapped paths name, and
+// prints the ones that are missing or changed, in the order of the inputs. The inputs are parsed
+// in parallel, then each local file is stat'ed once, however many inputs name it, in parallel
+// batches. A zero timestamp, as written by --zero-timestamps, only has its size compared. Returns
+// 0 if every source file is fresh, and 1 otherwise.
+static int runCheckFresh(const std::vector<std::string> &Inputs,
+                         const FilePathRemapper &FPathRemapper) {
+  // What a source file record says, with its path remapped
+  struct BuiltSource {
+    StringRef Path;
+    uint64_t Size;
+    uint64_t Timestamp;
+  };
+  struct CheckedFile {
+    std::unique_ptr<SourceInfo> SI;
+    std::vector<BuiltSource> Sources;
+    std::string Error;
+  };
+  std::vector<CheckedFile> Files(Inputs.size());
+
+  struct LocalFile {
+    std::error_code EC;
+    uint64_t Size = 0;
+    uint64_t Timestamp = 0;
+  };
+  StringMap<LocalFile> LocalFiles;
+
+  {
+    WorkStealingThreadPool Pool(NumJobs);
+    for (size_t I = 0; I < Inputs.size(); I++) {
+      Pool.async([&, I] {
+        FileScope File(Inputs[I]);
+        CheckedFile &Checked = Files[I];
+        if (Error Err = verifyInput(SourceInfo::open(Inputs[I])).moveInto(Checked.SI)) {
+          Checked.Error = toString(std::move(Err));
+          return;
+        }
+        Checked.SI->withLayout([&](auto L) {
+          for (const auto &Record : Checked.SI->getSourceFiles<decltype(L)>()) {
+            Expected<StringRef> Path = Checked.SI->getFilePath(Record.FileID);
+            if (!Path) {
+              Checked.Error = toString(Path.takeError());
+              return;
             }
+            Checked.Sources.push_back(
+                {FPathRemapper.remap(*Path), Record.FileSize, Record.Timestamp});
           }
-          Writer.EmitRecordWithBlob(Entry.ID, Record, Blob);
+        });
+      });
+    }
+    Pool.wait();
+
+    for (const CheckedFile &Checked : Files)
+      for (const BuiltSource &Source : Checked.Sources)
+        LocalFiles.try_emplace(Source.Path);
+
+    const size_t BatchSize = 256;
+    std::vector<StringMapEntry<LocalFile> *> Batch;
+    auto StatBatch = [&] {
+      Pool.async([Batch = std::move(Batch)] {
+        for (StringMapEntry<LocalFile> *Entry : Batch) {
+          sys::fs::file_status Status;
+          LocalFile &Local = Entry->getValue();
+          if ((Local.EC = sys::fs::status(Entry->getKey(), Status)))
+            continue;
+          Local.Size = Status.getSize();
+          Local.Timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                Status.getLastModificationTime().time_since_epoch())
+                                .count();
         }
-      }
-      break;
+      });
+      Batch.clear();
+    };
+    for (StringMapEntry<LocalFile> &Entry : LocalFiles) {
+      Batch.push_back(&Entry);
+      if (Batch.size() == BatchSize)
+        StatBatch();
+    }
+    if (!Batch.empty())
+      StatBatch();
+  }
+
+  size_t NumRecords = 0, NumStale = 0, NumFailed = 0;
+  for (size_t I = 0; I < Inputs.size(); I++) {
+    const CheckedFile &Checked = Files[I];
+    if (!Checked.Error.empty()) {
+      NumFailed++;
+      llvm::errs() << "source-info-import: " << Inputs[I] << ": " << Checked.Error << "\n";
+      continue;
     }
-    default:
-      return UNEXPECTED_BIT_ERROR;
+
+    for (const auto &[Path, Size, Timestamp] : Checked.Sources) {
+      NumRecords++;
+      const LocalFile &Local = LocalFiles.find(Path)->getValue();
+      std::string Reason;
+      if (Local.EC == std::errc::no_such_file_or_directory)
+        Reason = "missing";
+      else if (Local.EC)
+        Reason = Local.EC.message();
+      else if (Local.Size != Size)
+        Reason = formatv("{0} bytes, expected {1}", Local.Size, Size);
+      else if (Timestamp != 0 && Local.Timestamp != Timestamp)
+        Reason = "modified since it was built";
+      else
+        continue;
+      NumStale++;
+      llvm::outs() << Inputs[I] << ": " << Path << ": " << Reason << "\n";
     }
   }
-  return Error::success();
+
+  if (!Quiet)
+    llvm::errs() << formatv("source-info-import: {0} of {1} source files are fresh ({2} local "
+                            "files checked).\n",
+                            NumRecords - NumStale, NumRecords, LocalFiles.size());
+  return NumStale == 0 && NumFailed == 0 ? 0 : 1;
 }
 
-static Expected<std::unique_ptr<MemoryBuffer>> openBitcodeFile(StringRef Path) {
-  Expected<std::unique_ptr<MemoryBuffer>> MemBufOrErr =
-      errorOrToExpected(MemoryBuffer::getFileOrSTDIN(Path));
-  if (Error E = MemBufOrErr.takeError())
-    return std::move(E);
+// Compares two files and writes the changes to `OS`, after a `diff` line naming them if
+// `WithHeader`. Returns whether they differ.
+static Expected<bool> diffFiles(StringRef OldPath, StringRef NewPath, raw_ostream &OS,
+                                bool WithHeader) {
+  auto Open = [](StringRef Path) -> Expected<std::unique_ptr<SourceInfo>> {
+    Expected<std::unique_ptr<SourceInfo>> SI = verifyInput(SourceInfo::open(Path));
+    if (!SI)
+      return createStringError(std::errc::invalid_argument, "%s: %s", Path.str().c_str(),
+                               toString(SI.takeError()).c_str());
+    return SI;
+  };
+  std::unique_ptr<SourceInfo> Old, New;
+  RETURN_IF_ERROR(Open(OldPath).moveInto(Old));
+  RETURN_IF_ERROR(Open(NewPath).moveInto(New));
+  std::vector<SourceInfoChange> Changes = diffSourceInfo(*Old, *New, BriefDiff);
+  if (Changes.empty())
+    return false;
+  if (Quiet)
+    return true;
 
-  std::unique_ptr<MemoryBuffer> MemBuf = std::move(*MemBufOrErr);
-  return std::move(MemBuf);
+  if (BriefDiff) {
+    OS << "Files " << OldPath << " and " << NewPath << " differ\n";
+  } else {
+    if (WithHeader)
+      OS << "diff " << OldPath << " " << NewPath << "\n";
+    printSourceInfoChanges(Changes, OutputFormat, OS);
+  }
+  return true;
 }
 
-int main(int argc, char **argv) {
-  InitLLVM X(argc, argv);
-  cl::ParseCommandLineOptions(argc, argv,
-                              "The utility to inspect and remap .swiftsourceinfo file.\n");
+// Compares two files, or the .swiftsourceinfo files at the same relative paths under two
+// directories. The pairs are compared in parallel and printed in the order of their paths, and a
+// file only under one directory is reported as `Only in <dir>: <path>`. Returns 0 if everything is
+// the same, 1 if anything differs and 2 if anything failed.
+static int runDiff(StringRef OldPath, StringRef NewPath) {
+  // Like diff(1), trouble is 2 rather than the usual 1
+  auto Fail = [](Error Err) {
+    llvm::errs() << "source-info-import: " << toString(std::move(Err)) << "\n";
+    return 2;
+  };
+  if (OldPath == "" || NewPath == "")
+    return Fail(createStringError(std::errc::invalid_argument,
+                                  "--diff requires the two files or directories to compare."));
+  bool OldIsDir = sys::fs::is_directory(OldPath);
+  if (OldIsDir != sys::fs::is_directory(NewPath))
+    return Fail(createStringError(std::errc::invalid_argument,
+                                  "--diff compares two files or two directories."));
+  if (!OldIsDir) {
+    Expected<bool> Differs = diffFiles(OldPath, NewPath, llvm::outs(), /*WithHeader=*/false);
+    if (!Differs)
+      return Fail(Differs.takeError());
+    return *Differs ? 1 : 0;
+  }
+  if (!BriefDiff && OutputFormat != DumpFormat::Text)
+    return Fail(createStringError(std::errc::invalid_argument,
+                                  "--format only applies to --diff of two files; use --brief "
+                                  "to compare directories."));
 
-  ExitOnError ExitOnErr("source-info-import: ");
+  // The relative paths under each directory, sorted so the two lists can be merged
+  auto CollectRelative = [](StringRef Dir, std::vector<std::string> &Files) -> Error {
+    RETURN_IF_ERROR(collectSourceInfoFiles(Dir).moveInto(Files));
+    for (std::string &Path : Files)
+      Path = sys::path::relative_path(StringRef(Path).drop_front(Dir.size())).str();
+    llvm::sort(Files);
+    return Error::success();
+  };
+  std::vector<std::string> OldFiles, NewFiles;
+  if (Error Err = CollectRelative(OldPath, OldFiles))
+    return Fail(std::move(Err));
+  if (Error Err = CollectRelative(NewPath, NewFiles))
+    return Fail(std::move(Err));
 
-  if (InputFilename == "")
-    ExitOnErr(createStringError(std::errc::invalid_argument, "The input file is required."));
+  struct Entry {
+    std::string Path;
+    bool InOld = false, InNew = false;
+    // What comparing the pair printed, or its error
+    std::string Output, Error;
+    bool Differs = false;
+  };
+  std::vector<Entry> Entries;
+  for (size_t I = 0, J = 0; I < OldFiles.size() || J < NewFiles.size();) {
+    Entry E;
+    if (J == NewFiles.size() || (I < OldFiles.size() && OldFiles[I] < NewFiles[J])) {
+      E.Path = OldFiles[I++];
+      E.InOld = true;
+    } else if (I == OldFiles.size() || NewFiles[J] < OldFiles[I]) {
+      E.Path = NewFiles[J++];
+      E.InNew = true;
+    } else {
+      E.Path = OldFiles[I++];
+      E.InOld = E.InNew = true;
+      J++;
+    }
+    Entries.push_back(std::move(E));
+  }
 
-  std::unique_ptr<MemoryBuffer> MB = ExitOnErr(openBitcodeFile(InputFilename));
-  llvm::BitstreamCursor Cursor{MB.get()->getMemBufferRef()};
+  auto Under = [](StringRef Dir, StringRef Path) {
+    SmallString<256> Full(Dir);
+    sys::path::append(Full, Path);
+    return std::string(Full.str());
+  };
+  {
+    WorkStealingThreadPool Pool(NumJobs);
+    for (Entry &E : Entries) {
+      if (!E.InOld || !E.InNew)
+        continue;
+      Pool.async([&] {
+        std::string OldFile = Under(OldPath, E.Path), NewFile = Under(NewPath, E.Path);
+        FileScope File(OldFile);
+        raw_string_ostream OS(E.Output);
+        Expected<bool> Differs = diffFiles(OldFile, NewFile, OS, /*WithHeader=*/true);
+        if (!Differs)
+          E.Error = toString(Differs.takeError());
+        else
+          E.Differs = *Differs;
+      });
+    }
+  }
 
-  if (!checkMagicNumber(Cursor)) {
-    ExitOnErr(createStringError(std::errc::invalid_argument,
-                                "The input is not a .swiftsourceinfo file."));
+  size_t NumDiffering = 0, NumFailed = 0;
+  for (Entry &E : Entries) {
+    if (!E.InOld || !E.InNew) {
+      NumDiffering++;
+      if (!Quiet)
+        llvm::outs() << "Only in " << (E.InOld ? OldPath : NewPath) << ": " << E.Path << "\n";
+    } else if (!E.Error.empty()) {
+      NumFailed++;
+      llvm::outs().flush();
+      llvm::errs() << "source-info-import: " << E.Error << "\n";
+    } else if (E.Differs) {
+      NumDiffering++;
+      llvm::outs() << E.Output;
+    }
   }
+  llvm::outs().flush();
+  if (!Quiet)
+    llvm::errs() << llvm::formatv("source-info-import: {0} of {1} files differ, {2} failed.\n",
+                                  NumDiffering, Entries.size(), NumFailed);
+  return NumFailed > 0 ? 2 : NumDiffering > 0 ? 1 : 0;
+}
+
+// Module names are taken from the paths: `Foo` for `Foo.swiftmodule/Project/<triple>.swiftsourceinfo`
+// and for `Foo.swiftsourceinfo`.
+static StringRef moduleNameFromPath(StringRef Path) {
+  for (auto It = sys::path::rbegin(Path), End = sys::path::rend(Path); It != End; ++It) {
+    if (It->endswith(".swiftmodule"))
+      return It->drop_back(StringRef(".swiftmodule").size());
+  }
+  return sys::path::stem(Path);
+}
+
+// Reads the files on a work-stealing pool, then merges their USRs in path order, so the index
+// doesn't depend on the scheduling. A failed file is reported and left out. Returns 0 if every file
+// was indexed, 1 if some failed and 2 if all of them failed.
+static Expected<int> runBuildIndex(std::vector<std::string> Inputs, StringRef IndexPath) {
+  llvm::sort(Inputs);
 
-  Expected<std::unique_ptr<SwiftSourceInfo>> MaybeSourceInfo = parseSwiftSourceInfo(Cursor);
-  if (!MaybeSourceInfo)
-    ExitOnErr(MaybeSourceInfo.takeError());
+  struct IndexedFile {
+    std::unique_ptr<SourceInfo> SI;
+    std::vector<std::pair<StringRef, SwiftSourceInfo::DeclLocation>> Decls;
+    std::string Error;
+  };
+  std::vector<IndexedFile> Files(Inputs.size());
 
-  std::unique_ptr<SwiftSourceInfo> SSI = std::move(MaybeSourceInfo.get());
-  if (PathRemaps.size() > 0) {
-    FilePathRemapper FPathRemapper;
-    for (const auto &remap : PathRemaps) {
-      auto divider = remap.find('=');
-      auto pattern = remap.substr(0, divider);
-      std::regex re(pattern);
-      auto replacement = remap.substr(divider + 1);
-      FPathRemapper.addRemap(re, replacement);
+  {
+    WorkStealingThreadPool Pool(NumJobs);
+    for (size_t I = 0; I < Inputs.size(); I++) {
+      Pool.async([&, I] {
+        IndexedFile &File = Files[I];
+        if (Error Err = verifyInput(SourceInfo::open(Inputs[I])).moveInto(File.SI)) {
+          File.Error = toString(std::move(Err));
+          return;
+        }
+        File.SI->forEachUSR([&](StringRef USR, const SwiftSourceInfo::DeclLocation &Loc) {
+          File.Decls.emplace_back(USR, Loc);
+        });
+      });
     }
+  }
 
-    if (OutputFilename == "") {
-      ExitOnErr(createStringError(std::errc::invalid_argument,
-                                  "The destination file is required when --remap is specified."));
+  USRIndexBuilder Builder;
+  size_t NumFailed = 0;
+  for (size_t I = 0; I < Inputs.size(); I++) {
+    IndexedFile &File = Files[I];
+    if (!File.Error.empty()) {
+      NumFailed++;
+      llvm::errs() << "source-info-import: " << Inputs[I] << ": " << File.Error << "\n";
+      continue;
     }
+    StringRef Module = moduleNameFromPath(Inputs[I]);
+    for (const auto &[USR, Loc] : File.Decls)
+      Builder.add(USR, Module, Loc.FilePath, Loc.Line, Loc.Column);
+  }
+  RETURN_IF_ERROR(Builder.write(IndexPath));
 
-    FileIDRemapper FIDRemapper(FPathRemapper);
-    SSI.get()->remapFilePath(FIDRemapper, Quiet);
+  if (!Quiet || NumFailed > 0)
+    llvm::errs() << llvm::formatv(
+        "source-info-import: indexed {0} USRs from {1} of {2} files, {3} failed.\n",
+        Builder.size(), Inputs.size() - NumFailed, Inputs.size(), NumFailed);
 
-    // Write the remapped source info to the output file
-    SmallVector<char, 0> Buffer;
-    BitstreamWriter Writer{Buffer};
-    if (Error Err = rewriteSwiftSourceInfo(*SSI.get(), Cursor, Writer)) {
-      ExitOnErr(std::move(Err));
+  if (NumFailed == 0)
+    return 0;
+  return NumFailed == Inputs.size() ? 2 : 1;
+}
+
+// Answers each of the --lookup USRs with `Lookup`, which prints the result and returns false if
+// the USR isn't found. With `-`, the USRs are read from stdin and answered one line at a time, so
+// an editor can keep the process open. Returns 1 if any USR isn't found.
+static int answerLookups(function_ref<bool(StringRef USR)> Lookup) {
+  int ExitCode = 0;
+  auto Answer = [&](StringRef USR) {
+    if (!Lookup(USR)) {
+      llvm::errs() << "source-info-import: " << USR << " is not found.\n";
+      ExitCode = 1;
     }
+  };
 
-    // Write the buffer the output file
-    std::error_code EC;
-    raw_fd_ostream OutFile(OutputFilename, EC);
-    if (EC)
-      ExitOnErr(createStringError(EC, EC.message()));
-    OutFile.write(reinterpret_cast<const char *>(Buffer.data()), Buffer.size());
+  for (const std::string &USR : LookupUSRs) {
+    if (USR != "-") {
+      Answer(USR);
+      continue;
+    }
+    std::string Line;
+    while (std::getline(std::cin, Line)) {
+      StringRef USR = StringRef(Line).trim();
+      if (USR.empty())
+        continue;
+      Answer(USR);
+      llvm::outs().flush();
+    }
+  }
+  return ExitCode;
+}
+
+// Prints `<USR>\t<path>:<line>:<column>` and returns true if the USR is found
+static bool printLookup(const SourceInfo &SI, StringRef USR, raw_ostream &OS) {
+  auto Loc = SI.lookupUSR(USR);
+  if (Loc)
+    OS << USR << '\t' << Loc->FilePath << ':' << Loc->Line << ':' << Loc->Column << '\n';
+  return Loc.has_value();
+}
+
+static Expected<int> runLookup(StringRef InputPath) {
+  std::unique_ptr<SourceInfo> SI;
+  RETURN_IF_ERROR(verifyInput(SourceInfo::open(InputPath)).moveInto(SI));
+
+  return answerLookups([&](StringRef USR) { return printLookup(*SI, USR, llvm::outs()); });
+}
+
+// Prints `<USR>\t<module>\t<path>:<line>:<column>` for each of the --lookup USRs
+static Expected<int> runIndexLookup(StringRef IndexPath) {
+  std::unique_ptr<USRIndex> Index;
+  RETURN_IF_ERROR(USRIndex::open(IndexPath).moveInto(Index));
+
+  return answerLookups([&](StringRef USR) {
+    auto Entry = Index->lookup(USR);
+    if (Entry)
+      llvm::outs() << USR << '\t' << Entry->Module << '\t' << Entry->FilePath << ':'
+                   << Entry->Line << ':' << Entry->Column << '\n';
+    return Entry.has_value();
+  });
+}
+
+// The --format names, which an `inspect` request to the server carries
+static StringRef getDumpFormatName(DumpFormat Format) {
+  switch (Format) {
+  case DumpFormat::Text:
+    return "text";
+  case DumpFormat::NDJSON:
+    return "ndjson";
+  case DumpFormat::JSON:
+    return "json";
+  case DumpFormat::TSV:
+    return "tsv";
+  }
+  llvm_unreachable("Unknown dump format");
+}
+
+static std::optional<DumpFormat> parseDumpFormat(StringRef Name) {
+  for (DumpFormat Format :
+       {DumpFormat::Text, DumpFormat::NDJSON, DumpFormat::JSON, DumpFormat::TSV})
+    if (getDumpFormatName(Format) == Name)
+      return Format;
+  return std::nullopt;
+}
+
+// Runs a request from a --connect client: `remap <input> <output>`, `inspect <input> [<format>]`
+// or `lookup <input> <USR>...`. The client sends absolute paths, since its working directory isn't
+// ours.
+static int handleServeRequest(ArrayRef<StringRef> Args, raw_ostream &Out, raw_ostream &Err,
+                              const FilePathRemapper &FPathRemapper) {
+  // Errors name the input, like in batch mode
+  auto Fail = [&](Error E) {
+    Err << "source-info-import: ";
+    if (Args.size() > 1)
+      Err << Args[1] << ": ";
+    Err << toString(std::move(E)) << "\n";
+    return 1;
+  };
+
+  StringRef Command = Args.front();
+  if (Command == "remap" && Args.size() == 3) {
+    if (!rewritesFiles())
+      return Fail(createStringError(std::errc::invalid_argument,
+                                    "The server was started without --remap or --normalize."));
+    if (Error E = remapFile(Args[1], Args[2], FPathRemapper, Out))
+      return Fail(std::move(E));
+    return 0;
+  }
+
+  if ((Command == "inspect" && (Args.size() == 2 || Args.size() == 3)) ||
+      (Command == "lookup" && Args.size() > 2)) {
+    std::optional<DumpFormat> Format = DumpFormat::Text;
+    if (Command == "inspect" && Args.size() == 3)
+      Format = parseDumpFormat(Args[2]);
+    if (!Format)
+      return Fail(createStringError(std::errc::invalid_argument, "Unknown format '%s'.",
+                                    Args[2].str().c_str()));
+    std::unique_ptr<SourceInfo> SI;
+    if (Error E = verifyInput(SourceInfo::open(Args[1])).moveInto(SI))
+      return Fail(std::move(E));
+    if (Command == "inspect") {
+      dumpSourceInfo(*SI, *Format, Out);
+      return 0;
+    }
+
+    int ExitCode = 0;
+    for (StringRef USR : Args.drop_front(2)) {
+      if (!printLookup(*SI, USR, Out)) {
+        Err << "source-info-import: " << USR << " is not found.\n";
+        ExitCode = 1;
+      }
+    }
+    return ExitCode;
+  }
+
+  return Fail(createStringError(std::errc::invalid_argument, "Unknown request '%s'.",
+                                Command.str().c_str()));
+}
+
+// Turns the command line into a request to the --connect server, and prints its response
+static Expected<int> runClient(StringRef SocketPath) {
+  SmallString<256> Input(InputFilename);
+  SmallString<256> Output(OutputFilename);
+  std::vector<StringRef> Args;
+  if (ShutdownServer) {
+    Args = {"shutdown"};
+  } else {
+    if (InputFilename == "")
+      return createStringError(std::errc::invalid_argument, "The input file is required.");
+    RETURN_IF_ERROR(errorCodeToError(sys::fs::make_absolute(Input)));
+
+    if (!LookupUSRs.empty()) {
+      Args = {"lookup", Input};
+      for (const std::string &USR : LookupUSRs) {
+        if (USR == "-")
+          return createStringError(std::errc::invalid_argument,
+                                   "--lookup=- is not supported with --connect.");
+        Args.push_back(USR);
+      }
+    } else if (OutputFilename != "") {
+      RETURN_IF_ERROR(errorCodeToError(sys::fs::make_absolute(Output)));
+      Args = {"remap", Input, Output};
+    } else {
+      Args = {"inspect", Input, getDumpFormatName(OutputFormat)};
+    }
+  }
+
+  int FD;
+  RETURN_IF_ERROR(connectToServer(SocketPath).moveInto(FD));
+  Expected<ServeResponse> Response = sendServeRequest(FD, Args);
+  ::close(FD);
+  if (!Response)
+    return Response.takeError();
+
+  llvm::outs() << Response->Output;
+  llvm::errs() << Response->Errors;
+  return Response->ExitCode;
+}
+
+// Runs the mode the options select and returns the exit code
+static int run() {
+  if (CacheDir != "" && ConnectSocket == "")
+    OutputCache = ExitOnErr(ResultCache::open(CacheDir, CacheSizeMB << 20, getConfigDigest()));
+
+  if (ConnectSocket != "")
+    return ExitOnErr(runClient(ConnectSocket));
+
+  if (ServeSocket != "") {
+    FilePathRemapper FPathRemapper = ExitOnErr(buildPathRemapper());
+    {
+      SourceInfoServer Server(
+          ServeSocket,
+          [&](ArrayRef<StringRef> Args, raw_ostream &Out, raw_ostream &Err) {
+            return handleServeRequest(Args, Out, Err, FPathRemapper);
+          },
+          NumJobs);
+      ExitOnErr(Server.run());
+    }
+    recordPathCacheStats(FPathRemapper);
+    return 0;
+  }
+
+  if (BuildIndex != "") {
+    if (InputDir == "")
+      ExitOnErr(createStringError(std::errc::invalid_argument,
+                                  "--input-dir is required when --build-index is specified."));
+    return ExitOnErr(runBuildIndex(ExitOnErr(collectSourceInfoFiles(InputDir)), BuildIndex));
+  }
+
+  if (IndexFile != "") {
+    if (LookupUSRs.empty())
+      ExitOnErr(createStringError(std::errc::invalid_argument,
+                                  "--lookup is required when --index is specified."));
+    return ExitOnErr(runIndexLookup(IndexFile));
+  }
+
+  if (CheckNormalized) {
+    if (InputDir == "" && InputFilename == "")
+      ExitOnErr(createStringError(std::errc::invalid_argument,
+                                  "The input file or --input-dir is required."));
+    FilePathRemapper FPathRemapper = ExitOnErr(buildPathRemapper());
+    std::vector<std::string> Inputs = InputDir != ""
+                                          ? ExitOnErr(collectSourceInfoFiles(InputDir))
+                                          : std::vector<std::string>{InputFilename};
+    return runCheckNormalized(Inputs, FPathRemapper);
+  }
+
+  if (CheckFresh) {
+    if (InputDir == "" && InputFilename == "")
+      ExitOnErr(createStringError(std::errc::invalid_argument,
+                                  "The input file or --input-dir is required."));
+    FilePathRemapper FPathRemapper = ExitOnErr(buildPathRemapper());
+    std::vector<std::string> Inputs = InputDir != ""
+                                          ? ExitOnErr(collectSourceInfoFiles(InputDir))
+                                          : std::vector<std::string>{InputFilename};
+    int ExitCode = runCheckFresh(Inputs, FPathRemapper);
+    recordPathCacheStats(FPathRemapper);
+    return ExitCode;
+  }
+
+  if (Diff)
+    return runDiff(InputFilename, OutputFilename);
+
+  // With nothing else to do, --verify only checks the input or the files under --input-dir
+  if (Verify && !rewritesFiles() && ScanDir == "" && !TarMode && BatchManifest == "" &&
+      OutputDir == "" && LookupUSRs.empty()) {
+    if (InputDir == "" && InputFilename == "")
+      ExitOnErr(createStringError(std::errc::invalid_argument,
+                                  "The input file or --input-dir is required."));
+    std::vector<std::string> Inputs = InputDir != ""
+                                          ? ExitOnErr(collectSourceInfoFiles(InputDir))
+                                          : std::vector<std::string>{InputFilename};
+    return checkEachFile(Inputs, [](const SourceInfo &SI) { return SI.verify(); }, "valid");
+  }
+
+  if (ScanDir != "") {
+    if (!rewritesFiles())
+      return runScan(ScanDir, nullptr);
+    FilePathRemapper FPathRemapper = ExitOnErr(buildPathRemapper());
+    int ExitCode = runScan(ScanDir, &FPathRemapper);
+    recordPathCacheStats(FPathRemapper);
+    return ExitCode;
+  }
+
+  if (TarMode) {
+    FilePathRemapper FPathRemapper = ExitOnErr(buildPathRemapper());
+    int ExitCode = ExitOnErr(runTar(FPathRemapper));
+    recordPathCacheStats(FPathRemapper);
+    return ExitCode;
+  }
+
+  if (BatchManifest != "" || InputDir != "") {
+    if (InputDir != "" && OutputDir == "")
+      ExitOnErr(createStringError(std::errc::invalid_argument,
+                                  "--output-dir is required when --input-dir is specified."));
+
+    FilePathRemapper FPathRemapper = ExitOnErr(buildPathRemapper());
+    FilePairs Pairs = BatchManifest != "" ? ExitOnErr(readBatchManifest(BatchManifest))
+                                          : ExitOnErr(collectDirectoryPairs(InputDir, OutputDir));
+    int ExitCode = runBatch(Pairs, FPathRemapper);
+    recordPathCacheStats(FPathRemapper);
+    return ExitCode;
+  }
+
+  if (InputFilename == "")
+    ExitOnErr(createStringError(std::errc::invalid_argument, "The input file is required."));
+
+  if (!LookupUSRs.empty())
+    return ExitOnErr(runLookup(InputFilename));
+
+  if (rewritesFiles()) {
+    if (OutputFilename == "") {
+      ExitOnErr(createStringError(
+          std::errc::invalid_argument,
+          "The destination file is required when --remap or --normalize is specified."));
+    }
+
+    FilePathRemapper FPathRemapper = ExitOnErr(buildPathRemapper());
+    unsigned PatchThreads = NumJobs ? NumJobs : std::max(1u, std::thread::hardware_concurrency());
+    ExitOnErr(
+        remapFile(InputFilename, OutputFilename, FPathRemapper, llvm::outs(), PatchThreads));
+    recordPathCacheStats(FPathRemapper);
   } else {
-    // If no --remap is specified, it dumps the original file content.
-    SSI.get()->printContent();
+    // If neither --remap nor --normalize is specified, it dumps the original file content.
+    FileScope File(InputFilename);
+    std::unique_ptr<SourceInfo> SI = ExitOnErr(SourceInfo::open(InputFilename));
+    unsigned DumpThreads = NumJobs ? NumJobs : std::max(1u, std::thread::hardware_concurrency());
+    dumpSourceInfo(*SI, OutputFormat, llvm::outs(), DumpThreads);
   }
 
   return 0;
 }
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "The utility to inspect and remap .swiftsourceinfo file.\n");
+
+  bool PrintStats = AreStatisticsEnabled();
+  if (PrintStats)
+    ImportStats::get().enable();
+  if (TimeTrace != "")
+    FileScope::startTracing();
+
+  auto Start = std::chrono::steady_clock::now();
+  int ExitCode = run();
+  if (OutputCache)
+    OutputCache->trim();
+  std::chrono::duration<double> Wall = std::chrono::steady_clock::now() - Start;
+
+  llvm::outs().flush();
+  if (PrintStats)
+    ImportStats::get().print(llvm::errs(), Wall.count());
+  if (TimeTrace != "") {
+    ExitOnErr(timeTraceProfilerWrite(TimeTrace, InputFilename));
+    timeTraceProfilerCleanup();
+  }
+  return ExitCode;
+}